@@ -0,0 +1,385 @@
+#ifndef SIML_BIN_H_INCLUDED
+#define SIML_BIN_H_INCLUDED
+
+/*
+ * SIML compiled form v0.1
+ *
+ * Companion to siml-dom.h. Stores a document tree as an image (a .simlb
+ * file) that loads without parsing: a header, the node table, then one pool
+ * holding every key and value.
+ *
+ *   magic "SIMLBIN1", node count, pool length
+ *   per node: kind, style, comment_spaces, child_count, first_child,
+ *             next_sibling, key offset and length, value offset and length,
+ *             line
+ *   pool
+ *
+ * Numbers are 32-bit little-endian except kind and style (one byte) and
+ * comment_spaces (two bytes), so an image is 16 + 36 * nodes + pool bytes
+ * and reads the same on every host.
+ *
+ * siml_bin_load() turns a mapped image back into a siml_dom whose keys and
+ * values point into the image: one pass over the node table, with no text
+ * to scan or validate. It checks every link and offset, so a damaged or
+ * hostile image is rejected rather than trusted.
+ *
+ * A tree built with keep_comments from a buffer parser keeps comments,
+ * inline comment spacing, "---" separators and the final newline.
+ * siml_bin_decompile() replays the tree through siml_emitter, so its text
+ * has the layout siml-roundtrip checks (two-space indentation, no trailing
+ * blanks); for input in that layout the result is the source, byte for
+ * byte.
+ *
+ * Define SIML_IMPLEMENTATION in exactly one translation unit, as for siml.h.
+ */
+
+#include "siml-dom.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h> /* size_t */
+
+/* Compile the complete tree d into a new image of *len bytes, which the
+ * caller frees. Returns NULL when out of memory or when the pool would
+ * not fit 32-bit offsets.
+ */
+char *siml_bin_compile(const siml_dom *d, size_t *len);
+
+/* Replace the tree in d with the one stored in image (len bytes), which
+ * must outlive the tree. Returns SIML_DOM_DONE, SIML_DOM_ERROR for an
+ * invalid image, or SIML_DOM_NO_MEMORY; errors are set as for
+ * siml_dom_build(). Lookup indexes are built on demand as usual.
+ */
+siml_dom_result siml_bin_load(siml_dom *d, const char *image, size_t len);
+
+/* Write the text of the complete tree d into a new buffer of *len bytes,
+ * which the caller frees. Returns NULL when out of memory.
+ */
+char *siml_bin_decompile(const siml_dom *d, size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* ---------------- Implementation ---------------- */
+#ifdef SIML_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SIML_BIN_HEADER 16
+#define SIML_BIN_NODE   36
+
+static const char siml_bin_magic[8] = { 'S', 'I', 'M', 'L', 'B', 'I', 'N', '1' };
+
+char *siml_bin_compile(const siml_dom *d, size_t *len) {
+    size_t pool = 0;
+    size_t size;
+    unsigned int i;
+    unsigned char *image;
+    unsigned char *out;
+    char *text;
+
+    if (!d || !len || d->count == 0 || d->building) return 0;
+    for (i = 0; i < d->count; ++i) {
+        pool += d->nodes[i].key.len + d->nodes[i].value.len;
+        if (pool > 0xFFFFFFFFul) return 0;
+    }
+    if (d->count > (0xFFFFFFFFul - pool - SIML_BIN_HEADER) / SIML_BIN_NODE) {
+        return 0;
+    }
+    size = SIML_BIN_HEADER + (size_t)d->count * SIML_BIN_NODE + pool;
+    image = (unsigned char *)malloc(size);
+    if (!image) return 0;
+
+    memcpy(image, siml_bin_magic, sizeof(siml_bin_magic));
+    siml_put32(image + 8, (unsigned long)d->count);
+    siml_put32(image + 12, (unsigned long)pool);
+    out = image + SIML_BIN_HEADER;
+    text = (char *)out + (size_t)d->count * SIML_BIN_NODE;
+    pool = 0;
+    for (i = 0; i < d->count; ++i, out += SIML_BIN_NODE) {
+        const siml_node *n = &d->nodes[i];
+
+        out[0] = n->kind;
+        out[1] = n->style;
+        out[2] = (unsigned char)(n->comment_spaces & 0xFF);
+        out[3] = (unsigned char)(n->comment_spaces >> 8);
+        siml_put32(out + 4, (unsigned long)n->child_count);
+        siml_put32(out + 8, (unsigned long)n->first_child);
+        siml_put32(out + 12, (unsigned long)n->next_sibling);
+        siml_put32(out + 16, (unsigned long)pool);
+        siml_put32(out + 20, (unsigned long)n->key.len);
+        if (n->key.len > 0) memcpy(text + pool, n->key.ptr, n->key.len);
+        pool += n->key.len;
+        siml_put32(out + 24, (unsigned long)pool);
+        siml_put32(out + 28, (unsigned long)n->value.len);
+        if (n->value.len > 0) memcpy(text + pool, n->value.ptr, n->value.len);
+        pool += n->value.len;
+        siml_put32(out + 32, (unsigned long)n->line & 0xFFFFFFFFul);
+    }
+    *len = size;
+    return (char *)image;
+}
+
+static siml_dom_result siml_bin_invalid(siml_dom *d) {
+    d->count = 0;
+    return siml_dom_fail(d, SIML_DOM_ERROR, SIML_ERR_NONE, 0,
+                         "invalid compiled image");
+}
+
+/* Check that the links of the decoded nodes form the tree they describe:
+ * nodes in preorder, each parent's children chained from its first child
+ * through next_sibling, child_count of them. Anything else could make a
+ * walk loop or leave the table, so the image is rejected.
+ */
+static int siml_bin_check_links(siml_dom *d) {
+    unsigned int seen[SIML_DOM_MAX_DEPTH];
+    unsigned int i;
+    int depth = 1;
+
+    d->open[0] = 0;
+    d->last[0] = 0;
+    seen[0] = 0;
+    if (d->nodes[0].kind != SIML_NODE_STREAM ||
+        d->nodes[0].comment_spaces != 0) {
+        return 0;
+    }
+    if (d->nodes[0].child_count == 0 && d->nodes[0].first_child != 0) return 0;
+    for (i = 1; i <= d->count; ++i) {
+        unsigned int parent;
+        siml_node *n;
+
+        /* Close the nodes whose children are complete. */
+        while (depth > 0 &&
+               seen[depth - 1] == d->nodes[d->open[depth - 1]].child_count) {
+            if (d->last[depth - 1] != 0 &&
+                d->nodes[d->last[depth - 1]].next_sibling != 0) {
+                return 0;
+            }
+            depth -= 1;
+        }
+        if (i == d->count) break;
+        if (depth == 0) return 0;
+
+        parent = d->open[depth - 1];
+        if (d->last[depth - 1] == 0 ? d->nodes[parent].first_child != i
+                                    : d->nodes[d->last[depth - 1]].next_sibling
+                                          != i) {
+            return 0;
+        }
+        seen[depth - 1] += 1;
+        d->last[depth - 1] = i;
+
+        n = &d->nodes[i];
+        if (n->kind == SIML_NODE_STREAM || n->kind > SIML_NODE_COMMENT) return 0;
+        if (n->comment_spaces != 0 &&
+            (n->child_count == 0 || i + 1 == d->count ||
+             d->nodes[i + 1].kind != SIML_NODE_COMMENT)) {
+            return 0;
+        }
+        if (n->child_count > 0) {
+            if (depth == SIML_DOM_MAX_DEPTH) return 0;
+            d->open[depth] = i;
+            d->last[depth] = 0;
+            seen[depth] = 0;
+            depth += 1;
+        } else if (n->first_child != 0) {
+            return 0;
+        }
+    }
+    return depth == 0;
+}
+
+siml_dom_result siml_bin_load(siml_dom *d, const char *image, size_t len) {
+    const unsigned char *in = (const unsigned char *)image;
+    const char *text;
+    unsigned long count;
+    unsigned long pool;
+    unsigned int i;
+
+    if (!d) return SIML_DOM_ERROR;
+    siml_dom_free_chunks(d);
+    d->count = 0;
+    d->index_len = 0;
+    d->depth = 0;
+    d->building = 0;
+    d->error_code = SIML_ERR_NONE;
+    d->error_line = 0;
+    d->error_message = 0;
+    if (!image || len < SIML_BIN_HEADER ||
+        memcmp(image, siml_bin_magic, sizeof(siml_bin_magic)) != 0) {
+        return siml_bin_invalid(d);
+    }
+    count = siml_get32(in + 8);
+    pool = siml_get32(in + 12);
+    if (count == 0 || count > (len - SIML_BIN_HEADER) / SIML_BIN_NODE ||
+        pool != len - SIML_BIN_HEADER - count * SIML_BIN_NODE) {
+        return siml_bin_invalid(d);
+    }
+    if (count > d->cap &&
+        (!siml_dom_grow(d, (size_t)count) || count > d->cap)) {
+        return siml_dom_fail(d, SIML_DOM_NO_MEMORY, SIML_ERR_NONE, 0,
+                             "DOM memory limit exceeded");
+    }
+
+    in += SIML_BIN_HEADER;
+    text = (const char *)in + count * SIML_BIN_NODE;
+    for (i = 0; i < count; ++i, in += SIML_BIN_NODE) {
+        siml_node *n = &d->nodes[i];
+        unsigned long key_at = siml_get32(in + 16);
+        unsigned long key_len = siml_get32(in + 20);
+        unsigned long value_at = siml_get32(in + 24);
+        unsigned long value_len = siml_get32(in + 28);
+
+        if (key_at > pool || key_len > pool - key_at ||
+            value_at > pool || value_len > pool - value_at) {
+            return siml_bin_invalid(d);
+        }
+        n->kind = in[0];
+        n->style = in[1];
+        n->comment_spaces = (unsigned short)(in[2] | (in[3] << 8));
+        n->child_count = (unsigned int)siml_get32(in + 4);
+        n->first_child = (unsigned int)siml_get32(in + 8);
+        n->next_sibling = (unsigned int)siml_get32(in + 12);
+        n->key.ptr = text + key_at;
+        n->key.len = (size_t)key_len;
+        n->value.ptr = text + value_at;
+        n->value.len = (size_t)value_len;
+        n->line = (long)siml_get32(in + 32);
+        n->index = 0;
+    }
+    d->count = (unsigned int)count;
+    if (!siml_bin_check_links(d)) return siml_bin_invalid(d);
+    d->depth = 0;
+    return SIML_DOM_DONE;
+}
+
+/* Decompiler --------------------------------------------------------- */
+
+typedef struct siml_bin_text_s {
+    char  *data;
+    size_t len;
+    size_t cap;
+    int    failed;
+} siml_bin_text;
+
+static void siml_bin_append(siml_bin_text *b, const char *s, size_t n) {
+    if (b->failed || n == 0) return;
+    if (n > b->cap - b->len) {
+        size_t cap = b->cap ? b->cap : 4096;
+        char *data;
+
+        while (n > cap - b->len) cap *= 2;
+        data = (char *)realloc(b->data, cap);
+        if (!data) {
+            b->failed = 1;
+            return;
+        }
+        b->data = data;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+}
+
+static int siml_bin_write(void *userdata, const siml_slice *pieces,
+                          int count) {
+    siml_bin_text *b = (siml_bin_text *)userdata;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        siml_bin_append(b, pieces[i].ptr, pieces[i].len);
+    }
+    return !b->failed;
+}
+
+/* Emit node i and its children in the order the parser reported them. */
+static int siml_bin_node(siml_emitter *e, const siml_dom *d, unsigned int i) {
+    const siml_node *n = &d->nodes[i];
+    unsigned int c = n->first_child;
+
+    if (n->comment_spaces != 0 && c != 0 &&
+        d->nodes[c].kind == SIML_NODE_COMMENT) {
+        if (!siml_emit_inline_comment(e, n->comment_spaces,
+                                      d->nodes[c].value.ptr,
+                                      d->nodes[c].value.len)) {
+            return 0;
+        }
+        c = d->nodes[c].next_sibling;
+    }
+    switch (n->kind) {
+    case SIML_NODE_STREAM:
+        break;
+    case SIML_NODE_DOCUMENT:
+        if (!siml_emit_document_start(e)) return 0;
+        break;
+    case SIML_NODE_MAPPING:
+        if (!siml_emit_mapping_start(e, n->key.ptr, n->key.len)) return 0;
+        break;
+    case SIML_NODE_SEQUENCE:
+        if (!siml_emit_sequence_start(e, n->key.ptr, n->key.len,
+                                      (siml_seq_style)n->style)) {
+            return 0;
+        }
+        break;
+    case SIML_NODE_SCALAR:
+        return siml_emit_scalar(e, n->key.ptr, n->key.len, n->value.ptr,
+                                n->value.len);
+    case SIML_NODE_BLOCK_SCALAR:
+        if (!siml_emit_block_scalar_start(e, n->key.ptr, n->key.len)) return 0;
+        break;
+    case SIML_NODE_LINE:
+        return siml_emit_block_scalar_line(e, n->value.ptr, n->value.len);
+    case SIML_NODE_COMMENT:
+        return siml_emit_comment(e, n->value.ptr, n->value.len);
+    default:
+        return 1;
+    }
+    for (; c != 0; c = d->nodes[c].next_sibling) {
+        if (!siml_bin_node(e, d, c)) return 0;
+    }
+    switch (n->kind) {
+    case SIML_NODE_DOCUMENT:
+        return siml_emit_document_end(e);
+    case SIML_NODE_MAPPING:
+    case SIML_NODE_SEQUENCE:
+        return siml_emit_end(e);
+    default:
+        return 1;
+    }
+}
+
+char *siml_bin_decompile(const siml_dom *d, size_t *len) {
+    siml_bin_text b;
+    siml_emitter e;
+    char buf[4096];
+
+    if (!d || !len || d->count == 0 || d->building) return 0;
+    b.data = 0;
+    b.len = 0;
+    b.cap = 0;
+    b.failed = 0;
+    siml_emitter_init(&e, buf, sizeof(buf), siml_bin_write, &b);
+    /* The sentinel reserves at least one byte, so an empty text is not
+     * NULL.
+     */
+    if (!siml_bin_node(&e, d, 0) || !siml_emit_flush(&e)) b.failed = 1;
+    siml_bin_append(&b, "\n", 1);
+    if (b.failed) {
+        free(b.data);
+        return 0;
+    }
+    b.len -= 1;
+    if (d->nodes[0].style && b.len > 0 && b.data[b.len - 1] == '\n') {
+        b.len -= 1;
+    }
+    *len = b.len;
+    return b.data;
+}
+
+#endif /* SIML_IMPLEMENTATION */
+
+#endif /* SIML_BIN_H_INCLUDED */
@@ -0,0 +1,349 @@
+#ifndef SIML_CACHE_H_INCLUDED
+#define SIML_CACHE_H_INCLUDED
+
+/*
+ * SIML validation cache v0.1
+ *
+ * Companion to siml.h and siml-io.h. Remembers the outcome of parsing a
+ * buffer in a cache directory, under a 128-bit hash of its content, so that
+ * a buffer seen before is answered without calling siml_next(). The key
+ * also covers SIML_PARSER_REVISION, the SIML_MAX_* limits and the options,
+ * so an outcome is only reused by a parse that would reach it again.
+ *
+ * An entry is one file named after the key in hex:
+ *
+ *   magic "SIMLCAC1", key (16 bytes), source length (two 32-bit words,
+ *   low first), error code, error line, error message length, tape length
+ *   error message
+ *   event tape (see siml.h), if one was kept
+ *
+ * Numbers are 32-bit little-endian. An entry is only used when its key and
+ * length match the buffer; entries are written to a temporary file of their
+ * own and renamed into place, so processes and threads may share a
+ * directory. Entries are created readable by their owner only.
+ *
+ * The hash is the content hash of siml.h. It is not a cryptographic hash:
+ * a cache directory must not be writable by anyone whose input should not
+ * be trusted.
+ *
+ * Define SIML_IMPLEMENTATION in exactly one translation unit, as for siml.h,
+ * with the requirements of siml-io.h.
+ */
+
+#include "siml.h"
+#include "siml-io.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h> /* size_t */
+
+typedef struct siml_cache_s {
+    /* Options; set before siml_cache_check() */
+    const char       *dir;            /* cache directory, which must exist */
+    int               validate_utf8;  /* boolean, default SIML_VALIDATE_UTF8 */
+    int               keep_tape;      /* boolean: keep the event tape too */
+
+    /* Outcome of the last check */
+    unsigned char     key[16];        /* entry key */
+    int               hit;            /* boolean: read from the cache */
+    siml_error_code   error_code;     /* SIML_ERR_NONE if the buffer is valid */
+    long              error_line;
+    const char       *error_message;  /* NULL if the buffer is valid */
+    const char       *tape;           /* event tape with keep_tape, or NULL */
+    size_t            tape_len;
+
+    /* Internal */
+    char              error_buf[160];
+    siml_mmap_reader  entry;
+    char             *built;          /* tape recorded on a miss */
+} siml_cache;
+
+/* Hash len bytes at data into key. The entry key of a buffer is this hash
+ * with the revision, limits and options mixed in.
+ */
+void siml_cache_hash(const char *data, size_t len, unsigned char key[16]);
+
+/* Initialize c to use the cache directory dir. */
+void siml_cache_init(siml_cache *c, const char *dir);
+
+/* Find the outcome of parsing the buffer data (len bytes) in the cache, or
+ * parse it and store the outcome. The outcome is set in c either way; a
+ * cache that cannot be read or written only costs the parse. With
+ * keep_tape, an entry without a tape counts as a miss, and c->tape holds
+ * the events to replay with siml_tape_reader_init() over data until the
+ * next check. Returns 1, or 0 when out of memory.
+ */
+int siml_cache_check(siml_cache *c, const char *data, size_t len);
+
+/* Release the entry and tape of the last check. */
+void siml_cache_close(siml_cache *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* ---------------- Implementation ---------------- */
+#ifdef SIML_IMPLEMENTATION
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h> /* rename */
+#include <stdlib.h> /* mkstemp */
+#include <string.h>
+#include <unistd.h>
+
+#define SIML_CACHE_HEADER 48
+
+static const char siml_cache_magic[8] = { 'S', 'I', 'M', 'L', 'C', 'A', 'C', '1' };
+
+void siml_cache_hash(const char *data, size_t len, unsigned char key[16]) {
+    siml_hash128(data, len, key);
+}
+
+void siml_cache_init(siml_cache *c, const char *dir) {
+    if (!c) return;
+    memset(c, 0, sizeof(*c));
+    c->dir = dir;
+    c->validate_utf8 = SIML_VALIDATE_UTF8;
+    siml_mem_reader_init(&c->entry.mem, "", 0);
+}
+
+void siml_cache_close(siml_cache *c) {
+    if (!c) return;
+    siml_mmap_reader_close(&c->entry);
+    free(c->built);
+    c->built = 0;
+    c->tape = 0;
+    c->tape_len = 0;
+}
+
+static void siml_cache_set_error(siml_cache *c, siml_error_code code,
+                                 long line, const char *msg, size_t n) {
+    c->error_code = code;
+    c->error_line = line;
+    if (code == SIML_ERR_NONE) {
+        c->error_message = 0;
+        return;
+    }
+    if (n >= sizeof(c->error_buf)) n = sizeof(c->error_buf) - 1;
+    memcpy(c->error_buf, msg, n);
+    c->error_buf[n] = '\0';
+    c->error_message = c->error_buf;
+}
+
+/* Turn the content hash in c->key into the entry key: each word goes
+ * through a bijection chosen by what else decides the outcome of a parse.
+ */
+static void siml_cache_entry_key(siml_cache *c) {
+    unsigned long words[11] = {
+        SIML_PARSER_REVISION, SIML_MAX_KEY_LEN, SIML_MAX_NESTING,
+        SIML_MAX_LINE_LEN, SIML_MAX_INLINE_VALUE_LEN,
+        SIML_MAX_FLOW_ELEMENT_LEN, SIML_MAX_COMMENT_TEXT_LEN,
+        SIML_MAX_INLINE_COMMENT_TEXT_LEN, SIML_MAX_INLINE_COMMENT_SPACES,
+        SIML_MAX_BLOCK_LINE_LEN, 0
+    };
+    int k;
+    int i;
+
+    words[10] = c->validate_utf8 ? 1ul : 0ul;
+    for (k = 0; k < 4; ++k) {
+        unsigned int h = (unsigned int)siml_get32(c->key + 4 * k);
+
+        for (i = 0; i < 11; ++i) {
+            h = siml_hash_avalanche(h ^ ((unsigned int)words[i] +
+                                          (unsigned int)k * SIML_HASH_P4));
+        }
+        siml_put32(c->key + 4 * k, (unsigned long)h);
+    }
+}
+
+/* Path of the entry for c->key. Returns NULL when out of memory. */
+static char *siml_cache_path(const siml_cache *c) {
+    size_t n = strlen(c->dir);
+    char *path = (char *)malloc(n + 1 + 32 + 1);
+    int k;
+
+    if (!path) return 0;
+    memcpy(path, c->dir, n);
+    path[n++] = '/';
+    for (k = 0; k < 16; ++k) {
+        path[n++] = "0123456789abcdef"[c->key[k] >> 4];
+        path[n++] = "0123456789abcdef"[c->key[k] & 0xF];
+    }
+    path[n] = '\0';
+    return path;
+}
+
+/* Take the outcome from the mapped entry. Returns 0 if it does not belong
+ * to the buffer or lacks a wanted tape.
+ */
+static int siml_cache_read(siml_cache *c, size_t len) {
+    const unsigned char *in = (const unsigned char *)c->entry.mem.data;
+    size_t size = c->entry.mem.len;
+    unsigned long msg_len;
+    unsigned long tape_len;
+
+    if (size < SIML_CACHE_HEADER ||
+        memcmp(in, siml_cache_magic, sizeof(siml_cache_magic)) != 0 ||
+        memcmp(in + 8, c->key, 16) != 0 ||
+        siml_get32(in + 24) != ((unsigned long)len & 0xFFFFFFFFul) ||
+        siml_get32(in + 28) != ((unsigned long)(len >> 16) >> 16)) {
+        return 0;
+    }
+    msg_len = siml_get32(in + 40);
+    tape_len = siml_get32(in + 44);
+    if (msg_len > size - SIML_CACHE_HEADER ||
+        tape_len != size - SIML_CACHE_HEADER - msg_len ||
+        (c->keep_tape && tape_len == 0)) {
+        return 0;
+    }
+    siml_cache_set_error(c, (siml_error_code)siml_get32(in + 32),
+                         (long)siml_get32(in + 36),
+                         (const char *)in + SIML_CACHE_HEADER, msg_len);
+    if (c->error_code != SIML_ERR_NONE && msg_len == 0) return 0;
+    if (tape_len > 0) {
+        c->tape = (const char *)in + SIML_CACHE_HEADER + msg_len;
+        c->tape_len = tape_len;
+    }
+    return 1;
+}
+
+/* Parse the buffer, recording its tape with keep_tape. Returns 0 when out
+ * of memory.
+ */
+static int siml_cache_parse(siml_cache *c, const char *data, size_t len) {
+    siml_parser p;
+    siml_tape_writer w;
+    siml_event ev;
+    size_t cap = 65536;
+    size_t n = 0;
+
+    siml_parser_init_buffer(&p, data, len);
+    p.validate_utf8 = c->validate_utf8;
+    if (c->keep_tape) {
+        c->built = (char *)malloc(cap);
+        if (!c->built) return 0;
+        siml_tape_writer_init(&w, data, len);
+        w.validate_utf8 = c->validate_utf8;
+        n = siml_tape_write_header(&w, c->built);
+    }
+    for (;;) {
+        siml_event_type t = siml_next(&p, &ev);
+
+        if (c->keep_tape) {
+            if (cap - n < SIML_TAPE_MAX_RECORD) {
+                char *grown = (char *)realloc(c->built, cap * 2);
+                if (!grown) return 0;
+                c->built = grown;
+                cap *= 2;
+            }
+            n += siml_tape_write(&w, t, &ev, c->built + n);
+        }
+        if (t == SIML_EVENT_ERROR) {
+            const char *msg = ev.error_message ? ev.error_message
+                                               : "parse error";
+            siml_cache_set_error(c, ev.error_code, ev.line, msg, strlen(msg));
+            break;
+        }
+        if (t == SIML_EVENT_STREAM_END) {
+            siml_cache_set_error(c, SIML_ERR_NONE, 0, 0, 0);
+            break;
+        }
+    }
+    if (c->keep_tape) {
+        c->tape = c->built;
+        c->tape_len = n;
+    }
+    return 1;
+}
+
+/* Store the outcome of the last parse at path. Failures are ignored. */
+static void siml_cache_write(const siml_cache *c, const char *path,
+                             size_t len) {
+    unsigned char header[SIML_CACHE_HEADER];
+    size_t msg_len = c->error_message ? strlen(c->error_message) : 0;
+    size_t plen = strlen(path);
+    char *tmp = (char *)malloc(plen + 8);
+    const char *part[3];
+    size_t part_len[3];
+    int fd;
+    int ok = 1;
+    int k;
+
+    if (!tmp || c->tape_len > 0xFFFFFFFFul) {
+        free(tmp);
+        return;
+    }
+    memcpy(header, siml_cache_magic, sizeof(siml_cache_magic));
+    memcpy(header + 8, c->key, 16);
+    siml_put32(header + 24, (unsigned long)len & 0xFFFFFFFFul);
+    siml_put32(header + 28, (unsigned long)(len >> 16) >> 16);
+    siml_put32(header + 32, (unsigned long)c->error_code);
+    siml_put32(header + 36, (unsigned long)c->error_line);
+    siml_put32(header + 40, (unsigned long)msg_len);
+    siml_put32(header + 44, (unsigned long)c->tape_len);
+    part[0] = (const char *)header;
+    part_len[0] = sizeof(header);
+    part[1] = c->error_message;
+    part_len[1] = msg_len;
+    part[2] = c->tape;
+    part_len[2] = c->tape_len;
+
+    /* mkstemp() picks a name no other writer holds, thread or process */
+    memcpy(tmp, path, plen);
+    memcpy(tmp + plen, ".XXXXXX", 8);
+    fd = mkstemp(tmp);
+    if (fd < 0) ok = 0;
+    for (k = 0; ok && k < 3; ++k) {
+        size_t done = 0;
+        while (done < part_len[k]) {
+            long n = (long)write(fd, part[k] + done, part_len[k] - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                ok = 0;
+                break;
+            }
+            done += (size_t)n;
+        }
+    }
+    if (fd >= 0 && close(fd) != 0) ok = 0;
+    if (ok && rename(tmp, path) != 0) ok = 0;
+    if (!ok && fd >= 0) (void)unlink(tmp);
+    free(tmp);
+}
+
+int siml_cache_check(siml_cache *c, const char *data, size_t len) {
+    char *path;
+
+    if (!c || !c->dir) return 0;
+    siml_cache_close(c);
+    siml_cache_hash(data, len, c->key);
+    siml_cache_entry_key(c);
+    c->hit = 0;
+    path = siml_cache_path(c);
+    if (!path) return 0;
+    if (siml_mmap_reader_open(&c->entry, path)) {
+        if (siml_cache_read(c, len)) {
+            c->hit = 1;
+            free(path);
+            return 1;
+        }
+        siml_mmap_reader_close(&c->entry);
+        c->tape = 0;
+        c->tape_len = 0;
+    }
+    if (!siml_cache_parse(c, data, len)) {
+        siml_cache_close(c);
+        free(path);
+        return 0;
+    }
+    siml_cache_write(c, path, len);
+    free(path);
+    return 1;
+}
+
+#endif /* SIML_IMPLEMENTATION */
+
+#endif /* SIML_CACHE_H_INCLUDED */
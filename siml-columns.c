@@ -0,0 +1,262 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SIML_IMPLEMENTATION
+#include "siml.h"
+#include "siml-io.h"
+#include "siml-columns.h"
+
+/* Extracts columns of values from a stream of records. Without -o the rows
+ * are printed as tab-separated text under a header of the paths. With -o,
+ * column i is written to dir/i.off (rows + 1 offsets, 8-byte little-endian;
+ * value i is bytes off[i] to off[i + 1]), dir/i.bytes (the values back to
+ * back), dir/i.cells (SIML_CELL_* per row)
+ * and, for -n columns, dir/i.f64 (native doubles), with dir/columns.txt
+ * naming the paths. Rows are taken in batches, so memory does not grow with
+ * the stream.
+ */
+
+#define BATCH_ROWS 65536
+
+struct column_files {
+    FILE         *off;
+    FILE         *bytes;
+    FILE         *cells;
+    FILE         *f64;
+    unsigned long base;  /* bytes written by earlier batches */
+};
+
+static void print_value(const siml_column *col, size_t row) {
+    siml_slice v = siml_column_value(col, row);
+    size_t i;
+
+    if (col->numeric) {
+        if (col->cells[row] & SIML_CELL_NUMBER) {
+            (void)printf("%.17g", col->numbers[row]);
+        }
+        return;
+    }
+    for (i = 0; i < v.len; ++i) {
+        char ch = v.ptr[i];
+        if (ch == '\t') {
+            (void)fputs("\\t", stdout);
+        } else if (ch == '\n') {
+            (void)fputs("\\n", stdout);
+        } else if (ch == '\\') {
+            (void)fputs("\\\\", stdout);
+        } else {
+            (void)putchar(ch);
+        }
+    }
+}
+
+static void print_rows(const siml_columns *c) {
+    size_t row;
+    int i;
+
+    for (row = 0; row < c->rows; ++row) {
+        for (i = 0; i < c->count; ++i) {
+            if (i > 0) (void)putchar('\t');
+            print_value(&c->cols[i], row);
+        }
+        (void)putchar('\n');
+    }
+}
+
+static FILE *open_column_file(const char *dir, int i, const char *ext) {
+    char path[4096];
+    FILE *f;
+
+    (void)sprintf(path, "%.4000s/%d.%s", dir, i, ext);
+    f = fopen(path, "wb");
+    if (!f) perror(path);
+    return f;
+}
+
+static int write_offset(FILE *f, unsigned long off) {
+    unsigned char le[8];
+    int k;
+
+    for (k = 0; k < 8; ++k) {
+        le[k] = (unsigned char)((k < (int)sizeof(off))
+                                    ? (off >> (8 * k)) & 0xFF
+                                    : 0);
+    }
+    return fwrite(le, 1, 8, f) == 8;
+}
+
+/* Append a batch; each batch adds the end offsets of its rows. */
+static int write_rows(const siml_columns *c, struct column_files *files) {
+    size_t row;
+    int i;
+
+    for (i = 0; i < c->count; ++i) {
+        const siml_column *col = &c->cols[i];
+        struct column_files *f = &files[i];
+
+        for (row = 1; row <= c->rows; ++row) {
+            if (!write_offset(f->off,
+                              f->base + (unsigned long)col->offsets[row])) {
+                return 0;
+            }
+        }
+        if (fwrite(col->bytes, 1, col->bytes_len, f->bytes) !=
+                col->bytes_len ||
+            fwrite(col->cells, 1, c->rows, f->cells) != c->rows ||
+            (f->f64 && fwrite(col->numbers, sizeof(double), c->rows, f->f64) !=
+                           c->rows)) {
+            return 0;
+        }
+        f->base += (unsigned long)col->bytes_len;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    const char *paths[SIML_MAX_SUBSCRIPTIONS];
+    int numeric[SIML_MAX_SUBSCRIPTIONS];
+    int count = 0;
+    int items = 0;
+    const char *dir = NULL;
+    const char *filename = NULL;
+    size_t batch_rows = BATCH_ROWS;
+    struct column_files files[SIML_MAX_SUBSCRIPTIONS];
+    siml_mmap_reader mreader;
+    siml_fd_reader reader;
+    siml_parser parser;
+    siml_columns cols;
+    siml_columns_result r;
+    int mapped = 0;
+    int argi;
+    int i;
+    int rc = 0;
+
+    for (argi = 1; argi < argc; ++argi) {
+        if ((strcmp(argv[argi], "-c") == 0 || strcmp(argv[argi], "-n") == 0) &&
+            argi + 1 < argc && count < SIML_MAX_SUBSCRIPTIONS) {
+            numeric[count] = (argv[argi][1] == 'n');
+            paths[count++] = argv[++argi];
+        } else if (strcmp(argv[argi], "-i") == 0) {
+            items = 1;
+        } else if (strcmp(argv[argi], "-o") == 0 && argi + 1 < argc) {
+            dir = argv[++argi];
+        } else if (strcmp(argv[argi], "-b") == 0 && argi + 1 < argc) {
+            long n = strtol(argv[++argi], NULL, 10);
+            batch_rows = (n > 0) ? (size_t)n : BATCH_ROWS;
+        } else if (argi + 1 == argc && (argv[argi][0] != '-' ||
+                                        argv[argi][1] == '\0')) {
+            filename = argv[argi];
+        } else {
+            break;
+        }
+    }
+    if (!filename || count == 0 || !siml_columns_init(&cols, paths, count)) {
+        (void)fprintf(stderr,
+                      "Usage: %s [-i] [-o dir] [-b rows] (-c path | -n path)... "
+                      "<file.siml>\n"
+                      "  -c extracts the values at path, keys joined by '.'\n"
+                      "     ([key] for a key that contains '.')\n"
+                      "  -n extracts them as numbers\n"
+                      "  -i takes the items below each document root as rows\n"
+                      "  -o writes binary columns to dir instead of text\n"
+                      "  -b sets the rows per batch\n",
+                      argv[0]);
+        return 1;
+    }
+    cols.rows_mode = items ? SIML_ROWS_ITEMS : SIML_ROWS_DOCUMENTS;
+    cols.skip_mode = SIML_SKIP_INDENT;
+    cols.batch_rows = batch_rows;
+    for (i = 0; i < count; ++i) {
+        cols.cols[i].numeric = numeric[i];
+    }
+
+    if (strcmp(filename, "-") == 0) {
+        if (!siml_fd_reader_init(&reader, STDIN_FILENO, 0)) {
+            perror(filename);
+            return 1;
+        }
+        siml_parser_init(&parser, siml_fd_read_line, &reader);
+    } else {
+        if (!siml_mmap_reader_open(&mreader, filename)) {
+            perror(filename);
+            return 1;
+        }
+        mapped = 1;
+        siml_parser_init_buffer(&parser, mreader.mem.data, mreader.mem.len);
+    }
+    parser.validate_utf8 = 1;
+
+    memset(files, 0, sizeof(files));
+    if (dir) {
+        char path[4096];
+        FILE *names;
+
+        (void)sprintf(path, "%.4000s/columns.txt", dir);
+        names = fopen(path, "w");
+        if (!names) {
+            perror(path);
+            rc = 1;
+        }
+        for (i = 0; rc == 0 && i < count; ++i) {
+            (void)fprintf(names, "%d\t%s\t%s\n", i, paths[i],
+                          numeric[i] ? "number" : "string");
+            files[i].off = open_column_file(dir, i, "off");
+            files[i].bytes = open_column_file(dir, i, "bytes");
+            files[i].cells = open_column_file(dir, i, "cells");
+            if (numeric[i]) files[i].f64 = open_column_file(dir, i, "f64");
+            if (!files[i].off || !files[i].bytes || !files[i].cells ||
+                (numeric[i] && !files[i].f64)) {
+                rc = 1;
+            } else if (!write_offset(files[i].off, 0)) {
+                perror(dir);
+                rc = 1;
+            }
+        }
+        if (names && fclose(names) != 0) rc = 1;
+    } else {
+        for (i = 0; i < count; ++i) {
+            (void)printf("%s%s", i > 0 ? "\t" : "", paths[i]);
+        }
+        (void)printf("\n");
+    }
+
+    while (rc == 0) {
+        r = siml_columns_extract(&cols, &parser);
+        if (dir) {
+            if (!write_rows(&cols, files)) {
+                perror(dir);
+                rc = 1;
+            }
+        } else {
+            print_rows(&cols);
+        }
+        siml_columns_clear_rows(&cols);
+        if (r == SIML_COLUMNS_DONE) break;
+        if (r == SIML_COLUMNS_NO_MEMORY) {
+            (void)fprintf(stderr, "%s: out of memory\n", filename);
+            rc = 1;
+        } else if (r != SIML_COLUMNS_BATCH) {
+            (void)fprintf(stderr, "SIML error at line %ld: %s\n",
+                          cols.error_line, cols.error_message);
+            rc = 1;
+        }
+    }
+
+    for (i = 0; i < count; ++i) {
+        if (files[i].off && fclose(files[i].off) != 0) rc = 1;
+        if (files[i].bytes && fclose(files[i].bytes) != 0) rc = 1;
+        if (files[i].cells && fclose(files[i].cells) != 0) rc = 1;
+        if (files[i].f64 && fclose(files[i].f64) != 0) rc = 1;
+    }
+    siml_columns_free(&cols);
+    if (mapped) {
+        siml_mmap_reader_close(&mreader);
+    } else {
+        siml_fd_reader_free(&reader);
+    }
+    return rc;
+}
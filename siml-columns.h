@@ -0,0 +1,531 @@
+#ifndef SIML_COLUMNS_H_INCLUDED
+#define SIML_COLUMNS_H_INCLUDED
+
+/*
+ * SIML column extraction v0.1
+ *
+ * Companion to siml.h. Reads the values at a few key paths out of every
+ * record of a stream into one column per path, without building a tree.
+ *
+ * A record is a document, or with SIML_ROWS_ITEMS each mapping or sequence
+ * directly below a document root (the items of a root sequence). A column
+ * is one growing byte array holding its values back to back, with the
+ * offset of each row, so a scan over a column reads contiguous memory.
+ * Columns marked numeric also parse every value that is a decimal number
+ * as a double: a sign, digits, a fraction and an exponent, the last three
+ * optional ("12", "-0.5", "+1.5e-3"). SIML has no numbers of its own, so
+ * "inf", "nan", "0x1p3", ".5" and " 1" stay strings, whatever the locale.
+ *
+ * The paths are registered as subscriptions of the parser (siml_subscribe),
+ * so everything else is skipped inside the parser and never becomes an
+ * event. With batch_rows set, extraction stops after that many rows; the
+ * caller takes them, calls siml_columns_clear_rows() and goes on, which
+ * bounds memory for streams of any length.
+ *
+ * Define SIML_IMPLEMENTATION in exactly one translation unit, as for siml.h.
+ */
+
+#include "siml.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h> /* size_t */
+
+typedef enum siml_rows_e {
+    SIML_ROWS_DOCUMENTS = 0,  /* one row per document */
+    SIML_ROWS_ITEMS           /* one row per container below a root */
+} siml_rows;
+
+typedef enum siml_columns_result_e {
+    SIML_COLUMNS_ERROR = 0,   /* parse error; see error_* */
+    SIML_COLUMNS_DONE,
+    SIML_COLUMNS_NEED_MORE,   /* push parser: feed, then extract again */
+    SIML_COLUMNS_NO_MEMORY,   /* allocation failed or max_bytes reached */
+    SIML_COLUMNS_BATCH        /* batch_rows rows are ready */
+} siml_columns_result;
+
+/* Flags of a cell, one per row and column. */
+#define SIML_CELL_PRESENT 1   /* the record has a value at the path */
+#define SIML_CELL_NUMBER  2   /* the whole value is a decimal number */
+
+/* One column. The value of row i is bytes[offsets[i], offsets[i + 1]); a
+ * block scalar's lines are joined with '\n'. Of repeated keys, the first
+ * counts.
+ */
+typedef struct siml_column_s {
+    const char    *path;      /* as given to siml_columns_init() */
+    int            numeric;   /* boolean option: fill numbers */
+    size_t        *offsets;   /* rows + 1 entries */
+    char          *bytes;
+    size_t         bytes_len;
+    size_t         bytes_cap;
+    unsigned char *cells;     /* SIML_CELL_* */
+    double        *numbers;   /* numeric only; 0 unless SIML_CELL_NUMBER */
+
+    /* The path as key table ids below the record */
+    unsigned int   ids[SIML_MAX_NESTING];
+    int            depth;
+} siml_column;
+
+typedef struct siml_columns_s {
+    /* Options; set before siml_columns_extract() */
+    siml_rows       rows_mode;
+    siml_skip_mode  skip_mode;   /* for skipped nodes, default VALIDATE */
+    size_t          batch_rows;  /* 0 for no batches */
+    size_t          max_bytes;   /* 0 for no limit */
+
+    siml_column    *cols;
+    int             count;
+    size_t          rows;        /* rows in the current batch */
+    size_t          row_cap;
+    size_t          bytes;       /* memory held by the columns */
+
+    /* Path keys and the subscriptions derived from them */
+    siml_keytab     keys;
+    void           *keys_mem;
+    char           *sub_text;
+    const char     *subs[SIML_MAX_SUBSCRIPTIONS];  /* of rows_mode */
+
+    /* Extraction state */
+    int             extracting;  /* boolean */
+    int             level;       /* nesting below the document */
+    int             in_row;      /* boolean */
+    int             block_col;   /* column of the block scalar read, or -1 */
+    long            block_lines;
+    unsigned int    path[SIML_MAX_NESTING + 2];  /* key id per level */
+
+    /* Set when siml_columns_extract() fails */
+    siml_error_code error_code;
+    long            error_line;
+    const char     *error_message;
+    char            error_buf[160];
+} siml_columns;
+
+/* Set up count columns for paths, keys joined by '.' below the record, with
+ * [key] for a key that contains '.' (see siml_subscribe). The strings are
+ * not copied. Returns 0 for more than SIML_MAX_SUBSCRIPTIONS paths, a
+ * malformed path (empty key, "*" or [n]), or no memory.
+ */
+int siml_columns_init(siml_columns *c, const char *const *paths, int count);
+
+/* Extract the rest of p's stream, or the next batch. Replaces the
+ * subscriptions of p while it runs and clears them once the stream ends.
+ * Slices of a buffer parser are copied, so the input need not outlive the
+ * columns.
+ */
+siml_columns_result siml_columns_extract(siml_columns *c, siml_parser *p);
+
+/* Drop the rows extracted so far, keeping the columns and their memory. */
+void siml_columns_clear_rows(siml_columns *c);
+
+/* Value of row in col. */
+siml_slice siml_column_value(const siml_column *col, size_t row);
+
+/* Release all memory. */
+void siml_columns_free(siml_columns *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* ---------------- Implementation ---------------- */
+#ifdef SIML_IMPLEMENTATION
+
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Longest value tried as a number. */
+#define SIML_COLUMNS_NUMBER_MAX 64
+
+static siml_columns_result siml_columns_fail(siml_columns *c,
+                                             siml_columns_result r,
+                                             siml_error_code code, long line,
+                                             const char *msg) {
+    size_t n = strlen(msg);
+
+    if (n >= sizeof(c->error_buf)) n = sizeof(c->error_buf) - 1;
+    memcpy(c->error_buf, msg, n);
+    c->error_buf[n] = '\0';
+    c->error_code = code;
+    c->error_line = line;
+    c->error_message = c->error_buf;
+    c->extracting = 0;
+    return r;
+}
+
+int siml_columns_init(siml_columns *c, const char *const *paths, int count) {
+    size_t text = 0;
+    size_t keys = 0;
+    size_t key_text = 0;
+    size_t keys_size;
+    size_t n;
+    char *s;
+    int i;
+
+    if (!c) return 0;
+    memset(c, 0, sizeof(*c));
+    c->rows_mode = SIML_ROWS_DOCUMENTS;
+    c->skip_mode = SIML_SKIP_VALIDATE;
+    c->block_col = -1;
+    if (count < 1 || count > SIML_MAX_SUBSCRIPTIONS || !paths) return 0;
+    for (i = 0; i < count; ++i) {
+        if (!paths[i]) return 0;
+        n = strlen(paths[i]);
+        text += n + 3;
+        /* a key and its '.' or brackets take two bytes or more */
+        keys += (n + 1) / 2;
+        key_text += n + 1;
+    }
+    keys_size = SIML_KEYTAB_SIZE(keys, key_text);
+    c->cols = (siml_column *)calloc((size_t)count, sizeof(siml_column));
+    c->keys_mem = malloc(keys_size);
+    c->sub_text = (char *)malloc(text);
+    if (!c->cols || !c->keys_mem || !c->sub_text ||
+        !siml_keytab_init(&c->keys, c->keys_mem, keys_size)) {
+        siml_columns_free(c);
+        return 0;
+    }
+    c->count = count;
+    s = c->sub_text;
+    for (i = 0; i < count; ++i) {
+        siml_column *col = &c->cols[i];
+        const char *k = paths[i];
+
+        col->path = paths[i];
+        do {
+            const char *key;
+            size_t len;
+
+            k = siml_sub_step(k, &key, &len);
+            if (!k || (len == 1 && key[0] == '*') ||
+                col->depth == SIML_MAX_NESTING) {
+                siml_columns_free(c);
+                return 0;
+            }
+            col->ids[col->depth++] = siml_keytab_intern(&c->keys, key, len);
+        } while (*k != '\0');
+        /* "*.path", or "*[key]..."; documents subscribe from the path
+         * itself.
+         */
+        n = (paths[i][0] == '[') ? 1 : 2;
+        s[0] = '*';
+        s[1] = '.';
+        memcpy(s + n, paths[i], strlen(paths[i]) + 1);
+        s += strlen(s) + 1;
+    }
+    return 1;
+}
+
+void siml_columns_free(siml_columns *c) {
+    int i;
+
+    if (!c) return;
+    for (i = 0; c->cols && i < c->count; ++i) {
+        free(c->cols[i].offsets);
+        free(c->cols[i].bytes);
+        free(c->cols[i].cells);
+        free(c->cols[i].numbers);
+    }
+    free(c->cols);
+    free(c->keys_mem);
+    free(c->sub_text);
+    c->cols = 0;
+    c->keys_mem = 0;
+    c->sub_text = 0;
+    c->count = 0;
+    c->rows = 0;
+    c->row_cap = 0;
+    c->bytes = 0;
+    c->extracting = 0;
+}
+
+void siml_columns_clear_rows(siml_columns *c) {
+    int i;
+
+    if (!c) return;
+    for (i = 0; i < c->count; ++i) {
+        c->cols[i].bytes_len = 0;
+        if (c->cols[i].offsets) c->cols[i].offsets[0] = 0;
+    }
+    c->rows = 0;
+}
+
+siml_slice siml_column_value(const siml_column *col, size_t row) {
+    siml_slice s;
+
+    s.ptr = col->bytes + col->offsets[row];
+    s.len = col->offsets[row + 1] - col->offsets[row];
+    return s;
+}
+
+/* Whether n more bytes stay within max_bytes. */
+static int siml_columns_fits(const siml_columns *c, size_t n) {
+    return c->max_bytes == 0 || (c->bytes <= c->max_bytes &&
+                                 n <= c->max_bytes - c->bytes);
+}
+
+/* Make room for one more row in every column. */
+static int siml_columns_grow_rows(siml_columns *c) {
+    size_t cap = c->row_cap ? c->row_cap * 2 : 1024;
+    size_t per_row = sizeof(size_t) + 1;
+    int i;
+
+    for (i = 0; i < c->count; ++i) {
+        if (c->cols[i].numeric) per_row += sizeof(double);
+    }
+    if (!siml_columns_fits(c, (cap - c->row_cap) * per_row)) return 0;
+    for (i = 0; i < c->count; ++i) {
+        siml_column *col = &c->cols[i];
+        size_t *offsets = (size_t *)realloc(col->offsets,
+                                            (cap + 1) * sizeof(size_t));
+        unsigned char *cells;
+
+        if (!offsets) return 0;
+        if (!col->offsets) offsets[0] = 0;
+        col->offsets = offsets;
+        cells = (unsigned char *)realloc(col->cells, cap);
+        if (!cells) return 0;
+        col->cells = cells;
+        if (col->numeric) {
+            double *numbers = (double *)realloc(col->numbers,
+                                                cap * sizeof(double));
+            if (!numbers) return 0;
+            col->numbers = numbers;
+        }
+    }
+    c->bytes += (cap - c->row_cap) * per_row;
+    c->row_cap = cap;
+    return 1;
+}
+
+static int siml_columns_append(siml_columns *c, siml_column *col,
+                               const char *s, size_t len) {
+    if (col->bytes_cap - col->bytes_len < len) {
+        size_t cap = col->bytes_cap ? col->bytes_cap * 2 : 4096;
+        char *bytes;
+
+        while (cap - col->bytes_len < len) cap *= 2;
+        if (!siml_columns_fits(c, cap - col->bytes_cap)) return 0;
+        bytes = (char *)realloc(col->bytes, cap);
+        if (!bytes) return 0;
+        c->bytes += cap - col->bytes_cap;
+        col->bytes = bytes;
+        col->bytes_cap = cap;
+    }
+    if (len > 0) memcpy(col->bytes + col->bytes_len, s, len);
+    col->bytes_len += len;
+    return 1;
+}
+
+static int siml_columns_begin_row(siml_columns *c) {
+    int i;
+
+    if (c->rows == c->row_cap && !siml_columns_grow_rows(c)) return 0;
+    for (i = 0; i < c->count; ++i) {
+        c->cols[i].cells[c->rows] = 0;
+        if (c->cols[i].numeric) c->cols[i].numbers[c->rows] = 0;
+    }
+    c->in_row = 1;
+    return 1;
+}
+
+/* Whether the len bytes at s are a decimal number:
+ * [+-] digits [. digits] [(e|E) [+-] digits].
+ */
+static int siml_columns_is_number(const char *s, size_t len) {
+    size_t i = 0;
+    size_t d;
+
+    if (i < len && (s[i] == '+' || s[i] == '-')) i += 1;
+    for (d = i; i < len && s[i] >= '0' && s[i] <= '9'; ++i) {}
+    if (i == d) return 0;
+    if (i < len && s[i] == '.') {
+        for (d = ++i; i < len && s[i] >= '0' && s[i] <= '9'; ++i) {}
+        if (i == d) return 0;
+    }
+    if (i < len && (s[i] == 'e' || s[i] == 'E')) {
+        i += 1;
+        if (i < len && (s[i] == '+' || s[i] == '-')) i += 1;
+        for (d = i; i < len && s[i] >= '0' && s[i] <= '9'; ++i) {}
+        if (i == d) return 0;
+    }
+    return i == len;
+}
+
+/* Close the row: parse numbers and record where each value ends. */
+static void siml_columns_end_row(siml_columns *c) {
+    int i;
+
+    for (i = 0; i < c->count; ++i) {
+        siml_column *col = &c->cols[i];
+        size_t start = col->offsets[c->rows];
+        size_t len = col->bytes_len - start;
+
+        if (col->numeric && len < SIML_COLUMNS_NUMBER_MAX &&
+            siml_columns_is_number(col->bytes + start, len)) {
+            char buf[SIML_COLUMNS_NUMBER_MAX];
+            char *dot;
+
+            /* strtod() reads the decimal point of the C locale */
+            memcpy(buf, col->bytes + start, len);
+            buf[len] = '\0';
+            dot = strchr(buf, '.');
+            if (dot) *dot = localeconv()->decimal_point[0];
+            col->numbers[c->rows] = strtod(buf, 0);
+            col->cells[c->rows] |= SIML_CELL_NUMBER;
+        }
+        col->offsets[c->rows + 1] = col->bytes_len;
+    }
+    c->rows += 1;
+    c->in_row = 0;
+}
+
+/* Column whose path leads to a node with key id at the next level of the
+ * current row, not yet filled; -1 if none.
+ */
+static int siml_columns_match(const siml_columns *c, unsigned int id) {
+    int base = (c->rows_mode == SIML_ROWS_ITEMS) ? 3 : 2;
+    int depth = c->level + 2 - base;
+    int i;
+
+    if (!c->in_row || id == 0 || depth < 1) return -1;
+    for (i = 0; i < c->count; ++i) {
+        const siml_column *col = &c->cols[i];
+        int k;
+
+        if (col->depth != depth || col->ids[depth - 1] != id ||
+            (col->cells[c->rows] & SIML_CELL_PRESENT)) {
+            continue;
+        }
+        for (k = 0; k < depth - 1 && col->ids[k] == c->path[base + k]; ++k) {
+        }
+        if (k == depth - 1) return i;
+    }
+    return -1;
+}
+
+siml_columns_result siml_columns_extract(siml_columns *c, siml_parser *p) {
+    siml_event ev;
+    int items;
+
+    if (!c || !p || c->count == 0) return SIML_COLUMNS_ERROR;
+    items = (c->rows_mode == SIML_ROWS_ITEMS);
+    if (!c->extracting) {
+        c->level = 0;
+        c->in_row = 0;
+        c->block_col = -1;
+        c->error_code = SIML_ERR_NONE;
+        c->error_line = 0;
+        c->error_message = 0;
+        {
+            const char *s = c->sub_text;
+            int i;
+            for (i = 0; i < c->count; ++i) {
+                c->subs[i] = items ? s : s + (s[1] == '.' ? 2 : 1);
+                s += strlen(s) + 1;
+            }
+        }
+        if (!siml_subscribe(p, c->subs, c->count, c->skip_mode)) {
+            return SIML_COLUMNS_ERROR;
+        }
+        c->extracting = 1;
+    }
+
+    for (;;) {
+        siml_event_type t = siml_next(p, &ev);
+        int i;
+
+        switch (t) {
+        case SIML_EVENT_NEED_MORE:
+            return SIML_COLUMNS_NEED_MORE;
+        case SIML_EVENT_ERROR:
+            (void)siml_subscribe(p, 0, 0, c->skip_mode);
+            return siml_columns_fail(c, SIML_COLUMNS_ERROR, ev.error_code,
+                                     ev.line,
+                                     ev.error_message ? ev.error_message
+                                                      : "parse error");
+        case SIML_EVENT_STREAM_END:
+            (void)siml_subscribe(p, 0, 0, c->skip_mode);
+            c->extracting = 0;
+            return SIML_COLUMNS_DONE;
+        case SIML_EVENT_DOCUMENT_START:
+            c->level = 0;
+            if (!items && !siml_columns_begin_row(c)) goto no_memory;
+            break;
+        case SIML_EVENT_DOCUMENT_END:
+            if (c->in_row) {
+                siml_columns_end_row(c);
+                if (c->rows == c->batch_rows) return SIML_COLUMNS_BATCH;
+            }
+            break;
+        case SIML_EVENT_MAPPING_START:
+        case SIML_EVENT_SEQUENCE_START:
+            c->level += 1;
+            if (c->level <= SIML_MAX_NESTING + 1) {
+                c->path[c->level] = (ev.key.len > 0)
+                    ? siml_keytab_find(&c->keys, ev.key.ptr, ev.key.len)
+                    : 0;
+            }
+            if (items && c->level == 2 && !siml_columns_begin_row(c)) {
+                goto no_memory;
+            }
+            break;
+        case SIML_EVENT_MAPPING_END:
+        case SIML_EVENT_SEQUENCE_END:
+            c->level -= 1;
+            if (items && c->level == 1 && c->in_row) {
+                siml_columns_end_row(c);
+                if (c->rows == c->batch_rows) return SIML_COLUMNS_BATCH;
+            }
+            break;
+        case SIML_EVENT_SCALAR:
+        case SIML_EVENT_BLOCK_SCALAR_START:
+            i = (ev.key.len > 0 && c->level <= SIML_MAX_NESTING)
+                ? siml_columns_match(c, siml_keytab_find(&c->keys, ev.key.ptr,
+                                                         ev.key.len))
+                : -1;
+            if (t == SIML_EVENT_BLOCK_SCALAR_START) {
+                c->level += 1;
+                c->block_col = i;
+                c->block_lines = 0;
+            }
+            if (i < 0) break;
+            c->cols[i].cells[c->rows] |= SIML_CELL_PRESENT;
+            if (t == SIML_EVENT_SCALAR &&
+                !siml_columns_append(c, &c->cols[i], ev.value.ptr,
+                                     ev.value.len)) {
+                goto no_memory;
+            }
+            break;
+        case SIML_EVENT_BLOCK_SCALAR_LINE:
+            if (c->block_col >= 0) {
+                siml_column *col = &c->cols[c->block_col];
+                if ((c->block_lines > 0 &&
+                     !siml_columns_append(c, col, "\n", 1)) ||
+                    !siml_columns_append(c, col, ev.value.ptr, ev.value.len)) {
+                    goto no_memory;
+                }
+                c->block_lines += 1;
+            }
+            break;
+        case SIML_EVENT_BLOCK_SCALAR_END:
+            c->level -= 1;
+            c->block_col = -1;
+            break;
+        default:
+            break;
+        }
+    }
+
+no_memory:
+    (void)siml_subscribe(p, 0, 0, c->skip_mode);
+    return siml_columns_fail(c, SIML_COLUMNS_NO_MEMORY, SIML_ERR_NONE, 0,
+                             "column memory limit exceeded");
+}
+
+#endif /* SIML_IMPLEMENTATION */
+
+#endif /* SIML_COLUMNS_H_INCLUDED */
@@ -0,0 +1,116 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIML_IMPLEMENTATION
+#include "siml.h"
+#include "siml-io.h"
+#include "siml-dom.h"
+#include "siml-bin.h"
+
+/* Compiles a SIML file into a .simlb image, or with -d writes the text of
+ * an image back out. A file is only compiled when its image decompiles to
+ * the same bytes, so every image round-trips exactly.
+ */
+
+static int write_file(const char *path, const char *data, size_t len) {
+    FILE *f = (strcmp(path, "-") == 0) ? stdout : fopen(path, "wb");
+    int ok;
+
+    if (!f) {
+        perror(path);
+        return 0;
+    }
+    ok = (len == 0 || fwrite(data, 1, len, f) == len);
+    if (f == stdout) {
+        ok = (fflush(f) == 0) && ok;
+    } else {
+        ok = (fclose(f) == 0) && ok;
+    }
+    if (!ok) perror(path);
+    return ok;
+}
+
+static int compile(const char *in, const char *out) {
+    siml_mmap_reader reader;
+    siml_parser parser;
+    siml_dom dom;
+    siml_dom_result r;
+    char *text = 0;
+    char *image = 0;
+    size_t text_len = 0;
+    size_t image_len = 0;
+    int rc = 1;
+
+    if (!siml_mmap_reader_open(&reader, in)) {
+        perror(in);
+        return 1;
+    }
+    siml_parser_init_buffer(&parser, reader.mem.data, reader.mem.len);
+    parser.validate_utf8 = 1;
+    siml_dom_init(&dom);
+    dom.keep_comments = 1;
+    r = siml_dom_build(&dom, &parser);
+    if (r != SIML_DOM_DONE) {
+        (void)fprintf(stderr, "%s: SIML error at line %ld: %s\n", in,
+                      dom.error_line,
+                      dom.error_message ? dom.error_message : "parse error");
+    } else if (!(text = siml_bin_decompile(&dom, &text_len)) ||
+               !(image = siml_bin_compile(&dom, &image_len))) {
+        (void)fprintf(stderr, "%s: out of memory\n", in);
+    } else if (text_len != reader.mem.len ||
+               (text_len > 0 && memcmp(text, reader.mem.data, text_len) != 0)) {
+        (void)fprintf(stderr, "%s: layout is not canonical, the image would "
+                              "not reproduce it\n", in);
+    } else if (write_file(out, image, image_len)) {
+        rc = 0;
+    }
+    free(text);
+    free(image);
+    siml_dom_free(&dom);
+    siml_mmap_reader_close(&reader);
+    return rc;
+}
+
+static int decompile(const char *in, const char *out) {
+    siml_mmap_reader reader;
+    siml_dom dom;
+    char *text = 0;
+    size_t text_len = 0;
+    int rc = 1;
+
+    if (!siml_mmap_reader_open(&reader, in)) {
+        perror(in);
+        return 1;
+    }
+    siml_dom_init(&dom);
+    if (siml_bin_load(&dom, reader.mem.data, reader.mem.len) !=
+        SIML_DOM_DONE) {
+        (void)fprintf(stderr, "%s: %s\n", in, dom.error_message);
+    } else if (!(text = siml_bin_decompile(&dom, &text_len))) {
+        (void)fprintf(stderr, "%s: out of memory\n", in);
+    } else if (write_file(out, text, text_len)) {
+        rc = 0;
+    }
+    free(text);
+    siml_dom_free(&dom);
+    siml_mmap_reader_close(&reader);
+    return rc;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 4 && strcmp(argv[1], "-d") == 0) {
+        return decompile(argv[2], argv[3]);
+    }
+    if (argc == 3 && argv[1][0] != '-') {
+        return compile(argv[1], argv[2]);
+    }
+    (void)fprintf(stderr,
+                  "Usage: %s <file.siml> <file.simlb>\n"
+                  "       %s -d <file.simlb> <file.siml>\n"
+                  "  '-' as the output writes to stdout\n",
+                  argv[0], argv[0]);
+    return 1;
+}
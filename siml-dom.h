@@ -0,0 +1,751 @@
+#ifndef SIML_DOM_H_INCLUDED
+#define SIML_DOM_H_INCLUDED
+
+/*
+ * SIML document tree v0.1
+ *
+ * Companion to siml.h. Builds a tree from the event stream of a parser.
+ *
+ * Nodes are kept in one flat array and linked by index: each node has its
+ * first child and next sibling, so a tree walk touches consecutive memory.
+ * For a buffer parser (siml_parser_init_buffer) the key and value slices
+ * point into the caller's buffer, and a whole stream costs one node array.
+ * For other inputs the text is copied into a few large blocks owned by the
+ * tree.
+ *
+ * All memory is counted in siml_dom.bytes; max_bytes caps it for untrusted
+ * input.
+ *
+ * Queries such as siml_dom_get(d, 0, "[1].ui.labels[2]") walk the tree by
+ * key and position. A mapping or sequence with at least SIML_DOM_INDEX_MIN
+ * children gets a hash or position index the first time it is searched, so
+ * repeated lookups do not scan siblings. Building an index changes the
+ * tree: queries on one tree must not run concurrently.
+ *
+ * Define SIML_IMPLEMENTATION in exactly one translation unit, as for siml.h.
+ */
+
+#include "siml.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h> /* size_t */
+
+typedef enum siml_node_kind_e {
+    SIML_NODE_STREAM = 0,     /* node 0; children are documents */
+    SIML_NODE_DOCUMENT,
+    SIML_NODE_MAPPING,
+    SIML_NODE_SEQUENCE,
+    SIML_NODE_SCALAR,
+    SIML_NODE_BLOCK_SCALAR,   /* children are its lines */
+    SIML_NODE_LINE,           /* one block scalar line, in value */
+    SIML_NODE_COMMENT         /* only with keep_comments */
+} siml_node_kind;
+
+/* One node. Index 0 is the stream, so 0 also means "none" for links.
+ *
+ *  - key is the mapping key that introduces the node, or empty.
+ *  - value is the text of SCALAR, LINE and COMMENT nodes.
+ *  - comment_spaces is set when an inline comment follows the node; with
+ *    keep_comments its text is the node's first child, a COMMENT.
+ *  - index locates the lookup index of a large MAPPING or SEQUENCE, once
+ *    built; 0 if none.
+ *  - style is the siml_seq_style of a SEQUENCE. A DOCUMENT has 1 when a
+ *    "---" line ends it, and the STREAM has 1 when it is built from a buffer
+ *    that does not end in a newline.
+ */
+typedef struct siml_node_s {
+    unsigned char  kind;            /* siml_node_kind */
+    unsigned char  style;           /* see above */
+    unsigned short comment_spaces;  /* 0 if none */
+    unsigned int   child_count;
+    unsigned int   first_child;
+    unsigned int   next_sibling;
+    siml_slice     key;
+    siml_slice     value;
+    long           line;
+    unsigned int   index;
+} siml_node;
+
+/* Block of copied text. */
+typedef struct siml_dom_chunk_s {
+    struct siml_dom_chunk_s *next;
+    size_t                   used;
+    size_t                   cap;
+} siml_dom_chunk;
+
+typedef enum siml_dom_result_e {
+    SIML_DOM_ERROR = 0,       /* parse error; see error_* */
+    SIML_DOM_DONE,
+    SIML_DOM_NEED_MORE,       /* push parser: feed, then build again */
+    SIML_DOM_NO_MEMORY        /* allocation failed or max_bytes reached */
+} siml_dom_result;
+
+/* Which node a lookup returns when a mapping repeats a key. Every
+ * occurrence can be visited with siml_dom_next_duplicate().
+ */
+typedef enum siml_dup_policy_e {
+    SIML_DUP_FIRST = 0,
+    SIML_DUP_LAST
+} siml_dup_policy;
+
+/* Nesting of open nodes: stream, document, containers, block scalar. */
+#define SIML_DOM_MAX_DEPTH (SIML_MAX_NESTING + 3)
+
+/* Children a mapping or sequence needs before lookups index it. */
+#ifndef SIML_DOM_INDEX_MIN
+#define SIML_DOM_INDEX_MIN 16
+#endif
+
+/* Steps in a path: one per key or [n], a dotted key counting per part. */
+#define SIML_PATH_MAX_STEPS (SIML_MAX_NESTING * 2)
+
+typedef struct siml_path_step_s {
+    const char   *key;        /* NULL for [n] */
+    size_t        len;        /* key length, or n */
+    unsigned long hash;
+} siml_path_step;
+
+/* A compiled path; keys point into the string it was compiled from. */
+typedef struct siml_path_s {
+    siml_path_step steps[SIML_PATH_MAX_STEPS];
+    int            count;
+} siml_path;
+
+typedef struct siml_dom_s {
+    /* Options; set before siml_dom_build() */
+    size_t          max_bytes;      /* 0 for no limit */
+    int             keep_comments;  /* boolean, default 0 */
+    siml_dup_policy duplicates;     /* may be changed at any time */
+
+    siml_node      *nodes;
+    unsigned int    count;
+    unsigned int    cap;
+    siml_dom_chunk *chunks;         /* copied text, newest first */
+    size_t          bytes;          /* memory held by the tree */
+    unsigned int   *index_pool;     /* lookup indexes, see siml_node.index */
+    size_t          index_len;
+    size_t          index_cap;
+
+    /* Build state */
+    int             building;       /* boolean */
+    int             copy;           /* boolean: input does not outlive events */
+    int             depth;
+    unsigned int    open[SIML_DOM_MAX_DEPTH];
+    unsigned int    last[SIML_DOM_MAX_DEPTH];  /* last child, 0 if none */
+
+    /* Set when siml_dom_build() fails */
+    siml_error_code error_code;
+    long            error_line;
+    const char     *error_message;
+    char            error_buf[160];
+} siml_dom;
+
+/* Initialize an empty tree. */
+void siml_dom_init(siml_dom *d);
+
+/* Build the tree from the rest of p's stream, replacing any previous one.
+ * For a push parser, SIML_DOM_NEED_MORE asks for siml_feed() and another
+ * call, which continues the same tree. Slices of a buffer parser point into
+ * its buffer, which must outlive the tree.
+ */
+siml_dom_result siml_dom_build(siml_dom *d, siml_parser *p);
+
+/* Release all memory of the tree. */
+void siml_dom_free(siml_dom *d);
+
+/* Child of mapping node with the given key, or 0. Of repeated keys, the
+ * one selected by d->duplicates is returned.
+ */
+unsigned int siml_dom_lookup(siml_dom *d, unsigned int node,
+                             const char *key, size_t key_len);
+
+/* Next sibling of node with the same key, or 0. */
+unsigned int siml_dom_next_duplicate(const siml_dom *d, unsigned int node);
+
+/* Compile path for siml_dom_query(). A path is a series of steps: a key
+ * (separated from a previous step by '.'), [key] for a key taken literally,
+ * or [n] for the n-th item of a sequence, counting from 0. The stream is a
+ * sequence of its documents, and a key looked up in it applies to the first
+ * one. A document stands for its root node.
+ *
+ * Keys may contain '.': a key step that finds nothing is retried together
+ * with the next one, so "range.min" finds the key "range.min" when there is
+ * no "min" below "range"; "[range.min]" finds only the former.
+ *
+ * Returns 1 on success, 0 for a malformed or too long path.
+ */
+int siml_path_compile(siml_path *q, const char *path);
+
+/* Node that q leads to from node, or 0. The tree must be complete
+ * (siml_dom_build() returned SIML_DOM_DONE).
+ */
+unsigned int siml_dom_query(siml_dom *d, unsigned int node,
+                            const siml_path *q);
+
+/* siml_path_compile() and siml_dom_query() in one call; 0 also for a
+ * malformed path.
+ */
+unsigned int siml_dom_get(siml_dom *d, unsigned int node, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* ---------------- Implementation ---------------- */
+#ifdef SIML_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Smallest block for copied text. */
+#define SIML_DOM_CHUNK_SIZE 65536
+
+void siml_dom_init(siml_dom *d) {
+    if (!d) return;
+    d->max_bytes = 0;
+    d->keep_comments = 0;
+    d->duplicates = SIML_DUP_FIRST;
+    d->nodes = 0;
+    d->count = 0;
+    d->cap = 0;
+    d->chunks = 0;
+    d->bytes = 0;
+    d->index_pool = 0;
+    d->index_len = 0;
+    d->index_cap = 0;
+    d->building = 0;
+    d->copy = 0;
+    d->depth = 0;
+    d->error_code = SIML_ERR_NONE;
+    d->error_line = 0;
+    d->error_message = 0;
+    d->error_buf[0] = '\0';
+}
+
+static void siml_dom_free_chunks(siml_dom *d) {
+    while (d->chunks) {
+        siml_dom_chunk *c = d->chunks;
+        d->chunks = c->next;
+        d->bytes -= sizeof(siml_dom_chunk) + c->cap;
+        free(c);
+    }
+}
+
+void siml_dom_free(siml_dom *d) {
+    if (!d) return;
+    siml_dom_free_chunks(d);
+    free(d->nodes);
+    free(d->index_pool);
+    d->nodes = 0;
+    d->index_pool = 0;
+    d->index_len = 0;
+    d->index_cap = 0;
+    d->count = 0;
+    d->cap = 0;
+    d->bytes = 0;
+    d->building = 0;
+}
+
+/* Whether n more bytes stay within max_bytes. */
+static int siml_dom_fits(const siml_dom *d, size_t n) {
+    return d->max_bytes == 0 || (d->bytes <= d->max_bytes &&
+                                 n <= d->max_bytes - d->bytes);
+}
+
+static int siml_dom_grow(siml_dom *d, size_t want) {
+    size_t old = (size_t)d->cap * sizeof(siml_node);
+    siml_node *nodes;
+
+    if (want <= d->cap) want = (size_t)d->cap * 2;
+    if (want < 64) want = 64;
+    if (want > 0xFFFFFFFFu) want = 0xFFFFFFFFu;
+    if (d->max_bytes != 0 && !siml_dom_fits(d, want * sizeof(siml_node) - old)) {
+        /* Shrink the step to what the budget allows. */
+        want = (d->max_bytes - d->bytes + old) / sizeof(siml_node);
+        if (want <= d->count) return 0;
+    }
+    nodes = (siml_node *)realloc(d->nodes, want * sizeof(siml_node));
+    if (!nodes) return 0;
+    d->nodes = nodes;
+    d->cap = (unsigned int)want;
+    d->bytes += want * sizeof(siml_node) - old;
+    return 1;
+}
+
+/* Copy s into the newest text block. */
+static int siml_dom_copy(siml_dom *d, siml_slice *s) {
+    siml_dom_chunk *c = d->chunks;
+    char *dst;
+
+    if (!d->copy || !s->ptr || s->len == 0) return 1;
+    if (!c || c->cap - c->used < s->len) {
+        size_t cap = s->len > SIML_DOM_CHUNK_SIZE ? s->len : SIML_DOM_CHUNK_SIZE;
+        if (!siml_dom_fits(d, sizeof(siml_dom_chunk) + cap)) {
+            cap = s->len;
+            if (!siml_dom_fits(d, sizeof(siml_dom_chunk) + cap)) return 0;
+        }
+        c = (siml_dom_chunk *)malloc(sizeof(siml_dom_chunk) + cap);
+        if (!c) return 0;
+        c->next = d->chunks;
+        c->used = 0;
+        c->cap = cap;
+        d->chunks = c;
+        d->bytes += sizeof(siml_dom_chunk) + cap;
+    }
+    dst = (char *)(c + 1) + c->used;
+    memcpy(dst, s->ptr, s->len);
+    c->used += s->len;
+    s->ptr = dst;
+    return 1;
+}
+
+/* Append a node as the last child of the innermost open node. Returns its
+ * index, or 0 when out of memory.
+ */
+static unsigned int siml_dom_add(siml_dom *d, siml_node_kind kind,
+                                 const siml_slice *key,
+                                 const siml_slice *value, long line) {
+    siml_node *n;
+    unsigned int i;
+    unsigned int parent;
+
+    if (d->count == d->cap && !siml_dom_grow(d, 0)) return 0;
+    i = d->count;
+    n = &d->nodes[i];
+    n->kind = (unsigned char)kind;
+    n->style = 0;
+    n->comment_spaces = 0;
+    n->child_count = 0;
+    n->first_child = 0;
+    n->next_sibling = 0;
+    n->key.ptr = 0;
+    n->key.len = 0;
+    n->value.ptr = 0;
+    n->value.len = 0;
+    n->line = line;
+    n->index = 0;
+    if (key) n->key = *key;
+    if (value) n->value = *value;
+    if (!siml_dom_copy(d, &n->key) || !siml_dom_copy(d, &n->value)) return 0;
+    d->count += 1;
+
+    if (d->depth > 0) {
+        parent = d->open[d->depth - 1];
+        d->nodes[parent].child_count += 1;
+        if (d->last[d->depth - 1]) {
+            d->nodes[d->last[d->depth - 1]].next_sibling = i;
+        } else {
+            d->nodes[parent].first_child = i;
+        }
+        d->last[d->depth - 1] = i;
+    }
+    return i;
+}
+
+static void siml_dom_push(siml_dom *d, unsigned int i) {
+    d->open[d->depth] = i;
+    d->last[d->depth] = 0;
+    d->depth += 1;
+}
+
+/* Record the event's inline comment on node i, which is open. */
+static int siml_dom_inline_comment(siml_dom *d, unsigned int i,
+                                   const siml_event *ev) {
+    if (ev->inline_comment_spaces == 0) return 1;
+    d->nodes[i].comment_spaces = (unsigned short)ev->inline_comment_spaces;
+    return !d->keep_comments ||
+           siml_dom_add(d, SIML_NODE_COMMENT, 0, &ev->inline_comment,
+                        ev->line) != 0;
+}
+
+static siml_dom_result siml_dom_fail(siml_dom *d, siml_dom_result r,
+                                     siml_error_code code, long line,
+                                     const char *msg) {
+    size_t n = strlen(msg);
+
+    if (n >= sizeof(d->error_buf)) n = sizeof(d->error_buf) - 1;
+    memcpy(d->error_buf, msg, n);
+    d->error_buf[n] = '\0';
+    d->error_code = code;
+    d->error_line = line;
+    d->error_message = d->error_buf;
+    d->building = 0;
+    return r;
+}
+
+siml_dom_result siml_dom_build(siml_dom *d, siml_parser *p) {
+    siml_event ev;
+
+    if (!d || !p) return SIML_DOM_ERROR;
+    if (!d->building) {
+        siml_dom_free_chunks(d);
+        d->count = 0;
+        d->index_len = 0;
+        d->depth = 0;
+        d->error_code = SIML_ERR_NONE;
+        d->error_line = 0;
+        d->error_message = 0;
+        d->copy = (p->input != SIML_INPUT_BUFFER);
+        if (!d->copy && d->cap == 0 &&
+            !siml_dom_grow(d, p->buffer.len / 32 + 64)) {
+            return siml_dom_fail(d, SIML_DOM_NO_MEMORY, SIML_ERR_NONE, 0,
+                                 "DOM memory limit exceeded");
+        }
+        /* The stream is node 0, so success shows in count. */
+        (void)siml_dom_add(d, SIML_NODE_STREAM, 0, 0, 0);
+        if (d->count == 0) {
+            return siml_dom_fail(d, SIML_DOM_NO_MEMORY, SIML_ERR_NONE, 0,
+                                 "DOM memory limit exceeded");
+        }
+        siml_dom_push(d, 0);
+        d->building = 1;
+    }
+
+    for (;;) {
+        siml_event_type t = siml_next(p, &ev);
+        unsigned int i = 1;
+
+        switch (t) {
+        case SIML_EVENT_NEED_MORE:
+            return SIML_DOM_NEED_MORE;
+        case SIML_EVENT_ERROR:
+            return siml_dom_fail(d, SIML_DOM_ERROR, ev.error_code, ev.line,
+                                 ev.error_message ? ev.error_message
+                                                  : "parse error");
+        case SIML_EVENT_STREAM_END:
+            if (p->input == SIML_INPUT_BUFFER && p->buffer.len > 0 &&
+                p->buffer.data[p->buffer.len - 1] != '\n') {
+                d->nodes[0].style = 1;
+            }
+            d->building = 0;
+            return SIML_DOM_DONE;
+        case SIML_EVENT_DOCUMENT_START:
+            i = siml_dom_add(d, SIML_NODE_DOCUMENT, 0, 0, ev.line);
+            if (i) siml_dom_push(d, i);
+            break;
+        case SIML_EVENT_MAPPING_START:
+            i = siml_dom_add(d, SIML_NODE_MAPPING, &ev.key, 0, ev.line);
+            if (i) siml_dom_push(d, i);
+            break;
+        case SIML_EVENT_SEQUENCE_START:
+            i = siml_dom_add(d, SIML_NODE_SEQUENCE, &ev.key, 0, ev.line);
+            if (i) {
+                d->nodes[i].style = (unsigned char)ev.seq_style;
+                siml_dom_push(d, i);
+                if (!siml_dom_inline_comment(d, i, &ev)) i = 0;
+            }
+            break;
+        case SIML_EVENT_BLOCK_SCALAR_START:
+            i = siml_dom_add(d, SIML_NODE_BLOCK_SCALAR, &ev.key, 0, ev.line);
+            if (i) {
+                siml_dom_push(d, i);
+                if (!siml_dom_inline_comment(d, i, &ev)) i = 0;
+            }
+            break;
+        case SIML_EVENT_SCALAR:
+            i = siml_dom_add(d, SIML_NODE_SCALAR, &ev.key, &ev.value, ev.line);
+            if (i) {
+                siml_dom_push(d, i);
+                if (!siml_dom_inline_comment(d, i, &ev)) i = 0;
+                d->depth -= 1;
+            }
+            break;
+        case SIML_EVENT_BLOCK_SCALAR_LINE:
+            i = siml_dom_add(d, SIML_NODE_LINE, 0, &ev.value, ev.line);
+            break;
+        case SIML_EVENT_COMMENT:
+            if (d->keep_comments) {
+                i = siml_dom_add(d, SIML_NODE_COMMENT, 0, &ev.value, ev.line);
+            }
+            break;
+        case SIML_EVENT_DOCUMENT_END:
+            if (p->awaiting_document && d->depth > 1) {
+                d->nodes[d->open[d->depth - 1]].style = 1;
+            }
+            if (d->depth > 1) d->depth -= 1;
+            break;
+        case SIML_EVENT_MAPPING_END:
+        case SIML_EVENT_SEQUENCE_END:
+        case SIML_EVENT_BLOCK_SCALAR_END:
+            if (d->depth > 1) d->depth -= 1;
+            break;
+        default:
+            break;
+        }
+        if (i == 0) {
+            return siml_dom_fail(d, SIML_DOM_NO_MEMORY, SIML_ERR_NONE, ev.line,
+                                 "DOM memory limit exceeded");
+        }
+    }
+}
+
+/* Lookup indexes ------------------------------------------------------
+ *
+ * Indexes live in index_pool; node.index is 1 + the offset of one. A
+ * mapping index is a power-of-two table size followed by that many (first,
+ * last) pairs of children with the same key, open-addressed by key hash. A
+ * sequence index is the item count followed by the items.
+ */
+
+static int siml_dom_key_is(const siml_node *n, const char *key, size_t len) {
+    return n->kind != SIML_NODE_COMMENT && n->key.len == len &&
+           memcmp(n->key.ptr, key, len) == 0;
+}
+
+/* Reserve n slots in index_pool. Returns their offset + 1, or 0. */
+static size_t siml_dom_index_alloc(siml_dom *d, size_t n) {
+    size_t at = d->index_len;
+
+    if (n > d->index_cap - d->index_len) {
+        size_t cap = d->index_cap ? d->index_cap * 2 : 1024;
+        unsigned int *pool;
+
+        while (cap - d->index_len < n) cap *= 2;
+        if (!siml_dom_fits(d, (cap - d->index_cap) * sizeof(unsigned int))) {
+            return 0;
+        }
+        pool = (unsigned int *)realloc(d->index_pool,
+                                       cap * sizeof(unsigned int));
+        if (!pool) return 0;
+        d->bytes += (cap - d->index_cap) * sizeof(unsigned int);
+        d->index_pool = pool;
+        d->index_cap = cap;
+    }
+    d->index_len += n;
+    return at + 1;
+}
+
+/* Index node if it is large enough. Without memory, lookups scan. */
+static void siml_dom_index(siml_dom *d, unsigned int node) {
+    siml_node *n = &d->nodes[node];
+    unsigned int *t;
+    size_t at;
+    unsigned int i;
+
+    if (n->index != 0 || n->child_count < SIML_DOM_INDEX_MIN) return;
+    if (n->kind == SIML_NODE_MAPPING) {
+        size_t size = 1;
+        while (size < (size_t)n->child_count * 2) size *= 2;
+        at = siml_dom_index_alloc(d, 1 + size * 2);
+        if (at == 0 || at > 0xFFFFFFFFu) return;
+        t = d->index_pool + at - 1;
+        t[0] = (unsigned int)size;
+        memset(t + 1, 0, size * 2 * sizeof(unsigned int));
+        for (i = n->first_child; i != 0; i = d->nodes[i].next_sibling) {
+            const siml_node *c = &d->nodes[i];
+            size_t h;
+
+            if (c->kind == SIML_NODE_COMMENT) continue;
+            h = siml_fnv1a(c->key.ptr, c->key.len) & (size - 1);
+            while (t[1 + h * 2] != 0 &&
+                   !siml_dom_key_is(&d->nodes[t[1 + h * 2]], c->key.ptr,
+                                    c->key.len)) {
+                h = (h + 1) & (size - 1);
+            }
+            if (t[1 + h * 2] == 0) t[1 + h * 2] = i;
+            t[2 + h * 2] = i;
+        }
+    } else if (n->kind == SIML_NODE_SEQUENCE || n->kind == SIML_NODE_STREAM) {
+        unsigned int count = 0;
+        at = siml_dom_index_alloc(d, 1 + (size_t)n->child_count);
+        if (at == 0 || at > 0xFFFFFFFFu) return;
+        t = d->index_pool + at - 1;
+        for (i = n->first_child; i != 0; i = d->nodes[i].next_sibling) {
+            if (d->nodes[i].kind != SIML_NODE_COMMENT) t[1 + count++] = i;
+        }
+        t[0] = count;
+    } else {
+        return;
+    }
+    n->index = (unsigned int)at;
+}
+
+static unsigned int siml_dom_find(siml_dom *d, unsigned int node,
+                                  const char *key, size_t len,
+                                  unsigned long hash) {
+    const siml_node *n = &d->nodes[node];
+    unsigned int found = 0;
+    unsigned int i;
+
+    if (n->kind != SIML_NODE_MAPPING) return 0;
+    if (n->index == 0) siml_dom_index(d, node);
+    n = &d->nodes[node];
+    if (n->index != 0) {
+        const unsigned int *t = d->index_pool + n->index - 1;
+        size_t mask = t[0] - 1;
+        size_t h = hash & mask;
+
+        while (t[1 + h * 2] != 0) {
+            if (siml_dom_key_is(&d->nodes[t[1 + h * 2]], key, len)) {
+                return t[(d->duplicates == SIML_DUP_LAST ? 2 : 1) + h * 2];
+            }
+            h = (h + 1) & mask;
+        }
+        return 0;
+    }
+    for (i = n->first_child; i != 0; i = d->nodes[i].next_sibling) {
+        if (siml_dom_key_is(&d->nodes[i], key, len)) {
+            found = i;
+            if (d->duplicates != SIML_DUP_LAST) break;
+        }
+    }
+    return found;
+}
+
+/* The n-th item of a sequence or document of the stream. */
+static unsigned int siml_dom_item(siml_dom *d, unsigned int node, size_t k) {
+    const siml_node *n = &d->nodes[node];
+    unsigned int i;
+
+    if (n->kind != SIML_NODE_SEQUENCE && n->kind != SIML_NODE_STREAM) {
+        return 0;
+    }
+    if (n->index == 0) siml_dom_index(d, node);
+    n = &d->nodes[node];
+    if (n->index != 0) {
+        const unsigned int *t = d->index_pool + n->index - 1;
+        return k < t[0] ? t[1 + k] : 0;
+    }
+    for (i = n->first_child; i != 0; i = d->nodes[i].next_sibling) {
+        if (d->nodes[i].kind == SIML_NODE_COMMENT) continue;
+        if (k == 0) return i;
+        k -= 1;
+    }
+    return 0;
+}
+
+unsigned int siml_dom_lookup(siml_dom *d, unsigned int node,
+                             const char *key, size_t key_len) {
+    if (!d || node >= d->count || !key) return 0;
+    return siml_dom_find(d, node, key, key_len, siml_fnv1a(key, key_len));
+}
+
+unsigned int siml_dom_next_duplicate(const siml_dom *d, unsigned int node) {
+    const siml_node *n;
+    unsigned int i;
+
+    if (!d || node == 0 || node >= d->count) return 0;
+    n = &d->nodes[node];
+    for (i = n->next_sibling; i != 0; i = d->nodes[i].next_sibling) {
+        if (siml_dom_key_is(&d->nodes[i], n->key.ptr, n->key.len)) return i;
+    }
+    return 0;
+}
+
+static int siml_path_key_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '_' || c == '-';
+}
+
+int siml_path_compile(siml_path *q, const char *path) {
+    const char *s = path;
+
+    if (!q || !path) return 0;
+    q->count = 0;
+    while (*s != '\0') {
+        siml_path_step *st;
+
+        if (q->count == SIML_PATH_MAX_STEPS) return 0;
+        st = &q->steps[q->count];
+        if (*s == '.' && q->count > 0 && siml_path_key_char(s[1])) ++s;
+        if (*s == '[' && siml_path_key_char(s[1]) &&
+            (s[1] < '0' || s[1] > '9')) {
+            st->key = ++s;
+            while (siml_path_key_char(*s) || *s == '.') ++s;
+            if (*s != ']') return 0;
+            st->len = (size_t)(s - st->key);
+            st->hash = siml_fnv1a(st->key, st->len);
+            ++s;
+        } else if (*s == '[') {
+            size_t k = 0;
+            ++s;
+            if (*s < '0' || *s > '9') return 0;
+            while (*s >= '0' && *s <= '9') {
+                size_t next = k * 10 + (size_t)(*s - '0');
+                if (next / 10 != k) return 0;
+                k = next;
+                ++s;
+            }
+            if (*s != ']') return 0;
+            ++s;
+            st->key = 0;
+            st->len = k;
+            st->hash = 0;
+        } else if (siml_path_key_char(*s) && (q->count == 0 || s[-1] == '.')) {
+            st->key = s;
+            while (siml_path_key_char(*s)) ++s;
+            st->len = (size_t)(s - st->key);
+            st->hash = siml_fnv1a(st->key, st->len);
+        } else {
+            return 0;
+        }
+        q->count += 1;
+    }
+    return 1;
+}
+
+/* Follow steps [s, count) from node. A key step that finds nothing, or
+ * whose remaining steps find nothing, is retried joined to the next key
+ * step with its '.'.
+ */
+static unsigned int siml_dom_walk(siml_dom *d, unsigned int node,
+                                  const siml_path *q, int s) {
+    const siml_path_step *st;
+    size_t len;
+    unsigned long hash;
+    int j;
+
+    if (s == q->count) return node;
+    st = &q->steps[s];
+    if (d->nodes[node].kind == SIML_NODE_STREAM && st->key) {
+        node = siml_dom_item(d, node, 0);
+        if (node == 0) return 0;
+    }
+    if (d->nodes[node].kind == SIML_NODE_DOCUMENT) {
+        node = d->nodes[node].first_child;
+        while (node != 0 && d->nodes[node].kind == SIML_NODE_COMMENT) {
+            node = d->nodes[node].next_sibling;
+        }
+        if (node == 0) return 0;
+    }
+    if (!st->key) {
+        node = siml_dom_item(d, node, st->len);
+        return node ? siml_dom_walk(d, node, q, s + 1) : 0;
+    }
+    len = st->len;
+    hash = st->hash;
+    for (j = s;;) {
+        unsigned int found = siml_dom_find(d, node, st->key, len, hash);
+        if (found) {
+            found = siml_dom_walk(d, found, q, j + 1);
+            if (found) return found;
+        }
+        if (st->key[len] != '.' || j + 1 == q->count ||
+            q->steps[j + 1].key != st->key + len + 1) {
+            return 0;
+        }
+        j += 1;
+        len = (size_t)(q->steps[j].key + q->steps[j].len - st->key);
+        hash = siml_fnv1a(st->key, len);
+    }
+}
+
+unsigned int siml_dom_query(siml_dom *d, unsigned int node,
+                            const siml_path *q) {
+    if (!d || !q || node >= d->count) return 0;
+    return siml_dom_walk(d, node, q, 0);
+}
+
+unsigned int siml_dom_get(siml_dom *d, unsigned int node, const char *path) {
+    siml_path q;
+
+    if (!siml_path_compile(&q, path)) return 0;
+    return siml_dom_query(d, node, &q);
+}
+
+#endif /* SIML_IMPLEMENTATION */
+
+#endif /* SIML_DOM_H_INCLUDED */
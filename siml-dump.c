@@ -1,85 +1,69 @@
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #define SIML_IMPLEMENTATION
 #include "siml.h"
+#include "siml-io.h"
+#include "siml-parallel.h"
+#include "siml-dom.h"
+#include "siml-bin.h"
+#include "siml-cache.h"
 
-struct file_reader {
-    FILE   *fp;
-    char   *buf;
-    size_t  cap;
-    size_t  lines_read;
-    long    fail_after;
+/* Wraps the real reader to inject I/O errors for tests. */
+struct test_reader {
+    siml_read_line_fn read_line;
+    void             *userdata;
+    size_t            lines_read;
+    long              fail_after;
 };
 
-static int siml_file_read_line(void *userdata,
+static int siml_test_read_line(void *userdata,
                                const char **out_line,
                                size_t *out_len) {
-    struct file_reader *r;
-    size_t len;
-    int ch;
-    int saw_lf;
-    size_t new_cap;
-    char *new_buf;
-
-    r = (struct file_reader *)userdata;
-    if (!r || !out_line || !out_len) {
-        return -1;
-    }
-    if (!r->fp) {
-        return -1;
-    }
+    struct test_reader *r;
+    int rc;
+
+    r = (struct test_reader *)userdata;
     if (r->fail_after >= 0 && r->lines_read >= (size_t)r->fail_after) {
         return -1;
     }
-
-    if (r->cap == 0) {
-        r->cap = 256;
-        r->buf = (char *)malloc(r->cap);
-        if (!r->buf) {
-            return -1;
-        }
+    rc = r->read_line(r->userdata, out_line, out_len);
+    if (rc == 1) {
+        r->lines_read += 1;
     }
+    return rc;
+}
 
-    len = 0;
-    saw_lf = 0;
-    while ((ch = fgetc(r->fp)) != EOF) {
-        if (ch == '\n') {
-            saw_lf = 1;
-            break;
-        }
-        if (len + 1 >= r->cap) {
-            new_cap = r->cap * 2;
-            new_buf = (char *)realloc(r->buf, new_cap);
-            if (!new_buf) {
-                return -1;
-            }
-            r->buf = new_buf;
-            r->cap = new_cap;
-        }
-        r->buf[len++] = (char)ch;
-    }
+/* Chunk buffer for -r push. */
+static char push_buf[65536];
 
-    if (ferror(r->fp)) {
-        return -1;
-    }
-    if (ch == EOF && len == 0) {
-        return 0;
+#ifdef SIML_DUMP_TEST_HOOKS
+/* siml-dump-test, built for tests.sh, also reads these from the
+ * environment: SIML_TEST_PUSH_CHUNK feeds -r push in chunks of that many
+ * bytes and SIML_TEST_PARALLEL_UNIT sets the unit size of -j.
+ */
+static void read_test_hooks(size_t *push_chunk, size_t *unit_size) {
+    const char *env;
+    long n;
+
+    env = getenv("SIML_TEST_PUSH_CHUNK");
+    if (env && env[0] != '\0') {
+        n = strtol(env, NULL, 10);
+        if (n > 0 && (size_t)n < *push_chunk) *push_chunk = (size_t)n;
     }
-    if (ch == EOF && len > 0 && !saw_lf) {
-        r->buf[len] = '\0';
-        *out_line = r->buf;
-        *out_len  = len;
-        return 2;
+    env = getenv("SIML_TEST_PARALLEL_UNIT");
+    if (env && env[0] != '\0') {
+        n = strtol(env, NULL, 10);
+        if (n > 0) *unit_size = (size_t)n;
     }
-
-    r->buf[len] = '\0';
-    *out_line = r->buf;
-    *out_len  = len;
-    r->lines_read += 1;
-    return 1;
 }
+#endif
 
 static void print_slice(const siml_slice *s) {
     if (s && s->ptr && s->len > 0) {
@@ -87,6 +71,21 @@ static void print_slice(const siml_slice *s) {
     }
 }
 
+/* Key table for -k; storage sized for a few thousand distinct keys. */
+static siml_keytab keytab;
+static size_t keytab_mem[262144 / sizeof(size_t)];
+static int print_key_ids;
+
+static void print_key(const siml_event *ev) {
+    if (ev->key.len > 0) {
+        (void)printf(" key=");
+        print_slice(&ev->key);
+        if (print_key_ids) {
+            (void)printf(" id=%u", ev->key_id);
+        }
+    }
+}
+
 static void print_inline_comment(const siml_event *ev) {
     if (ev->inline_comment.ptr && ev->inline_comment.len > 0) {
         (void)printf("  # (spaces=%u) ", ev->inline_comment_spaces);
@@ -94,52 +93,582 @@ static void print_inline_comment(const siml_event *ev) {
     }
 }
 
+static void print_event(const siml_event *ev) {
+    switch (ev->type) {
+    case SIML_EVENT_STREAM_START:
+        (void)printf("STREAM_START\n");
+        break;
+    case SIML_EVENT_DOCUMENT_START:
+        (void)printf("DOCUMENT_START\n");
+        break;
+    case SIML_EVENT_DOCUMENT_END:
+        (void)printf("DOCUMENT_END\n");
+        break;
+    case SIML_EVENT_MAPPING_START:
+        (void)printf("MAPPING_START");
+        print_key(ev);
+        (void)printf("\n");
+        break;
+    case SIML_EVENT_MAPPING_END:
+        (void)printf("MAPPING_END\n");
+        break;
+    case SIML_EVENT_SEQUENCE_START:
+        (void)printf("SEQUENCE_START");
+        if (ev->seq_style == SIML_SEQ_STYLE_FLOW) {
+            (void)printf(" style=flow");
+        } else {
+            (void)printf(" style=block");
+        }
+        print_key(ev);
+        print_inline_comment(ev);
+        (void)printf("\n");
+        break;
+    case SIML_EVENT_SEQUENCE_END:
+        (void)printf("SEQUENCE_END\n");
+        break;
+    case SIML_EVENT_SCALAR:
+        (void)printf("SCALAR");
+        print_key(ev);
+        (void)printf(" value='");
+        print_slice(&ev->value);
+        (void)printf("'");
+        print_inline_comment(ev);
+        (void)printf("\n");
+        break;
+    case SIML_EVENT_BLOCK_SCALAR_START:
+        (void)printf("BLOCK_SCALAR_START");
+        print_key(ev);
+        print_inline_comment(ev);
+        (void)printf("\n");
+        break;
+    case SIML_EVENT_BLOCK_SCALAR_LINE:
+        (void)printf("BLOCK_SCALAR_LINE '");
+        print_slice(&ev->value);
+        (void)printf("'\n");
+        break;
+    case SIML_EVENT_BLOCK_SCALAR_END:
+        (void)printf("BLOCK_SCALAR_END\n");
+        break;
+    case SIML_EVENT_COMMENT:
+        (void)printf("COMMENT ");
+        print_slice(&ev->value);
+        (void)printf("\n");
+        break;
+    default:
+        break;
+    }
+}
+
+/* Print the events that node i was built from. */
+static void print_node(const siml_dom *d, unsigned int i) {
+    const siml_node *n = &d->nodes[i];
+    unsigned int c = n->first_child;
+    siml_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.key = n->key;
+    ev.value = n->value;
+    ev.seq_style = (siml_seq_style)n->style;
+    if (n->comment_spaces != 0) {
+        ev.inline_comment_spaces = n->comment_spaces;
+        ev.inline_comment = d->nodes[c].value;
+        c = d->nodes[c].next_sibling;
+    }
+    switch (n->kind) {
+    case SIML_NODE_STREAM:
+        ev.type = SIML_EVENT_STREAM_START;
+        break;
+    case SIML_NODE_DOCUMENT:
+        ev.type = SIML_EVENT_DOCUMENT_START;
+        break;
+    case SIML_NODE_MAPPING:
+        ev.type = SIML_EVENT_MAPPING_START;
+        break;
+    case SIML_NODE_SEQUENCE:
+        ev.type = SIML_EVENT_SEQUENCE_START;
+        break;
+    case SIML_NODE_SCALAR:
+        ev.type = SIML_EVENT_SCALAR;
+        break;
+    case SIML_NODE_BLOCK_SCALAR:
+        ev.type = SIML_EVENT_BLOCK_SCALAR_START;
+        break;
+    case SIML_NODE_LINE:
+        ev.type = SIML_EVENT_BLOCK_SCALAR_LINE;
+        break;
+    case SIML_NODE_COMMENT:
+        ev.type = SIML_EVENT_COMMENT;
+        break;
+    default:
+        return;
+    }
+    print_event(&ev);
+    for (; c != 0; c = d->nodes[c].next_sibling) {
+        print_node(d, c);
+    }
+    switch (n->kind) {
+    case SIML_NODE_STREAM:
+        (void)printf("STREAM_END\n");
+        break;
+    case SIML_NODE_DOCUMENT:
+        (void)printf("DOCUMENT_END\n");
+        break;
+    case SIML_NODE_MAPPING:
+        (void)printf("MAPPING_END\n");
+        break;
+    case SIML_NODE_SEQUENCE:
+        (void)printf("SEQUENCE_END\n");
+        break;
+    case SIML_NODE_BLOCK_SCALAR:
+        (void)printf("BLOCK_SCALAR_END\n");
+        break;
+    default:
+        break;
+    }
+}
+
+/* Options that are given, for option_conflicts */
+#define OPT_J     0x001   /* -j */
+#define OPT_DOM   0x002   /* -d, -q or -r simlb */
+#define OPT_S     0x004   /* -s */
+#define OPT_F     0x008   /* -f */
+#define OPT_K     0x010   /* -k */
+#define OPT_C     0x020   /* -c */
+#define OPT_R     0x040   /* -r other than mmap */
+#define OPT_TAPE  0x080   /* -r tape */
+#define OPT_SIMLB 0x100   /* -r simlb */
+
+/* Pairs of options that cannot be used together; the first match is
+ * reported.
+ */
+static const struct {
+    int first;
+    int second;
+    const char *message;
+} option_conflicts[] = {
+    { OPT_J, OPT_R, "-j reads only with -r mmap" },
+    { OPT_J, OPT_DOM, "-j cannot be combined with -d or -q" },
+    { OPT_C, OPT_R, "-c reads only with -r mmap" },
+    { OPT_C, OPT_J | OPT_DOM, "-c cannot be combined with -j, -d or -q" },
+    { OPT_S, OPT_J | OPT_DOM,
+      "-s cannot be combined with -j, -d, -q or -r simlb" },
+    { OPT_S, OPT_C | OPT_TAPE, "-s cannot be combined with -c or -r tape" },
+    { OPT_F, OPT_J | OPT_SIMLB, "-f cannot be combined with -j or -r simlb" },
+    { OPT_F, OPT_C | OPT_TAPE, "-f cannot be combined with -c or -r tape" },
+    { OPT_K, OPT_J | OPT_DOM,
+      "-k cannot be combined with -j, -d, -q or -r simlb" }
+};
+
 int main(int argc, char **argv) {
     const char *filename;
-    FILE *fp;
+    int fd;
     siml_parser parser;
     siml_event ev;
-    struct file_reader reader;
+    const char *reader_name;
+    siml_fd_reader reader;
+    siml_prefetch_reader preader;
+    siml_mmap_reader mreader;
+    siml_parallel pparser;
+    siml_dom dom;
+    siml_mmap_reader tape_map;
+    siml_tape_reader tape_reader;
+    siml_cache cache;
+    const char *cache_dir;
+    struct test_reader treader;
+    int mapped;
+    int prefetch;
+    int push;
+    int tape;
+    int simlb;
+    size_t push_chunk;
+    size_t unit_size;
+    long threads;
+    int parallel;
+    int use_dom;
+    const char *query;
+    long skip_level;
+    const char *subs[SIML_MAX_SUBSCRIPTIONS];
+    int sub_count;
+    siml_skip_mode skip_mode;
+    int validate_utf8;
+    int dup_last;
+    size_t max_bytes;
+    int used;
+    size_t k;
+    int skipping;
+    long level;
+    int argi;
     int rc;
 
-    if (argc != 2) {
-        (void)fprintf(stderr, "Usage: %s <file.siml>\n", argv[0]);
+    reader_name = NULL;
+    cache_dir = NULL;
+    filename = NULL;
+    threads = 0;
+    parallel = 0;
+    use_dom = 0;
+    query = NULL;
+    skip_level = 0;
+    sub_count = 0;
+    skip_mode = SIML_SKIP_INDENT;
+    validate_utf8 = 1;
+    dup_last = 0;
+    max_bytes = 0;
+    for (argi = 1; argi + 1 < argc; ++argi) {
+        if (strcmp(argv[argi], "-d") == 0) {
+            use_dom = 1;
+        } else if (strcmp(argv[argi], "-q") == 0 && argi + 2 < argc) {
+            query = argv[++argi];
+            use_dom = 1;
+        } else if (strcmp(argv[argi], "-r") == 0 && argi + 2 < argc) {
+            reader_name = argv[++argi];
+        } else if (strcmp(argv[argi], "-c") == 0 && argi + 2 < argc) {
+            cache_dir = argv[++argi];
+        } else if (strcmp(argv[argi], "-j") == 0 && argi + 2 < argc) {
+            threads = strtol(argv[++argi], NULL, 10);
+            parallel = 1;
+        } else if (strcmp(argv[argi], "-s") == 0 && argi + 2 < argc) {
+            skip_level = strtol(argv[++argi], NULL, 10);
+        } else if (strcmp(argv[argi], "-m") == 0 && argi + 2 < argc) {
+            const char *mode = argv[++argi];
+            if (strcmp(mode, "validate") == 0) {
+                skip_mode = SIML_SKIP_VALIDATE;
+            } else if (strcmp(mode, "lines") == 0) {
+                skip_mode = SIML_SKIP_LINES;
+            } else if (strcmp(mode, "indent") == 0) {
+                skip_mode = SIML_SKIP_INDENT;
+            } else {
+                (void)fprintf(stderr, "%s: unknown skip mode %s\n", argv[0],
+                              mode);
+                return 1;
+            }
+        } else if (strcmp(argv[argi], "-l") == 0) {
+            dup_last = 1;
+        } else if (strcmp(argv[argi], "-b") == 0 && argi + 2 < argc) {
+            long n = strtol(argv[++argi], NULL, 10);
+            max_bytes = (n > 0) ? (size_t)n : 0;
+        } else if (strcmp(argv[argi], "-a") == 0) {
+            validate_utf8 = 0;
+        } else if (strcmp(argv[argi], "-k") == 0) {
+            print_key_ids = 1;
+        } else if (strcmp(argv[argi], "-f") == 0 && argi + 2 < argc &&
+                   sub_count < SIML_MAX_SUBSCRIPTIONS) {
+            subs[sub_count++] = argv[++argi];
+        } else {
+            break;
+        }
+    }
+    if (argi + 1 == argc) {
+        filename = argv[argi];
+    }
+    simlb = (reader_name && strcmp(reader_name, "simlb") == 0);
+    if (simlb) {
+        use_dom = 1;
+    }
+    used = 0;
+    if (parallel) used |= OPT_J;
+    if (use_dom) used |= OPT_DOM;
+    if (skip_level > 0) used |= OPT_S;
+    if (sub_count > 0) used |= OPT_F;
+    if (print_key_ids) used |= OPT_K;
+    if (cache_dir) used |= OPT_C;
+    if (reader_name && strcmp(reader_name, "mmap") != 0) used |= OPT_R;
+    if (reader_name && strcmp(reader_name, "tape") == 0) used |= OPT_TAPE;
+    if (simlb) used |= OPT_SIMLB;
+    if (reader_name && strcmp(reader_name, "mmap") != 0 &&
+        strcmp(reader_name, "read") != 0 &&
+        strcmp(reader_name, "prefetch") != 0 &&
+        strcmp(reader_name, "push") != 0 &&
+        strcmp(reader_name, "tape") != 0 && !simlb) {
+        (void)fprintf(stderr, "%s: unknown reader %s\n", argv[0],
+                      reader_name);
+        return 1;
+    }
+    for (k = 0; k < sizeof(option_conflicts) / sizeof(option_conflicts[0]);
+         ++k) {
+        if ((used & option_conflicts[k].first) &&
+            (used & option_conflicts[k].second)) {
+            (void)fprintf(stderr, "%s: %s\n", argv[0],
+                          option_conflicts[k].message);
+            return 1;
+        }
+    }
+    if (!filename) {
+        (void)fprintf(stderr,
+                      "Usage: %s [-r mmap|read|prefetch|push|tape|simlb]\n"
+                      "       [-j threads | -d | -q path | -s level | -c dir]\n"
+                      "       [-f path]... [-m mode] [-k] [-l] [-b bytes] [-a]\n"
+                      "       <file.siml>\n"
+                      "  -r tape replays <file.siml>.tape, recording it first if\n"
+                      "     it is missing or stale\n"
+                      "  -r simlb loads the tree from a compiled <file.simlb>\n"
+                      "  -j parses documents on threads (0: one per CPU)\n"
+                      "  -d builds a document tree and prints it\n"
+                      "  -q prints the node at path, e.g. [0].flags[1]\n",
+                      argv[0]);
+        (void)fprintf(stderr,
+                      "  -s skips the nodes opened at nesting level (1: roots)\n"
+                      "  -f reports only the nodes at path, e.g. range.*, skipping\n"
+                      "     the rest as -s does\n"
+                      "  -m sets what -s and -f check in skipped lines: all\n"
+                      "     (validate), line rules (lines) or indentation\n"
+                      "     (indent, the default)\n"
+                      "  -k prints the key table id after each key\n");
+        (void)fprintf(stderr,
+                      "  -l lets the last of repeated keys count for -d and -q\n"
+                      "     (default: the first)\n"
+                      "  -b caps the memory of the tree of -d and -q at bytes\n"
+                      "  -a accepts any bytes, without checking UTF-8\n"
+                      "  -c replays the events kept in the cache directory dir,\n"
+                      "     parsing and keeping them first if they are not there\n");
         return 1;
     }
 
-    if (strcmp(argv[1], "-") == 0) {
-        fp = stdin;
+    fd = -1;
+    mapped = 0;
+    prefetch = (reader_name && strcmp(reader_name, "prefetch") == 0);
+    push = (reader_name && strcmp(reader_name, "push") == 0);
+    tape = (reader_name && strcmp(reader_name, "tape") == 0) || cache_dir;
+    if (strcmp(filename, "-") == 0) {
+        fd = STDIN_FILENO;
         filename = "<stdin>";
-    } else {
-        filename = argv[1];
-        fp = fopen(filename, "r");
-        if (!fp) {
+    } else if (!reader_name || strcmp(reader_name, "mmap") == 0 || tape ||
+               simlb) {
+        /* Regular files are mapped; anything else is read in chunks. */
+        mapped = siml_mmap_reader_open(&mreader, filename);
+    }
+    if (!mapped && fd < 0) {
+        if (parallel || tape || simlb ||
+            (reader_name && strcmp(reader_name, "mmap") == 0)) {
+            perror(filename);
+            return 1;
+        }
+        fd = open(filename, O_RDONLY);
+        if (fd < 0) {
             perror(filename);
             return 1;
         }
     }
+    if ((parallel || tape || simlb) && !mapped) {
+        (void)fprintf(stderr, "%s: -%c needs a regular file\n", filename,
+                      parallel ? 'j' : cache_dir ? 'c' : 'r');
+        return 1;
+    }
 
-    reader.fp  = fp;
-    reader.buf = NULL;
-    reader.cap = 0;
-    reader.lines_read = 0;
-    reader.fail_after = -1;
+    if (mapped) {
+        treader.read_line = siml_mmap_read_line;
+        treader.userdata  = &mreader;
+    } else if (push) {
+        treader.read_line = 0;
+        treader.userdata  = 0;
+    } else if (prefetch) {
+        if (!siml_prefetch_reader_init(&preader, fd, 0)) {
+            perror(filename);
+            if (fd != STDIN_FILENO) {
+                (void)close(fd);
+            }
+            return 1;
+        }
+        treader.read_line = siml_prefetch_read_line;
+        treader.userdata  = &preader;
+    } else {
+        if (!siml_fd_reader_init(&reader, fd, 0)) {
+            perror(filename);
+            if (fd != STDIN_FILENO) {
+                (void)close(fd);
+            }
+            return 1;
+        }
+        treader.read_line = siml_fd_read_line;
+        treader.userdata  = &reader;
+    }
+    treader.lines_read = 0;
+    treader.fail_after = -1;
     {
         const char *env = getenv("SIML_TEST_READ_ERROR_AFTER");
         if (env && env[0] != '\0') {
-            reader.fail_after = strtol(env, NULL, 10);
-            if (reader.fail_after < 0) {
-                reader.fail_after = -1;
+            treader.fail_after = strtol(env, NULL, 10);
+            if (treader.fail_after < 0) {
+                treader.fail_after = -1;
             }
         }
     }
+    push_chunk = sizeof(push_buf);
+    unit_size = 0;
+#ifdef SIML_DUMP_TEST_HOOKS
+    read_test_hooks(&push_chunk, &unit_size);
+#endif
+
+    if (parallel) {
+        if (!siml_parallel_init(&pparser, mreader.mem.data, mreader.mem.len,
+                                (int)threads)) {
+            perror(filename);
+            siml_mmap_reader_close(&mreader);
+            return 1;
+        }
+        pparser.validate_utf8 = validate_utf8;
+        if (unit_size > 0) {
+            pparser.unit_size = unit_size;
+        }
+    }
+    if (push) {
+        siml_parser_init_push(&parser);
+    } else if (treader.fail_after >= 0) {
+        siml_parser_init(&parser, siml_test_read_line, &treader);
+    } else if (mapped) {
+        siml_parser_init_buffer(&parser, mreader.mem.data, mreader.mem.len);
+    } else {
+        siml_parser_init(&parser, treader.read_line, treader.userdata);
+    }
+    parser.validate_utf8 = validate_utf8;
+    if (print_key_ids) {
+        (void)siml_keytab_init(&keytab, keytab_mem, sizeof(keytab_mem));
+        siml_parser_set_keytab(&parser, &keytab);
+    }
+    if (!siml_subscribe(&parser, subs, sub_count, skip_mode)) {
+        (void)fprintf(stderr, "%s: bad -f path\n", argv[0]);
+        if (mapped) {
+            siml_mmap_reader_close(&mreader);
+        } else {
+            if (prefetch) {
+                siml_prefetch_reader_free(&preader);
+            } else if (!push) {
+                siml_fd_reader_free(&reader);
+            }
+            if (fd != STDIN_FILENO) {
+                (void)close(fd);
+            }
+        }
+        return 1;
+    }
+
+    if (cache_dir) {
+        siml_cache_init(&cache, cache_dir);
+        cache.validate_utf8 = validate_utf8;
+        cache.keep_tape = 1;
+        if (!siml_cache_check(&cache, mreader.mem.data, mreader.mem.len)) {
+            (void)fprintf(stderr, "%s: out of memory\n", filename);
+            siml_mmap_reader_close(&mreader);
+            return 1;
+        }
+        if (!siml_tape_reader_init(&tape_reader, cache.tape, cache.tape_len,
+                                   mreader.mem.data, mreader.mem.len,
+                                   cache.validate_utf8)) {
+            (void)fprintf(stderr, "%s: damaged entry in cache %s\n",
+                          filename, cache_dir);
+            siml_cache_close(&cache);
+            siml_mmap_reader_close(&mreader);
+            return 1;
+        }
+    } else if (tape) {
+        char *path = (char *)malloc(strlen(filename) + 6);
+        int ok = (path != 0);
 
-    siml_parser_init(&parser, siml_file_read_line, &reader);
+        if (ok) {
+            (void)sprintf(path, "%s.tape", filename);
+            ok = siml_mmap_reader_open(&tape_map, path);
+            /* A tape of another source, revision, limits or -a setting is
+             * recorded again.
+             */
+            if (ok && !siml_tape_reader_init(&tape_reader, tape_map.mem.data,
+                                             tape_map.mem.len,
+                                             mreader.mem.data,
+                                             mreader.mem.len, validate_utf8)) {
+                siml_mmap_reader_close(&tape_map);
+                ok = 0;
+            }
+            if (!ok) {
+                ok = siml_tape_save(&parser, path) &&
+                     siml_mmap_reader_open(&tape_map, path) &&
+                     siml_tape_reader_init(&tape_reader, tape_map.mem.data,
+                                           tape_map.mem.len, mreader.mem.data,
+                                           mreader.mem.len, validate_utf8);
+            }
+        }
+        if (!ok) {
+            perror(path ? path : filename);
+            free(path);
+            siml_mmap_reader_close(&mreader);
+            return 1;
+        }
+        free(path);
+    }
 
     rc = 0;
-    while (1) {
+    if (use_dom) {
+        siml_dom_result r;
+        siml_dom_init(&dom);
+        dom.keep_comments = 1;
+        dom.max_bytes = max_bytes;
+        if (dup_last) {
+            dom.duplicates = SIML_DUP_LAST;
+        }
+        if (simlb) {
+            r = siml_bin_load(&dom, mreader.mem.data, mreader.mem.len);
+        }
+        while (!simlb &&
+               (r = siml_dom_build(&dom, &parser)) == SIML_DOM_NEED_MORE) {
+            long n;
+            do {
+                n = (long)read(fd, push_buf, push_chunk);
+            } while (n < 0 && errno == EINTR);
+            if (n < 0) {
+                perror(filename);
+                r = SIML_DOM_ERROR;
+                break;
+            }
+            if (n == 0) {
+                siml_feed_end(&parser);
+            } else {
+                (void)siml_feed(&parser, push_buf, (size_t)n);
+            }
+        }
+        if (r == SIML_DOM_DONE && query) {
+            unsigned int node = siml_dom_get(&dom, 0, query);
+            if (node != 0) {
+                print_node(&dom, node);
+            } else {
+                (void)fprintf(stderr, "%s: no node at %s\n", filename, query);
+                r = SIML_DOM_ERROR;
+            }
+        } else if (r == SIML_DOM_DONE) {
+            print_node(&dom, 0);
+        } else if (dom.error_message) {
+            (void)fprintf(stderr, "SIML error at line %ld: %s\n",
+                          dom.error_line, dom.error_message);
+        }
+        rc = (r == SIML_DOM_DONE) ? 0 : 1;
+        siml_dom_free(&dom);
+    }
+    skipping = 0;
+    level = 0;
+    while (!use_dom) {
         siml_event_type t;
-        t = siml_next(&parser, &ev);
+        if (skipping) {
+            t = siml_skip(&parser, &ev, skip_mode);
+        } else if (parallel) {
+            t = siml_parallel_next(&pparser, &ev);
+        } else if (tape) {
+            t = siml_tape_next(&tape_reader, &ev);
+        } else {
+            t = siml_next(&parser, &ev);
+        }
+        if (t == SIML_EVENT_NEED_MORE) {
+            long n;
+            do {
+                n = (long)read(fd, push_buf, push_chunk);
+            } while (n < 0 && errno == EINTR);
+            if (n < 0) {
+                perror(filename);
+                rc = 1;
+                break;
+            }
+            if (n == 0) {
+                siml_feed_end(&parser);
+            } else {
+                (void)siml_feed(&parser, push_buf, (size_t)n);
+            }
+            continue;
+        }
         if (t == SIML_EVENT_ERROR) {
             (void)fprintf(stderr, "SIML error at line %ld: %s\n",
                           ev.line,
@@ -152,86 +681,37 @@ int main(int argc, char **argv) {
             break;
         }
 
-        switch (t) {
-        case SIML_EVENT_STREAM_START:
-            (void)printf("STREAM_START\n");
-            break;
-        case SIML_EVENT_DOCUMENT_START:
-            (void)printf("DOCUMENT_START\n");
-            break;
-        case SIML_EVENT_DOCUMENT_END:
-            (void)printf("DOCUMENT_END\n");
-            break;
-        case SIML_EVENT_MAPPING_START:
-            (void)printf("MAPPING_START");
-            if (ev.key.len > 0) {
-                (void)printf(" key=");
-                print_slice(&ev.key);
-            }
-            (void)printf("\n");
-            break;
-        case SIML_EVENT_MAPPING_END:
-            (void)printf("MAPPING_END\n");
-            break;
-        case SIML_EVENT_SEQUENCE_START:
-            (void)printf("SEQUENCE_START");
-            if (ev.seq_style == SIML_SEQ_STYLE_FLOW) {
-                (void)printf(" style=flow");
-            } else {
-                (void)printf(" style=block");
-            }
-            if (ev.key.len > 0) {
-                (void)printf(" key=");
-                print_slice(&ev.key);
-            }
-            print_inline_comment(&ev);
-            (void)printf("\n");
-            break;
-        case SIML_EVENT_SEQUENCE_END:
-            (void)printf("SEQUENCE_END\n");
-            break;
-        case SIML_EVENT_SCALAR:
-            (void)printf("SCALAR");
-            if (ev.key.len > 0) {
-                (void)printf(" key=");
-                print_slice(&ev.key);
-            }
-            (void)printf(" value='");
-            print_slice(&ev.value);
-            (void)printf("'");
-            print_inline_comment(&ev);
-            (void)printf("\n");
-            break;
-        case SIML_EVENT_BLOCK_SCALAR_START:
-            (void)printf("BLOCK_SCALAR_START");
-            if (ev.key.len > 0) {
-                (void)printf(" key=");
-                print_slice(&ev.key);
-            }
-            print_inline_comment(&ev);
-            (void)printf("\n");
-            break;
-        case SIML_EVENT_BLOCK_SCALAR_LINE:
-            (void)printf("BLOCK_SCALAR_LINE '");
-            print_slice(&ev.value);
-            (void)printf("'\n");
-            break;
-        case SIML_EVENT_BLOCK_SCALAR_END:
-            (void)printf("BLOCK_SCALAR_END\n");
-            break;
-        case SIML_EVENT_COMMENT:
-            (void)printf("COMMENT ");
-            print_slice(&ev.value);
-            (void)printf("\n");
-            break;
-        default:
-            break;
+        print_event(&ev);
+        skipping = 0;
+        if (t == SIML_EVENT_MAPPING_START || t == SIML_EVENT_SEQUENCE_START ||
+            t == SIML_EVENT_BLOCK_SCALAR_START) {
+            level += 1;
+            skipping = (level == skip_level);
+        } else if (t == SIML_EVENT_MAPPING_END || t == SIML_EVENT_SEQUENCE_END ||
+                   t == SIML_EVENT_BLOCK_SCALAR_END) {
+            level -= 1;
         }
     }
 
-    free(reader.buf);
-    if (fp != stdin) {
-        fclose(fp);
+    if (parallel) {
+        siml_parallel_free(&pparser);
+    }
+    if (cache_dir) {
+        siml_cache_close(&cache);
+    } else if (tape) {
+        siml_mmap_reader_close(&tape_map);
+    }
+    if (mapped) {
+        siml_mmap_reader_close(&mreader);
+    } else {
+        if (prefetch) {
+            siml_prefetch_reader_free(&preader);
+        } else if (!push) {
+            siml_fd_reader_free(&reader);
+        }
+        if (fd != STDIN_FILENO) {
+            (void)close(fd);
+        }
     }
 
     return rc;
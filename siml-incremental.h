@@ -0,0 +1,367 @@
+#ifndef SIML_INCREMENTAL_H_INCLUDED
+#define SIML_INCREMENTAL_H_INCLUDED
+
+/*
+ * SIML incremental validation v0.1
+ *
+ * Companion to siml-parallel.h. Keeps the outcome of checking an in-memory
+ * stream so that, after an edit, only the part of the stream around the
+ * edit is parsed again.
+ *
+ * The stream is cut where siml-parallel.h cuts it, at every indent-0 line
+ * that can start a unit: after each "---" separator and at each top-level
+ * entry of a document. A unit is checked on its own, as a worker of
+ * siml_parallel would parse it, and keeps its length, its line count and
+ * its first error. After an edit, units are cut and checked again from the
+ * unit before the edit up to the first cut past the edit that falls where
+ * an old one did; the units after it are taken over unchanged. The error
+ * reported is that of the first failing unit, which is the error a parse of
+ * the whole stream reports.
+ *
+ * The cost of an edit is the parse of the units it touches plus one pass
+ * over the unit table, a few words per top-level entry. A document without
+ * top-level entries after its first line is one unit, parsed whole.
+ *
+ * Define SIML_IMPLEMENTATION in exactly one translation unit, as for siml.h,
+ * with the requirements of siml-parallel.h.
+ */
+
+#include "siml.h"
+#include "siml-parallel.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h> /* size_t */
+
+/* One checked part of the stream. */
+typedef struct siml_incremental_unit_s {
+    size_t           len;
+    long             lines;          /* LFs in the unit */
+    unsigned char    start;          /* siml_resume_kind */
+    unsigned char    to_entry;       /* boolean: ends before a top-level entry */
+    siml_error_code  error_code;     /* SIML_ERR_NONE if the unit is valid */
+    long             error_line;     /* counted from the unit's first line */
+    char            *error_message;  /* allocated; NULL if valid */
+} siml_incremental_unit;
+
+typedef struct siml_incremental_s {
+    /* Options; set before siml_incremental_parse() */
+    int                    validate_utf8;  /* boolean, default SIML_VALIDATE_UTF8 */
+
+    siml_incremental_unit *units;
+    size_t                 count;
+    size_t                 cap;
+    size_t                 len;            /* bytes of the stream */
+
+    /* Work done by the last parse or edit */
+    size_t                 parsed_bytes;
+    size_t                 parsed_units;
+
+    /* First error of the stream; error_message is NULL if it is valid */
+    siml_error_code        error_code;
+    long                   error_line;
+    const char            *error_message;
+} siml_incremental;
+
+/* Initialize s with default options and no stream. */
+void siml_incremental_init(siml_incremental *s);
+
+/* Check the whole stream of len bytes at data. Returns 1, or 0 when out of
+ * memory, which leaves s empty.
+ */
+int siml_incremental_parse(siml_incremental *s, const char *data, size_t len);
+
+/* Check data (len bytes) again after an edit that replaced old_len bytes at
+ * offset of the stream last checked with new_len bytes. Returns 1, or 0 for
+ * an edit that does not fit the old stream or when out of memory; s is
+ * then empty and siml_incremental_parse() starts over.
+ */
+int siml_incremental_edit(siml_incremental *s, const char *data, size_t len,
+                          size_t offset, size_t old_len, size_t new_len);
+
+/* Release all memory. */
+void siml_incremental_free(siml_incremental *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* ---------------- Implementation ---------------- */
+#ifdef SIML_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+
+void siml_incremental_init(siml_incremental *s) {
+    if (!s) return;
+    memset(s, 0, sizeof(*s));
+    s->validate_utf8 = SIML_VALIDATE_UTF8;
+}
+
+static void siml_incremental_drop(siml_incremental_unit *u, size_t n) {
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        free(u[i].error_message);
+        u[i].error_message = 0;
+    }
+}
+
+void siml_incremental_free(siml_incremental *s) {
+    if (!s) return;
+    siml_incremental_drop(s->units, s->count);
+    free(s->units);
+    s->units = 0;
+    s->count = 0;
+    s->cap = 0;
+    s->len = 0;
+    s->error_code = SIML_ERR_NONE;
+    s->error_line = 0;
+    s->error_message = 0;
+}
+
+/* Check unit u, which starts at data and has avail bytes to the end of the
+ * stream, as siml_parallel_parse() does. Returns 0 when out of memory.
+ */
+static int siml_incremental_check(siml_incremental *s,
+                                  siml_incremental_unit *u,
+                                  const char *data, size_t avail, int last) {
+    siml_parser p;
+    siml_event ev;
+    size_t len = u->to_entry ? avail : u->len;
+    long entry_line = u->lines + 1;
+
+    if (u->start == SIML_RESUME_ENTRY) {
+        siml_parser_init_buffer_entry(&p, data, len);
+    } else if (u->start == SIML_RESUME_SEPARATOR) {
+        siml_parser_init_buffer_resume(&p, data, len);
+    } else {
+        siml_parser_init_buffer(&p, data, len);
+    }
+    p.validate_utf8 = s->validate_utf8;
+    u->error_code = SIML_ERR_NONE;
+    u->error_line = 0;
+    u->error_message = 0;
+    s->parsed_bytes += u->len;
+    s->parsed_units += 1;
+
+    for (;;) {
+        siml_event_type t = siml_next(&p, &ev);
+        size_t n;
+
+        if (u->to_entry &&
+            (ev.line > entry_line ||
+             (ev.line == entry_line && t != SIML_EVENT_MAPPING_END &&
+              t != SIML_EVENT_SEQUENCE_END &&
+              t != SIML_EVENT_BLOCK_SCALAR_END && t != SIML_EVENT_ERROR))) {
+            /* The entry's own events belong to the next unit. */
+            return 1;
+        }
+        if (t == SIML_EVENT_STREAM_END) return 1;
+        if (t != SIML_EVENT_ERROR) continue;
+        if (!last && !u->to_entry &&
+            ev.error_code == SIML_ERR_SEPARATOR_AFTER_DOC) {
+            /* The unit ends at its separator; the next unit goes on. */
+            return 1;
+        }
+        if (!ev.error_message) ev.error_message = "parse error";
+        n = strlen(ev.error_message);
+        u->error_message = (char *)malloc(n + 1);
+        if (!u->error_message) return 0;
+        memcpy(u->error_message, ev.error_message, n + 1);
+        u->error_code = ev.error_code;
+        u->error_line = ev.line;
+        return 1;
+    }
+}
+
+/* Cut and check data[from, len) into units appended to s, starting as
+ * start says. Old units [next, keep) of the table follow the edit, the
+ * first of them moved to offset at; cutting stops at the first cut at or
+ * past stop that lands on the start of one of them with the same kind.
+ * Returns the index of that old unit, keep if the stream ended first, or
+ * -1 when out of memory.
+ */
+static long siml_incremental_cut(siml_incremental *s, const char *data,
+                                 size_t len, size_t from,
+                                 siml_resume_kind start, size_t stop,
+                                 size_t next, size_t at, size_t keep) {
+    for (;;) {
+        siml_incremental_unit *u;
+        size_t end;
+        int entry;
+
+        if (s->count == s->cap) {
+            size_t cap = s->cap ? s->cap * 2 : 64;
+            siml_incremental_unit *units = (siml_incremental_unit *)realloc(
+                s->units, cap * sizeof(siml_incremental_unit));
+            if (!units) return -1;
+            s->units = units;
+            s->cap = cap;
+        }
+        end = siml_parallel_split(data, len, from + 1, &entry);
+        u = &s->units[s->count];
+        u->len = end - from;
+        u->lines = siml_parallel_count_lines(data + from, u->len);
+        u->start = (unsigned char)start;
+        u->to_entry = (unsigned char)entry;
+        if (!siml_incremental_check(s, u, data + from, len - from,
+                                    end == len)) {
+            return -1;
+        }
+        s->count += 1;
+        if (end == len) return (long)keep;
+        from = end;
+        start = entry ? SIML_RESUME_ENTRY : SIML_RESUME_SEPARATOR;
+        if (from < stop) continue;
+        while (next < keep && at < from) {
+            at += s->units[next].len;
+            next += 1;
+        }
+        if (next < keep && at == from && s->units[next].start == start) {
+            return (long)next;
+        }
+    }
+}
+
+/* Set the error of s from its first failing unit. */
+static void siml_incremental_result(siml_incremental *s) {
+    long base = 0;
+    size_t i;
+
+    s->error_code = SIML_ERR_NONE;
+    s->error_line = 0;
+    s->error_message = 0;
+    for (i = 0; i < s->count; ++i) {
+        const siml_incremental_unit *u = &s->units[i];
+        if (u->error_message) {
+            s->error_code = u->error_code;
+            s->error_line = base + u->error_line;
+            s->error_message = u->error_message;
+            return;
+        }
+        base += u->lines;
+    }
+}
+
+int siml_incremental_parse(siml_incremental *s, const char *data, size_t len) {
+    if (!s) return 0;
+    siml_incremental_free(s);
+    s->parsed_bytes = 0;
+    s->parsed_units = 0;
+    if (siml_incremental_cut(s, data, len, 0, SIML_RESUME_NONE, len, 0, 0,
+                             0) < 0) {
+        siml_incremental_free(s);
+        return 0;
+    }
+    s->len = len;
+    siml_incremental_result(s);
+    return 1;
+}
+
+/* Whether a unit that ends at from, before a top-level entry, reads data
+ * at offset or past it: it parses the entry's first line, and the line
+ * after that too when the entry line ends in CR, to tell a CRLF from a
+ * stray CR.
+ */
+static int siml_incremental_reads_to(const char *data, size_t from,
+                                     size_t offset) {
+    const char *lf;
+
+    if (from >= offset) return 1;
+    lf = (const char *)memchr(data + from, '\n', offset - from);
+    if (!lf) return 1;
+    if (lf == data + from || lf[-1] != '\r') return 0;
+    from = (size_t)(lf - data) + 1;
+    return from >= offset || !memchr(data + from, '\n', offset - from);
+}
+
+/* Reverse units [lo, hi) in place. */
+static void siml_incremental_reverse(siml_incremental_unit *u, size_t lo,
+                                     size_t hi) {
+    while (lo + 1 < hi) {
+        siml_incremental_unit t = u[lo];
+        u[lo] = u[hi - 1];
+        u[hi - 1] = t;
+        lo += 1;
+        hi -= 1;
+    }
+}
+
+int siml_incremental_edit(siml_incremental *s, const char *data, size_t len,
+                          size_t offset, size_t old_len, size_t new_len) {
+    size_t first;
+    size_t from = 0;
+    size_t next;
+    size_t at;
+    size_t keep;
+    size_t reuse;
+    size_t added;
+    long r;
+
+    if (!s) return 0;
+    if (s->count == 0 || offset > s->len || old_len > s->len - offset ||
+        len != s->len - old_len + new_len) {
+        siml_incremental_free(s);
+        return 0;
+    }
+    s->parsed_bytes = 0;
+    s->parsed_units = 0;
+
+    /* The unit holding the edit, then back one: the unit before a top-level
+     * entry reads that entry's first line. Further back while a unit's
+     * look-ahead past that line reaches the edit.
+     */
+    for (first = 0; first + 1 < s->count; ++first) {
+        if (from + s->units[first].len > offset) break;
+        from += s->units[first].len;
+    }
+    if (first > 0) {
+        first -= 1;
+        from -= s->units[first].len;
+    }
+    while (first > 0 && s->units[first - 1].to_entry &&
+           siml_incremental_reads_to(data, from, offset)) {
+        first -= 1;
+        from -= s->units[first].len;
+    }
+
+    /* The first old unit that starts past the edit, at its new offset */
+    next = first + 1;
+    at = from + s->units[first].len;
+    while (next < s->count && at < offset + old_len) {
+        at += s->units[next].len;
+        next += 1;
+    }
+    at = at - old_len + new_len;
+
+    /* New units go to the end of the table; old units [first, r) are
+     * replaced by them.
+     */
+    keep = s->count;
+    r = siml_incremental_cut(s, data, len, from,
+                             (siml_resume_kind)s->units[first].start,
+                             offset + new_len, next, at, keep);
+    if (r < 0) {
+        siml_incremental_free(s);
+        return 0;
+    }
+    added = s->count - keep;
+    reuse = (size_t)r;
+    siml_incremental_drop(s->units + first, reuse - first);
+    siml_incremental_reverse(s->units, reuse, keep);
+    siml_incremental_reverse(s->units, keep, s->count);
+    siml_incremental_reverse(s->units, reuse, s->count);
+    memmove(s->units + first, s->units + reuse,
+            (s->count - reuse) * sizeof(siml_incremental_unit));
+    s->count = first + (keep - reuse) + added;
+    s->len = len;
+    siml_incremental_result(s);
+    return 1;
+}
+
+#endif /* SIML_IMPLEMENTATION */
+
+#endif /* SIML_INCREMENTAL_H_INCLUDED */
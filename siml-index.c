@@ -0,0 +1,198 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIML_IMPLEMENTATION
+#include "siml.h"
+#include "siml-io.h"
+#include "siml-columns.h"
+#include "siml-index.h"
+#include "siml-cache.h"
+
+/* Writes <file.siml>.idx, the document index of a stream, and reads single
+ * documents through it: by number, or by the value of an indexed key. A
+ * document read this way is parsed on its own, with the line numbers of the
+ * whole stream; its text is printed as it appears in the stream. The index
+ * is stamped with a hash of the stream, so any change to it, even within
+ * the resolution of its modification time, makes the index out of date.
+ */
+
+static int build(const char *filename, const char *path, int skip,
+                 const char *const *keys, int count) {
+    siml_mmap_reader reader;
+    siml_doc_index x;
+    unsigned char stamp[16];
+    char *image;
+    size_t image_len = 0;
+    FILE *f;
+    int rc = 1;
+
+    if (!siml_mmap_reader_open(&reader, filename)) {
+        perror(filename);
+        return 1;
+    }
+    siml_doc_index_init(&x);
+    x.validate_utf8 = 1;
+    if (skip) x.skip_mode = SIML_SKIP_INDENT;
+    siml_cache_hash(reader.mem.data, reader.mem.len, stamp);
+    image = siml_doc_index_build(&x, reader.mem.data, reader.mem.len, keys,
+                                 count, stamp, &image_len);
+    if (!image) {
+        (void)fprintf(stderr, "SIML error at line %ld: %s\n", x.error_line,
+                      x.error_message ? x.error_message : "cannot index");
+    } else if (!(f = fopen(path, "wb"))) {
+        perror(path);
+    } else {
+        if (fwrite(image, 1, image_len, f) == image_len) rc = 0;
+        if (fclose(f) != 0) rc = 1;
+        if (rc != 0) perror(path);
+    }
+    free(image);
+    siml_mmap_reader_close(&reader);
+    return rc;
+}
+
+/* Parse document doc on its own and print its text. */
+static int show(const siml_doc_index *x, const char *data, size_t len,
+                unsigned long doc) {
+    siml_parser p;
+    siml_event ev;
+    size_t offset;
+    size_t end;
+    long line;
+    long next_line;
+
+    if (!siml_doc_index_document(x, doc, &offset, &line)) {
+        (void)fprintf(stderr, "no document %lu\n", doc);
+        return 1;
+    }
+    siml_parser_init_buffer_at(&p, data + offset, len - offset, line);
+    p.validate_utf8 = 1;
+    for (;;) {
+        siml_event_type t = siml_next(&p, &ev);
+        if (t == SIML_EVENT_ERROR) {
+            (void)fprintf(stderr, "SIML error at line %ld: %s\n", ev.line,
+                          ev.error_message ? ev.error_message : "parse error");
+            return 1;
+        }
+        if (t == SIML_EVENT_DOCUMENT_END || t == SIML_EVENT_STREAM_END) break;
+    }
+    /* The text runs to the next document's separator line. */
+    end = len;
+    if (siml_doc_index_document(x, doc + 1, &end, &next_line)) end -= 4;
+    if (end > offset && fwrite(data + offset, 1, end - offset, stdout) !=
+                            end - offset) {
+        perror("stdout");
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *keys[SIML_MAX_SUBSCRIPTIONS];
+    int count = 0;
+    int skip = 0;
+    const char *doc_arg = NULL;
+    const char *find = NULL;
+    const char *filename = NULL;
+    char *path;
+    siml_mmap_reader reader;
+    siml_mmap_reader index_map;
+    siml_doc_index x;
+    unsigned char stamp[16];
+    unsigned long doc = 0;
+    int argi;
+    int rc;
+
+    for (argi = 1; argi < argc; ++argi) {
+        if (strcmp(argv[argi], "-k") == 0 && argi + 1 < argc &&
+            count < SIML_MAX_SUBSCRIPTIONS) {
+            keys[count++] = argv[++argi];
+        } else if (strcmp(argv[argi], "-s") == 0) {
+            skip = 1;
+        } else if (strcmp(argv[argi], "-n") == 0 && argi + 1 < argc) {
+            doc_arg = argv[++argi];
+        } else if (strcmp(argv[argi], "-f") == 0 && argi + 1 < argc &&
+                   strchr(argv[argi + 1], '=')) {
+            find = argv[++argi];
+        } else if (argi + 1 == argc && argv[argi][0] != '-') {
+            filename = argv[argi];
+        } else {
+            break;
+        }
+    }
+    if (!filename || (doc_arg && find) ||
+        ((doc_arg || find) && (count > 0 || skip))) {
+        (void)fprintf(stderr,
+                      "Usage: %s [-s] [-k path]... <file.siml>\n"
+                      "       %s -n doc | -f path=value <file.siml>\n"
+                      "  -k records the values at path in <file.siml>.idx\n"
+                      "  -s skips what is not recorded without checking it\n"
+                      "  -n prints document doc, counting from 0\n"
+                      "  -f prints the first document with path: value\n",
+                      argv[0], argv[0]);
+        return 1;
+    }
+    path = (char *)malloc(strlen(filename) + 5);
+    if (!path) {
+        perror(filename);
+        return 1;
+    }
+    (void)sprintf(path, "%s.idx", filename);
+    if (!doc_arg && !find) {
+        rc = build(filename, path, skip, keys, count);
+        free(path);
+        return rc;
+    }
+
+    if (!siml_mmap_reader_open(&reader, filename)) {
+        perror(filename);
+        free(path);
+        return 1;
+    }
+    if (!siml_mmap_reader_open(&index_map, path)) {
+        perror(path);
+        siml_mmap_reader_close(&reader);
+        free(path);
+        return 1;
+    }
+    rc = 1;
+    siml_doc_index_init(&x);
+    siml_cache_hash(reader.mem.data, reader.mem.len, stamp);
+    if (!siml_doc_index_load(&x, index_map.mem.data, index_map.mem.len)) {
+        (void)fprintf(stderr, "%s: %s\n", path, x.error_message);
+    } else if (x.source_len != reader.mem.len ||
+               memcmp(x.stamp, stamp, 16) != 0) {
+        (void)fprintf(stderr, "%s: out of date, index %s again\n", path,
+                      filename);
+    } else if (doc_arg) {
+        doc = strtoul(doc_arg, NULL, 10);
+        rc = show(&x, reader.mem.data, reader.mem.len, doc);
+    } else {
+        const char *eq = strchr(find, '=');
+        char key[256];
+        size_t n = (size_t)(eq - find);
+        int k = -1;
+
+        if (n < sizeof(key)) {
+            memcpy(key, find, n);
+            key[n] = '\0';
+            k = siml_doc_index_key(&x, key);
+        }
+        if (k < 0) {
+            (void)fprintf(stderr, "%s: %.*s is not indexed\n", path, (int)n,
+                          find);
+        } else if (!siml_doc_index_find(&x, k, eq + 1, strlen(eq + 1), 0,
+                                        &doc)) {
+            (void)fprintf(stderr, "%s: no document with %s\n", path, find);
+        } else {
+            rc = show(&x, reader.mem.data, reader.mem.len, doc);
+        }
+    }
+    siml_mmap_reader_close(&index_map);
+    siml_mmap_reader_close(&reader);
+    free(path);
+    return rc;
+}
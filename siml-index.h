@@ -0,0 +1,499 @@
+#ifndef SIML_INDEX_H_INCLUDED
+#define SIML_INDEX_H_INCLUDED
+
+/*
+ * SIML document index v0.1
+ *
+ * Companion to siml-columns.h. Records where each document of a stream
+ * starts, and the values of a few key paths in it, in an image kept next to
+ * the stream (a sidecar file). With the image, document n or the document
+ * whose id is some value is found without reading the stream, and
+ * siml_parser_init_buffer_at() parses just that document with the line
+ * numbers of the whole stream.
+ *
+ *   magic "SIMLIDX2", documents, keys, source length (two words), stamp
+ *   (16 bytes), pool length
+ *   per key: name offset and length, documents with a value
+ *   per document: offset (two words), line, then per key the value offset
+ *                 and length (offset 0xFFFFFFFF: no value)
+ *   per key: (value hash, document) pairs in hash order
+ *   pool
+ *
+ * All numbers are 32-bit little-endian words. The image is used where it is
+ * mapped: loading checks its size, and each access checks what it reads.
+ *
+ * The stamp is 16 bytes of the caller's; with the source length it tells
+ * whether the index still describes the stream. A hash of the stream
+ * (siml_cache_hash() of siml-cache.h) also catches an edit that keeps the
+ * length within one tick of the modification time.
+ *
+ * Define SIML_IMPLEMENTATION in exactly one translation unit, as for siml.h.
+ */
+
+#include "siml.h"
+#include "siml-columns.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h> /* size_t */
+
+typedef struct siml_doc_index_s {
+    /* Options; set before siml_doc_index_build() */
+    int                  validate_utf8;  /* boolean, default SIML_VALIDATE_UTF8 */
+    siml_skip_mode       skip_mode;      /* for unindexed nodes, default VALIDATE */
+
+    /* The loaded image */
+    const unsigned char *image;
+    size_t               len;
+    unsigned long        count;          /* documents */
+    int                  key_count;
+    size_t               source_len;
+    unsigned char        stamp[16];
+
+    /* Set when siml_doc_index_build() or siml_doc_index_load() fails */
+    long                 error_line;
+    const char          *error_message;
+    char                 error_buf[160];
+} siml_doc_index;
+
+/* Initialize x with default options and no image. */
+void siml_doc_index_init(siml_doc_index *x);
+
+/* Index the stream of len bytes at data, recording the values at paths
+ * (keys joined by '.' below each document root, [key] for a key that
+ * contains '.', at most SIML_MAX_SUBSCRIPTIONS). Returns a new image of
+ * *image_len bytes, which the caller frees, or NULL on a parse error or no
+ * memory. With skip_mode other than SIML_SKIP_VALIDATE, nodes outside the
+ * paths are skipped without being checked, so errors in them show only
+ * when their document is parsed.
+ */
+char *siml_doc_index_build(siml_doc_index *x, const char *data, size_t len,
+                           const char *const *paths, int count,
+                           const unsigned char stamp[16], size_t *image_len);
+
+/* Use the image of len bytes, which must outlive x. Returns 1, or 0 if it
+ * is not an index image.
+ */
+int siml_doc_index_load(siml_doc_index *x, const char *image, size_t len);
+
+/* Start of document doc (from 0): its byte offset in the stream and its
+ * first line, as siml_parser_init_buffer_at() takes them. Returns 0 if
+ * there is no such document.
+ */
+int siml_doc_index_document(const siml_doc_index *x, unsigned long doc,
+                            size_t *offset, long *line);
+
+/* Number of the key recorded for path, or -1. */
+int siml_doc_index_key(const siml_doc_index *x, const char *path);
+
+/* Value of key in document doc; ptr is NULL when it has none. */
+siml_slice siml_doc_index_value(const siml_doc_index *x, unsigned long doc,
+                                int key);
+
+/* First document, after skipping skip of them, whose key has value
+ * (len bytes). Returns 1 and sets *doc, or 0 if there is none.
+ */
+int siml_doc_index_find(const siml_doc_index *x, int key, const char *value,
+                        size_t len, unsigned long skip, unsigned long *doc);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* ---------------- Implementation ---------------- */
+#ifdef SIML_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SIML_DOC_INDEX_HEADER 44
+#define SIML_DOC_INDEX_NONE   0xFFFFFFFFul
+
+static const char siml_doc_index_magic[8] = {
+    'S', 'I', 'M', 'L', 'I', 'D', 'X', '2'
+};
+
+/* (hash, document) pair of the lookup tables, while building */
+typedef struct siml_doc_index_pair_s {
+    unsigned long hash;
+    unsigned long doc;
+} siml_doc_index_pair;
+
+static int siml_doc_index_pair_cmp(const void *a, const void *b) {
+    const siml_doc_index_pair *x = (const siml_doc_index_pair *)a;
+    const siml_doc_index_pair *y = (const siml_doc_index_pair *)b;
+
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    if (x->doc != y->doc) return x->doc < y->doc ? -1 : 1;
+    return 0;
+}
+
+static void *siml_doc_index_fail(siml_doc_index *x, long line,
+                                 const char *msg) {
+    size_t n = strlen(msg);
+
+    if (n >= sizeof(x->error_buf)) n = sizeof(x->error_buf) - 1;
+    memcpy(x->error_buf, msg, n);
+    x->error_buf[n] = '\0';
+    x->error_line = line;
+    x->error_message = x->error_buf;
+    return 0;
+}
+
+void siml_doc_index_init(siml_doc_index *x) {
+    if (!x) return;
+    memset(x, 0, sizeof(*x));
+    x->validate_utf8 = SIML_VALIDATE_UTF8;
+    x->skip_mode = SIML_SKIP_VALIDATE;
+}
+
+/* Count the documents of p's stream, skipping their roots in x's mode. */
+static long siml_doc_index_count(siml_doc_index *x, siml_parser *p) {
+    siml_event ev;
+    long docs = 0;
+    int at_root = 0;
+
+    for (;;) {
+        siml_event_type t = siml_next(p, &ev);
+
+        if (t == SIML_EVENT_DOCUMENT_START) {
+            docs += 1;
+            at_root = 1;
+            continue;
+        }
+        if (at_root && x->skip_mode != SIML_SKIP_VALIDATE &&
+            (t == SIML_EVENT_MAPPING_START || t == SIML_EVENT_SEQUENCE_START)) {
+            t = siml_skip(p, &ev, x->skip_mode);
+        }
+        if (t == SIML_EVENT_ERROR) {
+            (void)siml_doc_index_fail(x, ev.line, ev.error_message);
+            return -1;
+        }
+        if (t == SIML_EVENT_STREAM_END) return docs;
+        if (t != SIML_EVENT_COMMENT) at_root = 0;
+    }
+}
+
+char *siml_doc_index_build(siml_doc_index *x, const char *data, size_t len,
+                           const char *const *paths, int count,
+                           const unsigned char stamp[16], size_t *image_len) {
+    siml_parser p;
+    siml_columns cols;
+    siml_doc_index_pair *pairs = 0;
+    unsigned char *image = 0;
+    unsigned char *out;
+    char *pool;
+    size_t pool_len = 0;
+    size_t doc_size;
+    size_t size;
+    size_t at;
+    unsigned long docs;
+    unsigned long doc;
+    long line;
+    int i;
+
+    if (!x || !image_len || !stamp || count < 0 ||
+        count > SIML_MAX_SUBSCRIPTIONS || (count > 0 && !paths)) {
+        return 0;
+    }
+    x->error_line = 0;
+    x->error_message = 0;
+    siml_parser_init_buffer(&p, data, len);
+    p.validate_utf8 = x->validate_utf8;
+    if (count == 0) {
+        long n = siml_doc_index_count(x, &p);
+        if (n < 0) return 0;
+        docs = (unsigned long)n;
+        memset(&cols, 0, sizeof(cols));
+    } else {
+        siml_columns_result r;
+
+        if (!siml_columns_init(&cols, paths, count)) {
+            return siml_doc_index_fail(x, 0, "bad index path");
+        }
+        cols.skip_mode = x->skip_mode;
+        r = siml_columns_extract(&cols, &p);
+        if (r != SIML_COLUMNS_DONE) {
+            (void)siml_doc_index_fail(x, cols.error_line, cols.error_message);
+            siml_columns_free(&cols);
+            return 0;
+        }
+        docs = (unsigned long)cols.rows;
+        for (i = 0; i < count; ++i) {
+            pool_len += strlen(paths[i]) + cols.cols[i].bytes_len;
+        }
+    }
+
+    doc_size = 12 + 8 * (size_t)count;
+    if (docs > (0xFFFFFFFFul - SIML_DOC_INDEX_HEADER) /
+                   (doc_size + 8 * (size_t)count + 8) ||
+        pool_len >= SIML_DOC_INDEX_NONE) {
+        siml_columns_free(&cols);
+        return siml_doc_index_fail(x, 0, "index too large");
+    }
+    size = SIML_DOC_INDEX_HEADER + 12 * (size_t)count + docs * doc_size +
+           docs * 8 * (size_t)count + pool_len;
+    image = (unsigned char *)malloc(size);
+    if (count > 0) {
+        pairs = (siml_doc_index_pair *)malloc(
+            (docs ? docs : 1) * sizeof(siml_doc_index_pair));
+    }
+    if (!image || (count > 0 && !pairs)) {
+        free(image);
+        free(pairs);
+        siml_columns_free(&cols);
+        return siml_doc_index_fail(x, 0, "out of memory");
+    }
+
+    memcpy(image, siml_doc_index_magic, sizeof(siml_doc_index_magic));
+    siml_put32(image + 8, docs);
+    siml_put32(image + 12, (unsigned long)count);
+    siml_put32(image + 16, (unsigned long)(len & 0xFFFFFFFFul));
+    siml_put32(image + 20, (unsigned long)(len >> 16 >> 16));
+    memcpy(image + 24, stamp, 16);
+    siml_put32(image + 40, (unsigned long)pool_len);
+    pool = (char *)image + size - pool_len;
+    pool_len = 0;
+
+    /* Keys; their value counts are filled in with the lookup tables. */
+    out = image + SIML_DOC_INDEX_HEADER;
+    for (i = 0; i < count; ++i, out += 12) {
+        size_t n = strlen(paths[i]);
+        memcpy(pool + pool_len, paths[i], n);
+        siml_put32(out, (unsigned long)pool_len);
+        siml_put32(out + 4, (unsigned long)n);
+        pool_len += n;
+    }
+
+    /* Documents: the first starts the stream, each other follows a "---"
+     * line. The parse above has checked the stream, so every such line is
+     * a separator.
+     */
+    at = 0;
+    line = 1;
+    for (doc = 0; doc < docs; ++doc, out += doc_size) {
+        if (doc > 0) {
+            for (;;) {
+                const char *nl = (const char *)memchr(data + at, '\n',
+                                                      len - at);
+                size_t next = nl ? (size_t)(nl - data) + 1 : len;
+                int sep = (next - at == 4 && memcmp(data + at, "---", 3) == 0);
+
+                line += 1;
+                at = next;
+                if (sep || at == len) break;
+            }
+        }
+        siml_put32(out, (unsigned long)(at & 0xFFFFFFFFul));
+        siml_put32(out + 4, (unsigned long)(at >> 16 >> 16));
+        siml_put32(out + 8, (unsigned long)line);
+        for (i = 0; i < count; ++i) {
+            const siml_column *col = &cols.cols[i];
+            unsigned char *v = out + 12 + 8 * (size_t)i;
+
+            if (col->cells[doc] & SIML_CELL_PRESENT) {
+                siml_slice s = siml_column_value(col, (size_t)doc);
+                if (s.len > 0) memcpy(pool + pool_len, s.ptr, s.len);
+                siml_put32(v, (unsigned long)pool_len);
+                siml_put32(v + 4, (unsigned long)s.len);
+                pool_len += s.len;
+            } else {
+                siml_put32(v, SIML_DOC_INDEX_NONE);
+                siml_put32(v + 4, 0);
+            }
+        }
+    }
+
+    /* Lookup tables */
+    for (i = 0; i < count; ++i) {
+        const siml_column *col = &cols.cols[i];
+        unsigned long n = 0;
+        unsigned long k;
+
+        for (doc = 0; doc < docs; ++doc) {
+            if (col->cells[doc] & SIML_CELL_PRESENT) {
+                siml_slice s = siml_column_value(col, (size_t)doc);
+                pairs[n].hash = siml_fnv1a(s.ptr, s.len);
+                pairs[n].doc = doc;
+                n += 1;
+            }
+        }
+        qsort(pairs, (size_t)n, sizeof(*pairs), siml_doc_index_pair_cmp);
+        siml_put32(image + SIML_DOC_INDEX_HEADER + 12 * (size_t)i + 8, n);
+        for (k = 0; k < n; ++k, out += 8) {
+            siml_put32(out, pairs[k].hash);
+            siml_put32(out + 4, pairs[k].doc);
+        }
+        memset(out, 0, (size_t)(docs - n) * 8);
+        out += (docs - n) * 8;
+    }
+
+    free(pairs);
+    siml_columns_free(&cols);
+    *image_len = size;
+    return (char *)image;
+}
+
+int siml_doc_index_load(siml_doc_index *x, const char *image, size_t len) {
+    const unsigned char *in = (const unsigned char *)image;
+    unsigned long docs;
+    unsigned long keys;
+    unsigned long pool;
+    size_t need;
+
+    if (!x) return 0;
+    x->image = 0;
+    x->len = 0;
+    x->count = 0;
+    x->key_count = 0;
+    if (!image || len < SIML_DOC_INDEX_HEADER ||
+        memcmp(image, siml_doc_index_magic,
+               sizeof(siml_doc_index_magic)) != 0) {
+        (void)siml_doc_index_fail(x, 0, "not a document index");
+        return 0;
+    }
+    docs = siml_get32(in + 8);
+    keys = siml_get32(in + 12);
+    pool = siml_get32(in + 40);
+    if (keys > SIML_MAX_SUBSCRIPTIONS ||
+        docs > (len - SIML_DOC_INDEX_HEADER) / (12 + 16 * keys)) {
+        (void)siml_doc_index_fail(x, 0, "damaged document index");
+        return 0;
+    }
+    need = SIML_DOC_INDEX_HEADER + 12 * keys + docs * (12 + 16 * keys);
+    if (need > len || len - need != pool) {
+        (void)siml_doc_index_fail(x, 0, "damaged document index");
+        return 0;
+    }
+    x->image = in;
+    x->len = len;
+    x->count = docs;
+    x->key_count = (int)keys;
+    x->source_len = (size_t)siml_get32(in + 16);
+    if (sizeof(size_t) > 4) {
+        x->source_len |= (size_t)siml_get32(in + 20) << 16 << 16;
+    }
+    memcpy(x->stamp, in + 24, 16);
+    return 1;
+}
+
+/* Pool of a loaded image: its offset and length. */
+static size_t siml_doc_index_pool(const siml_doc_index *x, size_t *pool_len) {
+    *pool_len = (size_t)siml_get32(x->image + 40);
+    return x->len - *pool_len;
+}
+
+/* Slice of the pool at the (offset, length) words at in; ptr is NULL when
+ * the offset is 0xFFFFFFFF or out of range.
+ */
+static siml_slice siml_doc_index_slice(const siml_doc_index *x,
+                                       const unsigned char *in) {
+    siml_slice s;
+    size_t pool_len;
+    size_t pool = siml_doc_index_pool(x, &pool_len);
+    unsigned long at = siml_get32(in);
+    unsigned long n = siml_get32(in + 4);
+
+    s.ptr = 0;
+    s.len = 0;
+    if (at != SIML_DOC_INDEX_NONE && at <= pool_len && n <= pool_len - at) {
+        s.ptr = (const char *)x->image + pool + at;
+        s.len = (size_t)n;
+    }
+    return s;
+}
+
+static const unsigned char *siml_doc_index_entry(const siml_doc_index *x,
+                                                 unsigned long doc) {
+    return x->image + SIML_DOC_INDEX_HEADER + 12 * (size_t)x->key_count +
+           doc * (12 + 8 * (size_t)x->key_count);
+}
+
+int siml_doc_index_document(const siml_doc_index *x, unsigned long doc,
+                            size_t *offset, long *line) {
+    const unsigned char *in;
+    size_t at;
+
+    if (!x || !x->image || doc >= x->count) return 0;
+    in = siml_doc_index_entry(x, doc);
+    at = (size_t)siml_get32(in);
+    if (sizeof(size_t) > 4) {
+        at |= (size_t)siml_get32(in + 4) << 16 << 16;
+    }
+    if (at > x->source_len) return 0;
+    *offset = at;
+    *line = (long)siml_get32(in + 8);
+    return 1;
+}
+
+int siml_doc_index_key(const siml_doc_index *x, const char *path) {
+    int i;
+
+    if (!x || !x->image || !path) return -1;
+    for (i = 0; i < x->key_count; ++i) {
+        siml_slice s = siml_doc_index_slice(
+            x, x->image + SIML_DOC_INDEX_HEADER + 12 * (size_t)i);
+        if (s.ptr && s.len == strlen(path) && memcmp(s.ptr, path, s.len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+siml_slice siml_doc_index_value(const siml_doc_index *x, unsigned long doc,
+                                int key) {
+    siml_slice s;
+
+    if (!x || !x->image || doc >= x->count || key < 0 ||
+        key >= x->key_count) {
+        s.ptr = 0;
+        s.len = 0;
+        return s;
+    }
+    return siml_doc_index_slice(
+        x, siml_doc_index_entry(x, doc) + 12 + 8 * (size_t)key);
+}
+
+int siml_doc_index_find(const siml_doc_index *x, int key, const char *value,
+                        size_t len, unsigned long skip, unsigned long *doc) {
+    const unsigned char *table;
+    unsigned long hash;
+    unsigned long lo = 0;
+    unsigned long hi;
+    unsigned long k;
+
+    if (!x || !x->image || key < 0 || key >= x->key_count || !doc) return 0;
+    table = siml_doc_index_entry(x, x->count) + 8 * x->count * (size_t)key;
+    hi = siml_get32(x->image + SIML_DOC_INDEX_HEADER +
+                    12 * (size_t)key + 8);
+    if (hi > x->count) return 0;
+    hash = siml_fnv1a(value, len);
+    /* First pair with this hash */
+    for (k = hi; lo < k;) {
+        unsigned long mid = lo + (k - lo) / 2;
+        if (siml_get32(table + 8 * mid) < hash) {
+            lo = mid + 1;
+        } else {
+            k = mid;
+        }
+    }
+    for (; lo < hi && siml_get32(table + 8 * lo) == hash; ++lo) {
+        unsigned long d = siml_get32(table + 8 * lo + 4);
+        siml_slice s = siml_doc_index_value(x, d, key);
+
+        if (s.ptr && s.len == len && memcmp(s.ptr, value, len) == 0) {
+            if (skip == 0) {
+                *doc = d;
+                return 1;
+            }
+            skip -= 1;
+        }
+    }
+    return 0;
+}
+
+#endif /* SIML_IMPLEMENTATION */
+
+#endif /* SIML_INDEX_H_INCLUDED */
@@ -0,0 +1,673 @@
+#ifndef SIML_IO_H_INCLUDED
+#define SIML_IO_H_INCLUDED
+
+/*
+ * SIML input readers v0.1
+ *
+ * Companion to siml.h. siml.h itself stays free of I/O; this header provides
+ * ready-made siml_read_line_fn implementations on top of POSIX file APIs.
+ *
+ * - siml_mmap_reader: maps a regular file and hands out lines that point
+ *   straight into the mapping (no per-line copy).
+ * - siml_fd_reader: reads pipes, sockets and stdin in large read(2) chunks
+ *   and hands out lines that point into the chunk.
+ * - siml_prefetch_reader: like siml_fd_reader, but a background thread reads
+ *   the next chunk while the parser consumes the current one.
+ * - siml_tape_save(): records the event tape of a buffer parser to a file,
+ *   which siml_tape_reader can later replay over a mapping of the source.
+ * - siml_fd_write(): a siml_write_fn for siml_emitter that hands each batch
+ *   of pieces to one writev(2).
+ *
+ * Define SIML_IMPLEMENTATION in exactly one translation unit, as for siml.h.
+ * The including file must request POSIX/BSD declarations (e.g. by defining
+ * _DEFAULT_SOURCE) before including any system header, and link with the
+ * platform's threads library.
+ */
+
+#include "siml.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h> /* size_t */
+#include <pthread.h>
+
+/* read(2) chunk sizes. Requested sizes are clamped to MIN..MAX. */
+#ifndef SIML_IO_CHUNK_SIZE
+#define SIML_IO_CHUNK_SIZE 262144
+#endif
+
+#ifndef SIML_IO_CHUNK_MIN
+#define SIML_IO_CHUNK_MIN 65536
+#endif
+
+#ifndef SIML_IO_CHUNK_MAX
+#define SIML_IO_CHUNK_MAX 1048576
+#endif
+
+/* Memory-mapped file reader.
+ *
+ * Lines returned by siml_mmap_read_line() point into the mapping and stay
+ * valid until siml_mmap_reader_close(), which is longer than the
+ * siml_read_line_fn contract requires. mem.data/mem.len expose the whole file.
+ */
+typedef struct siml_mmap_reader_s {
+    siml_mem_reader mem;
+    void           *map;      /* NULL for empty files */
+    size_t          map_len;
+} siml_mmap_reader;
+
+/* Map the regular file at path. Returns 1 on success, 0 on failure with errno
+ * set. Fails for files that cannot be mapped (pipes, terminals, ...).
+ */
+int siml_mmap_reader_open(siml_mmap_reader *r, const char *path);
+
+/* Unmap the file. Safe to call on a reader whose open failed. */
+void siml_mmap_reader_close(siml_mmap_reader *r);
+
+/* siml_read_line_fn over a siml_mmap_reader. */
+int siml_mmap_read_line(void *userdata, const char **out_line, size_t *out_len);
+
+/* Chunked read(2) reader.
+ *
+ * Lines point into the current chunk. Only a line that straddles two chunks
+ * is moved (to the front of the buffer) before the next read. A line longer
+ * than SIML_MAX_LINE_LEN is returned as soon as SIML_MAX_LINE_LEN + 1 bytes
+ * of it are in, so the parser reports it as too long without waiting for
+ * the rest; only a further call reads past that rest, without keeping it.
+ */
+typedef struct siml_fd_reader_s {
+    int     fd;
+    char   *buf;
+    size_t  cap;
+    size_t  start;     /* first unconsumed byte */
+    size_t  end;       /* end of valid data */
+    int     eof;       /* boolean */
+    int     skipping;  /* boolean: buf[start..end) is inside a line too long */
+    int     failed;    /* boolean */
+} siml_fd_reader;
+
+/* Set up a reader on fd with the given chunk size (0 selects
+ * SIML_IO_CHUNK_SIZE). Returns 1 on success, 0 if the buffer cannot be
+ * allocated. The reader does not own fd. The chunk is never smaller than
+ * SIML_MAX_LINE_LEN + 2 bytes.
+ */
+int siml_fd_reader_init(siml_fd_reader *r, int fd, size_t chunk_size);
+
+/* Release the chunk buffer. */
+void siml_fd_reader_free(siml_fd_reader *r);
+
+/* siml_read_line_fn over a siml_fd_reader. */
+int siml_fd_read_line(void *userdata, const char **out_line, size_t *out_len);
+
+/* Double-buffered background reader.
+ *
+ * A reader thread fills one chunk with read(2) while the parser consumes the
+ * other, so I/O and parsing overlap. Each chunk goes to the parser with
+ * what one read(2) returned, so a slow pipe is not waited on to fill it.
+ * A chunk is handed back to the thread
+ * only once the parser has asked for the line after its last one, which
+ * keeps returned lines valid until the next callback invocation. A line that
+ * spans two chunks is assembled in a private line buffer. Overlong lines are
+ * cut off as with siml_fd_reader.
+ */
+typedef struct siml_prefetch_reader_s {
+    int             fd;
+    size_t          cap;
+    char           *chunk[2];
+    size_t          chunk_len[2];
+    int             chunk_full[2];  /* boolean: owned by the parser side */
+    int             chunk_last[2];  /* boolean: EOF or error after this chunk */
+    int             read_error;     /* boolean */
+    int             cur;            /* chunk being consumed, -1 for none */
+    int             next;           /* chunk to consume after cur */
+    size_t          pos;
+    char           *line;           /* SIML_MAX_LINE_LEN + 1 bytes */
+    size_t          line_len;
+    int             line_returned;  /* boolean: line buffer was handed out */
+    int             skipping;       /* boolean: pos is inside a line too long */
+    int             finished;       /* boolean */
+    int             failed;         /* boolean */
+    int             stop;           /* boolean */
+    int             started;        /* boolean */
+    pthread_t       thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+} siml_prefetch_reader;
+
+/* Start a reader thread on fd with the given chunk size (0 selects
+ * SIML_IO_CHUNK_SIZE). Returns 1 on success, 0 on allocation or thread
+ * creation failure. The reader does not own fd.
+ */
+int siml_prefetch_reader_init(siml_prefetch_reader *r, int fd, size_t chunk_size);
+
+/* Stop the reader thread and release all buffers. Waits for a read(2) that
+ * is in flight to return.
+ */
+void siml_prefetch_reader_free(siml_prefetch_reader *r);
+
+/* siml_read_line_fn over a siml_prefetch_reader. */
+int siml_prefetch_read_line(void *userdata, const char **out_line, size_t *out_len);
+
+/* Parse the rest of buffer parser p and write its event tape to path, which
+ * is replaced atomically. Returns 1 on success (also when the stream has an
+ * error, which is recorded), 0 on failure with errno set.
+ */
+int siml_tape_save(siml_parser *p, const char *path);
+
+/* siml_write_fn that writes to the file descriptor userdata points to (an
+ * int), with writev(2) calls that take all pieces at once where the system
+ * allows. Returns 0 on failure with errno set.
+ */
+int siml_fd_write(void *userdata, const siml_slice *pieces, int count);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+/* ---------------- Implementation ---------------- */
+#ifdef SIML_IMPLEMENTATION
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h> /* rename */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+int siml_mmap_reader_open(siml_mmap_reader *r, const char *path) {
+    struct stat st;
+    void *map;
+    int fd;
+
+    if (!r || !path) {
+        errno = EINVAL;
+        return 0;
+    }
+    siml_mem_reader_init(&r->mem, "", 0);
+    r->map = 0;
+    r->map_len = 0;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    if (fstat(fd, &st) != 0) {
+        (void)close(fd);
+        return 0;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        (void)close(fd);
+        errno = ENODEV;
+        return 0;
+    }
+    if (st.st_size == 0) {
+        (void)close(fd);
+        return 1;
+    }
+
+    map = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    (void)close(fd);
+    if (map == MAP_FAILED) return 0;
+#if defined(MADV_SEQUENTIAL)
+    (void)madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+#elif defined(POSIX_MADV_SEQUENTIAL)
+    (void)posix_madvise(map, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+#endif
+
+    r->map = map;
+    r->map_len = (size_t)st.st_size;
+    siml_mem_reader_init(&r->mem, (const char *)map, (size_t)st.st_size);
+    return 1;
+}
+
+void siml_mmap_reader_close(siml_mmap_reader *r) {
+    if (!r) return;
+    if (r->map) {
+        (void)munmap(r->map, r->map_len);
+    }
+    siml_mem_reader_init(&r->mem, "", 0);
+    r->map = 0;
+    r->map_len = 0;
+}
+
+int siml_mmap_read_line(void *userdata, const char **out_line, size_t *out_len) {
+    siml_mmap_reader *r = (siml_mmap_reader *)userdata;
+    if (!r) return -1;
+    return siml_mem_read_line(&r->mem, out_line, out_len);
+}
+
+static size_t siml_io_chunk_size(size_t chunk_size) {
+    if (chunk_size == 0) chunk_size = SIML_IO_CHUNK_SIZE;
+    if (chunk_size < SIML_IO_CHUNK_MIN) chunk_size = SIML_IO_CHUNK_MIN;
+    if (chunk_size > SIML_IO_CHUNK_MAX) chunk_size = SIML_IO_CHUNK_MAX;
+    return chunk_size;
+}
+
+int siml_fd_reader_init(siml_fd_reader *r, int fd, size_t chunk_size) {
+    if (!r) return 0;
+    chunk_size = siml_io_chunk_size(chunk_size);
+    if (chunk_size < SIML_MAX_LINE_LEN + 2) chunk_size = SIML_MAX_LINE_LEN + 2;
+    r->fd = fd;
+    r->cap = chunk_size;
+    r->start = 0;
+    r->end = 0;
+    r->eof = 0;
+    r->skipping = 0;
+    r->failed = 0;
+    r->buf = (char *)malloc(r->cap);
+    return r->buf != 0;
+}
+
+void siml_fd_reader_free(siml_fd_reader *r) {
+    if (!r) return;
+    free(r->buf);
+    r->buf = 0;
+    r->cap = 0;
+}
+
+/* Read past the rest of a line too long, up to and including its LF.
+ * Returns 1, or -1 on a read error.
+ */
+static int siml_fd_skip_line(siml_fd_reader *r) {
+    long n;
+
+    for (;;) {
+        const char *lf = siml_find_lf(r->buf + r->start, r->buf + r->end);
+        if (lf) {
+            r->start = (size_t)(lf - r->buf) + 1;
+            r->skipping = 0;
+            return 1;
+        }
+        r->start = 0;
+        r->end = 0;
+        if (r->eof) {
+            r->skipping = 0;
+            return 1;
+        }
+        do {
+            n = (long)read(r->fd, r->buf, r->cap);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) return -1;
+        if (n == 0) r->eof = 1;
+        r->end = (size_t)n;
+    }
+}
+
+int siml_fd_read_line(void *userdata, const char **out_line, size_t *out_len) {
+    siml_fd_reader *r;
+    const char *lf;
+    size_t scanned;
+    long n;
+
+    r = (siml_fd_reader *)userdata;
+    if (!r || !out_line || !out_len || !r->buf || r->failed) {
+        return -1;
+    }
+
+    if (r->skipping && siml_fd_skip_line(r) < 0) {
+        r->failed = 1;
+        return -1;
+    }
+    scanned = r->start;
+    for (;;) {
+        lf = siml_find_lf(r->buf + scanned, r->buf + r->end);
+        if (lf) {
+            *out_line = r->buf + r->start;
+            *out_len = (size_t)(lf - (r->buf + r->start));
+            r->start += *out_len + 1;
+            return 1;
+        }
+        if (r->end - r->start > SIML_MAX_LINE_LEN) {
+            *out_line = r->buf + r->start;
+            *out_len = SIML_MAX_LINE_LEN + 1;
+            r->start += SIML_MAX_LINE_LEN + 1;
+            r->skipping = 1;
+            return 1;
+        }
+        if (r->eof) {
+            if (r->start >= r->end) return 0;
+            *out_line = r->buf + r->start;
+            *out_len = r->end - r->start;
+            r->start = r->end;
+            return 2;
+        }
+
+        /* Move the partial line to the front and read the next chunk. */
+        if (r->start > 0) {
+            memmove(r->buf, r->buf + r->start, r->end - r->start);
+            r->end -= r->start;
+            r->start = 0;
+        }
+        scanned = r->end;
+        do {
+            n = (long)read(r->fd, r->buf + r->end, r->cap - r->end);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) {
+            r->failed = 1;
+            return -1;
+        }
+        if (n == 0) {
+            r->eof = 1;
+        }
+        r->end += (size_t)n;
+    }
+}
+
+/* Reader thread: fill chunks alternately until EOF, error or stop. */
+static void *siml_prefetch_thread(void *arg) {
+    siml_prefetch_reader *r = (siml_prefetch_reader *)arg;
+    int i = 0;
+
+    for (;;) {
+        size_t len = 0;
+        int last = 0;
+        int error = 0;
+        long n;
+
+        (void)pthread_mutex_lock(&r->mutex);
+        while (r->chunk_full[i] && !r->stop) {
+            (void)pthread_cond_wait(&r->cond, &r->mutex);
+        }
+        if (r->stop) {
+            (void)pthread_mutex_unlock(&r->mutex);
+            return 0;
+        }
+        (void)pthread_mutex_unlock(&r->mutex);
+
+        do {
+            n = (long)read(r->fd, r->chunk[i], r->cap);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) {
+            last = 1;
+            error = (n < 0);
+        } else {
+            len = (size_t)n;
+        }
+
+        (void)pthread_mutex_lock(&r->mutex);
+        r->chunk_len[i] = len;
+        r->chunk_last[i] = last;
+        r->chunk_full[i] = 1;
+        if (error) r->read_error = 1;
+        (void)pthread_cond_broadcast(&r->cond);
+        (void)pthread_mutex_unlock(&r->mutex);
+        if (last) return 0;
+        i ^= 1;
+    }
+}
+
+int siml_prefetch_reader_init(siml_prefetch_reader *r, int fd, size_t chunk_size) {
+    if (!r) return 0;
+    r->fd = fd;
+    r->cap = siml_io_chunk_size(chunk_size);
+    r->chunk[0] = (char *)malloc(r->cap);
+    r->chunk[1] = (char *)malloc(r->cap);
+    r->line = (char *)malloc(SIML_MAX_LINE_LEN + 1);
+    r->chunk_len[0] = r->chunk_len[1] = 0;
+    r->chunk_full[0] = r->chunk_full[1] = 0;
+    r->chunk_last[0] = r->chunk_last[1] = 0;
+    r->read_error = 0;
+    r->cur = -1;
+    r->next = 0;
+    r->pos = 0;
+    r->line_len = 0;
+    r->line_returned = 0;
+    r->skipping = 0;
+    r->finished = 0;
+    r->failed = 0;
+    r->stop = 0;
+    r->started = 0;
+    if (!r->chunk[0] || !r->chunk[1] || !r->line) {
+        siml_prefetch_reader_free(r);
+        return 0;
+    }
+    (void)pthread_mutex_init(&r->mutex, 0);
+    (void)pthread_cond_init(&r->cond, 0);
+    if (pthread_create(&r->thread, 0, siml_prefetch_thread, r) != 0) {
+        (void)pthread_cond_destroy(&r->cond);
+        (void)pthread_mutex_destroy(&r->mutex);
+        siml_prefetch_reader_free(r);
+        return 0;
+    }
+    r->started = 1;
+    return 1;
+}
+
+void siml_prefetch_reader_free(siml_prefetch_reader *r) {
+    if (!r) return;
+    if (r->started) {
+        (void)pthread_mutex_lock(&r->mutex);
+        r->stop = 1;
+        (void)pthread_cond_broadcast(&r->cond);
+        (void)pthread_mutex_unlock(&r->mutex);
+        (void)pthread_join(r->thread, 0);
+        (void)pthread_cond_destroy(&r->cond);
+        (void)pthread_mutex_destroy(&r->mutex);
+        r->started = 0;
+    }
+    free(r->chunk[0]);
+    free(r->chunk[1]);
+    free(r->line);
+    r->chunk[0] = r->chunk[1] = 0;
+    r->line = 0;
+}
+
+int siml_prefetch_read_line(void *userdata, const char **out_line, size_t *out_len) {
+    siml_prefetch_reader *r;
+
+    r = (siml_prefetch_reader *)userdata;
+    if (!r || !out_line || !out_len || !r->started || r->failed) {
+        return -1;
+    }
+    if (r->line_returned) {
+        r->line_len = 0;
+        r->line_returned = 0;
+    }
+
+    for (;;) {
+        const char *base;
+        const char *end;
+        const char *lf;
+        size_t n;
+
+        if (r->cur < 0) {
+            if (r->finished) {
+                if (r->read_error) {
+                    r->failed = 1;
+                    return -1;
+                }
+                if (r->line_len == 0) return 0;
+                r->line_returned = 1;
+                *out_line = r->line;
+                *out_len = r->line_len;
+                return 2;
+            }
+            (void)pthread_mutex_lock(&r->mutex);
+            while (!r->chunk_full[r->next]) {
+                (void)pthread_cond_wait(&r->cond, &r->mutex);
+            }
+            (void)pthread_mutex_unlock(&r->mutex);
+            r->cur = r->next;
+            r->next ^= 1;
+            r->pos = 0;
+        }
+
+        base = r->chunk[r->cur];
+        end = base + r->chunk_len[r->cur];
+        lf = siml_find_lf(base + r->pos, end);
+        if (r->skipping) {
+            /* Read past the rest of a line too long, up to its LF. */
+            if (lf) {
+                r->pos = (size_t)(lf - base) + 1;
+                r->skipping = 0;
+                continue;
+            }
+        } else if (lf && r->line_len == 0) {
+            n = (size_t)(lf - (base + r->pos));
+            *out_line = base + r->pos;
+            *out_len = n;
+            r->pos += n + 1;
+            return 1;
+        } else {
+            /* Append to the line buffer up to the LF or the end of the
+             * chunk. A line too long goes out as soon as SIML_MAX_LINE_LEN
+             * + 1 bytes of it are in; a further call skips the rest.
+             */
+            n = (size_t)((lf ? lf : end) - (base + r->pos));
+            if (r->line_len + n > SIML_MAX_LINE_LEN) {
+                size_t keep = SIML_MAX_LINE_LEN + 1 - r->line_len;
+                memcpy(r->line + r->line_len, base + r->pos, keep);
+                r->line_len += keep;
+                r->pos += keep;
+                r->skipping = 1;
+                r->line_returned = 1;
+                *out_line = r->line;
+                *out_len = r->line_len;
+                return 1;
+            }
+            memcpy(r->line + r->line_len, base + r->pos, n);
+            r->line_len += n;
+            if (lf) {
+                r->pos += n + 1;
+                r->line_returned = 1;
+                *out_line = r->line;
+                *out_len = r->line_len;
+                return 1;
+            }
+        }
+
+        /* Chunk used up: hand it back to the reader thread. */
+        (void)pthread_mutex_lock(&r->mutex);
+        if (r->chunk_last[r->cur]) {
+            r->finished = 1;
+        }
+        r->chunk_full[r->cur] = 0;
+        (void)pthread_cond_broadcast(&r->cond);
+        (void)pthread_mutex_unlock(&r->mutex);
+        r->cur = -1;
+    }
+}
+
+int siml_tape_save(siml_parser *p, const char *path) {
+    siml_tape_writer w;
+    siml_event ev;
+    char *tape;
+    char *tmp;
+    size_t cap = 65536;
+    size_t len;
+    size_t done = 0;
+    size_t plen;
+    int fd;
+    int ok = 1;
+
+    if (!p || !path || p->input != SIML_INPUT_BUFFER) {
+        errno = EINVAL;
+        return 0;
+    }
+    tape = (char *)malloc(cap);
+    if (!tape) return 0;
+    siml_tape_writer_init(&w, p->buffer.data, p->buffer.len);
+    w.validate_utf8 = p->validate_utf8;
+    len = siml_tape_write_header(&w, tape);
+    for (;;) {
+        siml_event_type t = siml_next(p, &ev);
+        size_t n;
+
+        if (cap - len < SIML_TAPE_MAX_RECORD) {
+            char *grown = (char *)realloc(tape, cap * 2);
+            if (!grown) {
+                free(tape);
+                return 0;
+            }
+            tape = grown;
+            cap *= 2;
+        }
+        n = siml_tape_write(&w, t, &ev, tape + len);
+        if (n == 0) {
+            free(tape);
+            errno = EINVAL;
+            return 0;
+        }
+        len += n;
+        if (t == SIML_EVENT_STREAM_END || t == SIML_EVENT_ERROR) break;
+    }
+
+    plen = strlen(path);
+    tmp = (char *)malloc(plen + 8);
+    if (!tmp) {
+        free(tape);
+        return 0;
+    }
+    /* mkstemp() picks a name no other writer holds, as siml_cache_write()
+     * does; a fixed name could be renamed into place half written.
+     */
+    memcpy(tmp, path, plen);
+    memcpy(tmp + plen, ".XXXXXX", 8);
+    fd = mkstemp(tmp);
+    if (fd < 0) ok = 0;
+    while (ok && done < len) {
+        long n = (long)write(fd, tape + done, len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            ok = 0;
+            break;
+        }
+        done += (size_t)n;
+    }
+    if (fd >= 0 && close(fd) != 0) ok = 0;
+    if (ok && rename(tmp, path) != 0) ok = 0;
+    if (!ok && fd >= 0) {
+        int saved = errno;
+        (void)unlink(tmp);
+        errno = saved;
+    }
+    free(tmp);
+    free(tape);
+    return ok;
+}
+
+/* Pieces go out in groups of up to 16; a short write resumes in the piece
+ * where it stopped.
+ */
+int siml_fd_write(void *userdata, const siml_slice *pieces, int count) {
+    struct iovec iov[16];
+    int fd = *(const int *)userdata;
+    size_t skip = 0;   /* bytes of pieces[0] already written */
+
+    while (count > 0) {
+        int n = count < 16 ? count : 16;
+        size_t want = 0;
+        long done;
+        int i;
+
+        for (i = 0; i < n; ++i) {
+            size_t from = i == 0 ? skip : 0;
+            iov[i].iov_base = (void *)(pieces[i].ptr + from);
+            iov[i].iov_len = pieces[i].len - from;
+            want += iov[i].iov_len;
+        }
+        done = want > 0 ? (long)writev(fd, iov, n) : 0;
+        if (done < 0 && errno == EINTR) continue;
+        if (done < 0) return 0;
+        if (done == 0 && want > 0) {
+            errno = EIO;
+            return 0;
+        }
+        /* Drop the pieces written in full. */
+        while (count > 0 && (size_t)done >= pieces[0].len - skip) {
+            done -= (long)(pieces[0].len - skip);
+            skip = 0;
+            pieces += 1;
+            count -= 1;
+        }
+        skip += (size_t)done;
+    }
+    return 1;
+}
+
+#endif /* SIML_IMPLEMENTATION */
+
+#endif /* SIML_IO_H_INCLUDED */
@@ -0,0 +1,597 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#define SIML_IMPLEMENTATION
+#include "siml.h"
+#include "siml-incremental.h"
+#include "siml-cache.h"
+
+/* Validates many files in one process. Files are sorted by path and dealt
+ * out to the workers in contiguous runs; a worker that runs dry steals the
+ * upper half of another worker's remaining run. Each worker reuses one
+ * parser and one read buffer for all of its files. With -c, verdicts are
+ * kept in a siml-cache.h directory, and files seen before are not parsed.
+ *
+ * With -e, validates one file and then replays a script of edits on it,
+ * checking the file again after each edit with siml-incremental.h. Each
+ * script line is "offset length text": length bytes at offset are replaced
+ * by text, in which \n, \t and \\ stand for a newline, a tab and a
+ * backslash. With -x, each result is also compared with a parse of the
+ * whole edited file, and a mismatch stops the replay.
+ */
+
+struct path_list {
+    char  **paths;
+    size_t  len;
+    size_t  cap;
+    int     failed;  /* boolean: some directory could not be read */
+};
+
+/* Outcome for one file; message is NULL when the file is valid. */
+struct result {
+    char *message;
+};
+
+struct lint;
+
+struct worker {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    size_t          lo;      /* files [lo, hi) are not taken yet */
+    size_t          hi;
+    int             index;
+    struct lint    *lint;
+    siml_parser     parser;
+    siml_cache      cache;
+    char           *buf;
+    size_t          cap;
+};
+
+struct lint {
+    struct path_list files;
+    struct result   *results;
+    struct worker   *workers;
+    int              nworkers;
+    const char      *cache_dir;  /* NULL: no cache */
+};
+
+static int list_add(struct path_list *l, const char *path, size_t len) {
+    char *copy;
+
+    if (l->len == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 256;
+        char **paths = (char **)realloc(l->paths, cap * sizeof(char *));
+        if (!paths) return 0;
+        l->paths = paths;
+        l->cap = cap;
+    }
+    copy = (char *)malloc(len + 1);
+    if (!copy) return 0;
+    memcpy(copy, path, len);
+    copy[len] = '\0';
+    l->paths[l->len++] = copy;
+    return 1;
+}
+
+static int has_siml_suffix(const char *name) {
+    size_t n = strlen(name);
+    return n > 5 && strcmp(name + n - 5, ".siml") == 0;
+}
+
+/* Add the .siml files below dir. Symbolic links to files are followed, but
+ * not those to directories, which could lead back up the tree. A directory
+ * that cannot be read is reported and sets l->failed. Returns 0 on
+ * allocation failure.
+ */
+static int walk_dir(struct path_list *l, const char *dir) {
+    DIR *d;
+    struct dirent *e;
+    size_t dlen = strlen(dir);
+    char *path;
+    int ok = 1;
+
+    d = opendir(dir);
+    if (!d) {
+        perror(dir);
+        l->failed = 1;
+        return 1;
+    }
+    while (ok && (e = readdir(d)) != 0) {
+        size_t nlen;
+        int is_dir;
+        int is_reg;
+
+        if (e->d_name[0] == '.') continue;
+        nlen = strlen(e->d_name);
+        path = (char *)malloc(dlen + nlen + 2);
+        if (!path) {
+            ok = 0;
+            break;
+        }
+        memcpy(path, dir, dlen);
+        path[dlen] = '/';
+        memcpy(path + dlen + 1, e->d_name, nlen + 1);
+#if defined(DT_DIR) && defined(DT_REG) && defined(DT_LNK) && \
+    defined(DT_UNKNOWN)
+        is_dir = (e->d_type == DT_DIR);
+        is_reg = (e->d_type == DT_REG);
+        if (e->d_type == DT_UNKNOWN || e->d_type == DT_LNK)
+#endif
+        {
+            struct stat st;
+            is_dir = is_reg = 0;
+            if (lstat(path, &st) == 0) {
+                is_dir = S_ISDIR(st.st_mode);
+                if (S_ISLNK(st.st_mode) && stat(path, &st) != 0) {
+                    st.st_mode = 0;
+                }
+                is_reg = S_ISREG(st.st_mode);
+            }
+        }
+        if (is_dir) {
+            ok = walk_dir(l, path);
+        } else if (is_reg && has_siml_suffix(e->d_name)) {
+            ok = list_add(l, path, dlen + 1 + nlen);
+        }
+        free(path);
+    }
+    (void)closedir(d);
+    return ok;
+}
+
+/* Add a command-line path: a directory is searched, anything else is taken
+ * as a file to check.
+ */
+static int add_path(struct path_list *l, const char *path) {
+    struct stat st;
+
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        return walk_dir(l, path);
+    }
+    return list_add(l, path, strlen(path));
+}
+
+/* Add every path listed one per line in file ("-" for stdin). */
+static int add_list(struct path_list *l, const char *file) {
+    FILE *f;
+    char line[4096];
+    int ok = 1;
+
+    f = strcmp(file, "-") == 0 ? stdin : fopen(file, "r");
+    if (!f) {
+        perror(file);
+        return 0;
+    }
+    while (ok && fgets(line, sizeof(line), f)) {
+        size_t n = strlen(line);
+        while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r')) {
+            line[--n] = '\0';
+        }
+        if (n > 0) ok = add_path(l, line);
+    }
+    if (f != stdin) (void)fclose(f);
+    return ok;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Read the whole file into the worker's buffer. Returns 0 with errno set on
+ * failure.
+ */
+static int read_file(struct worker *w, const char *path, size_t *out_len) {
+    struct stat st;
+    size_t len = 0;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+        (size_t)st.st_size + 1 > w->cap) {
+        char *buf = (char *)realloc(w->buf, (size_t)st.st_size + 1);
+        if (!buf) {
+            (void)close(fd);
+            errno = ENOMEM;
+            return 0;
+        }
+        w->buf = buf;
+        w->cap = (size_t)st.st_size + 1;
+    }
+    for (;;) {
+        long n;
+        if (len == w->cap) {
+            size_t cap = w->cap ? w->cap * 2 : 65536;
+            char *buf = (char *)realloc(w->buf, cap);
+            if (!buf) {
+                (void)close(fd);
+                errno = ENOMEM;
+                return 0;
+            }
+            w->buf = buf;
+            w->cap = cap;
+        }
+        n = (long)read(fd, w->buf + len, w->cap - len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            int saved = errno;
+            (void)close(fd);
+            errno = saved;
+            return 0;
+        }
+        if (n == 0) break;
+        len += (size_t)n;
+    }
+    (void)close(fd);
+    *out_len = len;
+    return 1;
+}
+
+static char *format_message(const char *path, long line, const char *msg) {
+    size_t n = strlen(path) + strlen(msg) + 64;
+    char *s = (char *)malloc(n);
+
+    if (!s) return 0;
+    if (line >= 0) {
+        (void)sprintf(s, "%s: SIML error at line %ld: %s", path, line, msg);
+    } else {
+        (void)sprintf(s, "%s: %s", path, msg);
+    }
+    return s;
+}
+
+static void check_file(struct worker *w, size_t i) {
+    const char *path = w->lint->files.paths[i];
+    struct result *r = &w->lint->results[i];
+    siml_event ev;
+    size_t len;
+
+    r->message = 0;
+    if (!read_file(w, path, &len)) {
+        r->message = format_message(path, -1, strerror(errno));
+        return;
+    }
+    if (w->lint->cache_dir) {
+        if (!siml_cache_check(&w->cache, w->buf, len)) {
+            r->message = format_message(path, -1, strerror(ENOMEM));
+        } else if (w->cache.error_message) {
+            r->message = format_message(path, w->cache.error_line,
+                                        w->cache.error_message);
+        }
+        return;
+    }
+    /* Re-pointing the parser at the new buffer resets it. */
+    siml_parser_init_buffer(&w->parser, w->buf, len);
+    w->parser.validate_utf8 = 1;
+    for (;;) {
+        siml_event_type t = siml_next(&w->parser, &ev);
+        if (t == SIML_EVENT_ERROR) {
+            r->message = format_message(path, ev.line,
+                                        ev.error_message ? ev.error_message
+                                                         : "parse error");
+            return;
+        }
+        if (t == SIML_EVENT_STREAM_END) return;
+    }
+}
+
+/* Take the next file of w's own run, or steal half of another run. */
+static int next_file(struct worker *w, size_t *out) {
+    struct lint *lint = w->lint;
+    int k;
+
+    (void)pthread_mutex_lock(&w->lock);
+    if (w->lo < w->hi) {
+        *out = w->lo++;
+        (void)pthread_mutex_unlock(&w->lock);
+        return 1;
+    }
+    (void)pthread_mutex_unlock(&w->lock);
+
+    for (k = 1; k < lint->nworkers; ++k) {
+        struct worker *v = &lint->workers[(w->index + k) % lint->nworkers];
+        size_t lo = 0;
+        size_t hi = 0;
+
+        (void)pthread_mutex_lock(&v->lock);
+        if (v->lo < v->hi) {
+            size_t n = (v->hi - v->lo + 1) / 2;
+            hi = v->hi;
+            lo = hi - n;
+            v->hi = lo;
+        }
+        (void)pthread_mutex_unlock(&v->lock);
+        if (lo < hi) {
+            *out = lo;
+            (void)pthread_mutex_lock(&w->lock);
+            w->lo = lo + 1;
+            w->hi = hi;
+            (void)pthread_mutex_unlock(&w->lock);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *worker_main(void *arg) {
+    struct worker *w = (struct worker *)arg;
+    size_t i;
+
+    while (next_file(w, &i)) {
+        check_file(w, i);
+    }
+    return 0;
+}
+
+/* Decode the text of an edit line in place. Returns its length. */
+static size_t unescape(char *s) {
+    char *out = s;
+    const char *in = s;
+
+    while (*in) {
+        if (in[0] == '\\' && in[1] == 'n') {
+            *out++ = '\n';
+            in += 2;
+        } else if (in[0] == '\\' && in[1] == 't') {
+            *out++ = '\t';
+            in += 2;
+        } else if (in[0] == '\\' && in[1] == '\\') {
+            *out++ = '\\';
+            in += 2;
+        } else {
+            *out++ = *in++;
+        }
+    }
+    return (size_t)(out - s);
+}
+
+static void print_state(const char *path, unsigned long step,
+                        const siml_incremental *s) {
+    if (s->error_message) {
+        (void)printf("%s: edit %lu: SIML error at line %ld: %s\n", path, step,
+                     s->error_line, s->error_message);
+    } else {
+        (void)printf("%s: edit %lu: ok\n", path, step);
+    }
+}
+
+/* Compare s against a parse of the whole buffer. Returns 0 on a mismatch.
+ */
+static int cross_check(const char *path, unsigned long step,
+                       const siml_incremental *s, const char *data,
+                       size_t len) {
+    siml_parser p;
+    siml_event ev;
+
+    siml_parser_init_buffer(&p, data, len);
+    p.validate_utf8 = s->validate_utf8;
+    for (;;) {
+        siml_event_type t = siml_next(&p, &ev);
+        if (t == SIML_EVENT_ERROR) {
+            if (s->error_message && s->error_line == ev.line &&
+                s->error_code == ev.error_code &&
+                strcmp(s->error_message, ev.error_message
+                                             ? ev.error_message
+                                             : "parse error") == 0) {
+                return 1;
+            }
+            break;
+        }
+        if (t == SIML_EVENT_STREAM_END) {
+            if (!s->error_message) return 1;
+            ev.line = 0;
+            ev.error_message = "no error";
+            break;
+        }
+    }
+    (void)fprintf(stderr, "%s: edit %lu: full parse reports line %ld: %s\n",
+                  path, step, ev.line,
+                  ev.error_message ? ev.error_message : "parse error");
+    return 0;
+}
+
+/* Apply the edits read from f to the file in w's buffer, checking it after
+ * each, and with full_check against a full parse too. Returns 1 when the
+ * script ran to its end.
+ */
+static int run_script(FILE *f, const char *script, const char *path,
+                      struct worker *w, size_t len, siml_incremental *s,
+                      int full_check) {
+    char line[4096];
+    unsigned long step = 0;
+
+    if (!siml_incremental_parse(s, w->buf, len)) {
+        perror(path);
+        return 0;
+    }
+    print_state(path, step, s);
+    if (full_check && !cross_check(path, step, s, w->buf, len)) return 0;
+    while (fgets(line, sizeof(line), f)) {
+        char *text;
+        unsigned long offset;
+        unsigned long old_len;
+        size_t new_len;
+        size_t n = strlen(line);
+
+        if (n > 0 && line[n - 1] == '\n') line[--n] = '\0';
+        if (n == 0 || line[0] == '#') continue;
+        step += 1;
+        offset = strtoul(line, &text, 10);
+        old_len = strtoul(text, &text, 10);
+        if (*text == ' ') text += 1;
+        new_len = unescape(text);
+        if (offset > len || old_len > len - offset) {
+            (void)fprintf(stderr, "%s: edit %lu: past the end of %s\n",
+                          script, step, path);
+            return 0;
+        }
+        if (len - old_len + new_len > w->cap) {
+            size_t cap = len - old_len + new_len;
+            char *buf = (char *)realloc(w->buf, cap);
+            if (!buf) {
+                perror(path);
+                return 0;
+            }
+            w->buf = buf;
+            w->cap = cap;
+        }
+        memmove(w->buf + offset + new_len, w->buf + offset + old_len,
+                len - offset - old_len);
+        memcpy(w->buf + offset, text, new_len);
+        len = len - old_len + new_len;
+        if (!siml_incremental_edit(s, w->buf, len, offset, old_len,
+                                   new_len)) {
+            perror(path);
+            return 0;
+        }
+        print_state(path, step, s);
+        if (full_check && !cross_check(path, step, s, w->buf, len)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int replay(const char *script, const char *path, int full_check) {
+    struct worker w;
+    siml_incremental s;
+    FILE *f;
+    size_t len = 0;
+    int ok;
+
+    memset(&w, 0, sizeof(w));
+    if (!read_file(&w, path, &len)) {
+        perror(path);
+        free(w.buf);
+        return 1;
+    }
+    f = fopen(script, "r");
+    if (!f) {
+        perror(script);
+        free(w.buf);
+        return 1;
+    }
+    siml_incremental_init(&s);
+    s.validate_utf8 = 1;
+    ok = run_script(f, script, path, &w, len, &s, full_check);
+    siml_incremental_free(&s);
+    (void)fclose(f);
+    free(w.buf);
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    struct lint lint;
+    long threads = 0;
+    int argi;
+    int k;
+    size_t i;
+    int started;
+    int rc = 0;
+
+    if (argc == 4 && strcmp(argv[1], "-e") == 0) {
+        return replay(argv[2], argv[3], 0);
+    }
+    if (argc == 5 && strcmp(argv[1], "-e") == 0 &&
+        strcmp(argv[3], "-x") == 0) {
+        return replay(argv[2], argv[4], 1);
+    }
+    memset(&lint, 0, sizeof(lint));
+    for (argi = 1; argi < argc; ++argi) {
+        if (strcmp(argv[argi], "-j") == 0 && argi + 1 < argc) {
+            threads = strtol(argv[++argi], NULL, 10);
+        } else if (strcmp(argv[argi], "-c") == 0 && argi + 1 < argc) {
+            lint.cache_dir = argv[++argi];
+        } else if (strcmp(argv[argi], "-l") == 0 && argi + 1 < argc) {
+            if (!add_list(&lint.files, argv[++argi])) return 1;
+        } else if (argv[argi][0] == '-' && argv[argi][1] != '\0') {
+            (void)fprintf(stderr,
+                          "Usage: %s [-j threads] [-c dir] [-l list] [path...]\n"
+                          "       %s -e script [-x] <file.siml>\n"
+                          "  paths are files or directories searched for "
+                          "*.siml, not following links to directories;\n"
+                          "  -l reads paths from a file (- for stdin)\n"
+                          "  -c keeps verdicts in the cache directory dir\n"
+                          "  -e checks the file after each edit of script\n"
+                          "  -x compares each check with a full parse\n",
+                          argv[0], argv[0]);
+            return 1;
+        } else if (!add_path(&lint.files, argv[argi])) {
+            perror(argv[argi]);
+            return 1;
+        }
+    }
+    /* An unreadable directory fails the run, but the rest is checked. */
+    rc = lint.files.failed;
+    if (lint.files.len == 0) return rc;
+    qsort(lint.files.paths, lint.files.len, sizeof(char *), compare_paths);
+
+    if (threads <= 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads <= 0) threads = 1;
+    }
+    if ((size_t)threads > lint.files.len) threads = (long)lint.files.len;
+    lint.nworkers = (int)threads;
+    lint.results = (struct result *)calloc(lint.files.len,
+                                           sizeof(struct result));
+    lint.workers = (struct worker *)calloc((size_t)threads,
+                                           sizeof(struct worker));
+    if (!lint.results || !lint.workers) {
+        perror(argv[0]);
+        return 1;
+    }
+
+    for (k = 0; k < lint.nworkers; ++k) {
+        struct worker *w = &lint.workers[k];
+        w->index = k;
+        w->lint = &lint;
+        siml_cache_init(&w->cache, lint.cache_dir);
+        w->cache.validate_utf8 = 1;
+        w->lo = lint.files.len * (size_t)k / (size_t)lint.nworkers;
+        w->hi = lint.files.len * (size_t)(k + 1) / (size_t)lint.nworkers;
+        (void)pthread_mutex_init(&w->lock, 0);
+    }
+    started = 0;
+    for (k = 1; k < lint.nworkers; ++k) {
+        if (pthread_create(&lint.workers[k].thread, 0, worker_main,
+                           &lint.workers[k]) != 0) {
+            break;
+        }
+        started = k;
+    }
+    /* The main thread is worker 0; it steals whatever failed to start. */
+    (void)worker_main(&lint.workers[0]);
+    for (k = 1; k <= started; ++k) {
+        (void)pthread_join(lint.workers[k].thread, 0);
+    }
+    for (k = started + 1; k < lint.nworkers; ++k) {
+        (void)worker_main(&lint.workers[k]);
+    }
+
+    for (i = 0; i < lint.files.len; ++i) {
+        if (lint.results[i].message) {
+            (void)fprintf(stderr, "%s\n", lint.results[i].message);
+            free(lint.results[i].message);
+            rc = 1;
+        }
+        free(lint.files.paths[i]);
+    }
+    for (k = 0; k < lint.nworkers; ++k) {
+        (void)pthread_mutex_destroy(&lint.workers[k].lock);
+        siml_cache_close(&lint.workers[k].cache);
+        free(lint.workers[k].buf);
+    }
+    free(lint.files.paths);
+    free(lint.results);
+    free(lint.workers);
+    return rc;
+}
@@ -0,0 +1,430 @@
+#ifndef SIML_PARALLEL_H_INCLUDED
+#define SIML_PARALLEL_H_INCLUDED
+
+/*
+ * SIML parallel document parser v0.1
+ *
+ * Companion to siml.h. Parses the documents of an in-memory stream on several
+ * threads and hands the events back in stream order.
+ *
+ * The input is cut into units at indent-0 lines: "---" separators, and
+ * top-level entries of a document (keys or "- " items after its first line),
+ * so that one large document is split as well. Each worker thread parses one
+ * unit at a time with its own siml_parser, and siml_parallel_next() returns
+ * the units' events one after another. Events, errors and line numbers are
+ * those siml_next() would report for the whole stream, including the checks
+ * on separators before the first and after the last document.
+ *
+ * A unit that starts at an entry is parsed with the root container already
+ * open. The parser of the unit before it reads on into that entry's line:
+ * the container, block scalar and header-only state it ends with decides
+ * which events and errors that line causes before the entry itself. Its
+ * events stop at the first one that belongs to the entry.
+ *
+ * Define SIML_IMPLEMENTATION in exactly one translation unit, as for siml.h.
+ * The including file must request POSIX/BSD declarations (e.g. by defining
+ * _DEFAULT_SOURCE) before including any system header, and link with the
+ * platform's threads library.
+ */
+
+#include "siml.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h> /* size_t */
+#include <pthread.h>
+
+/* Target unit size in bytes. A unit ends at the first separator or
+ * top-level entry at or past this size.
+ */
+#ifndef SIML_PARALLEL_UNIT_SIZE
+#define SIML_PARALLEL_UNIT_SIZE 65536
+#endif
+
+/* Parsed units held per worker thread while earlier ones are delivered. */
+#ifndef SIML_PARALLEL_UNITS_PER_THREAD
+#define SIML_PARALLEL_UNITS_PER_THREAD 4
+#endif
+
+/* A run of documents and the events parsed from it. */
+typedef struct siml_parallel_unit_s {
+    const char  *data;
+    size_t       len;
+    size_t       avail;      /* bytes from data to the end of the stream */
+    siml_resume_kind start;  /* where the unit starts in the stream */
+    int          to_entry;   /* boolean: ends before a top-level entry */
+    int          last;       /* boolean: ends the stream */
+    int          done;       /* boolean: events are complete */
+    long         lines;      /* physical lines in the unit */
+    siml_event  *events;
+    size_t       count;
+    size_t       cap;
+    char         error_buf[160];
+} siml_parallel_unit;
+
+typedef struct siml_parallel_s {
+    /* Options; set after init, before the first siml_parallel_next() */
+    int                 validate_utf8; /* boolean, default SIML_VALIDATE_UTF8 */
+    size_t              unit_size;     /* default SIML_PARALLEL_UNIT_SIZE */
+
+    const char         *data;
+    size_t              len;
+    siml_parallel_unit *units;        /* ring of nunits */
+    size_t              nunits;
+    size_t              split_pos;    /* input before this is claimed */
+    siml_resume_kind    split_start;  /* how the input at split_pos starts */
+    unsigned long       claimed;      /* units handed to workers */
+    int                 split_done;   /* boolean: nothing left to claim */
+    unsigned long       current;      /* unit being delivered */
+    size_t              pos;          /* next event of the current unit */
+    long                line_base;    /* lines before the current unit */
+    siml_event          final;        /* STREAM_END or ERROR, repeated */
+    int                 finished;     /* boolean */
+    int                 go;           /* boolean: options are final */
+    int                 stop;         /* boolean */
+    int                 nthreads;
+    pthread_t          *threads;
+    pthread_mutex_t     mutex;
+    pthread_cond_t      cond;
+} siml_parallel;
+
+/* Start threads workers (0 selects the number of online CPUs) over the len
+ * bytes at data. Returns 1 on success, 0 on allocation or thread creation
+ * failure. Event slices point into data, which must outlive the parser.
+ */
+int siml_parallel_init(siml_parallel *pp, const char *data, size_t len,
+                       int threads);
+
+/* Stop the workers and release all memory. Waits for units in progress. */
+void siml_parallel_free(siml_parallel *pp);
+
+/* Next event of the stream, as siml_next() would return it. Blocks until the
+ * unit holding it is parsed. Events stay valid until the next call.
+ */
+siml_event_type siml_parallel_next(siml_parallel *pp, siml_event *ev);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* ---------------- Implementation ---------------- */
+#ifdef SIML_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Whether the indent-0 line at q can start a unit: a content line of its
+ * document comes before it, so the root container is open.
+ */
+static int siml_parallel_entry_ok(const char *data, const char *q) {
+    while (q > data) {
+        const char *a = q - 1;
+        const char *b;
+        while (a > data && a[-1] != '\n') --a;
+        b = a;
+        while (b < q - 1 && *b == ' ') ++b;
+        if (b == q - 1 || *b == '#') {
+            /* Blank or comment line; look further back. */
+            q = a;
+            continue;
+        }
+        return !(q - 1 - a == 3 && a[0] == '-' && a[1] == '-' && a[2] == '-');
+    }
+    return 0;
+}
+
+/* End of the unit holding from: just past the first "---" line, or at the
+ * first top-level entry, that starts at or after from; or len. *entry tells
+ * which.
+ */
+static size_t siml_parallel_split(const char *data, size_t len, size_t from,
+                                  int *entry) {
+    const char *q;
+    const char *end = data + len;
+
+    *entry = 0;
+    if (from >= len) return len;
+    if (from == 0) from = 1;
+    q = data + from - 1;
+    for (;;) {
+        q = (const char *)memchr(q, '\n', (size_t)(end - q));
+        if (!q || end - q < 2) return len;
+        q += 1;
+        if (q[0] == '-' && end - q >= 3 && q[1] == '-' && q[2] == '-') {
+            if (end - q >= 4 && q[3] == '\n') return (size_t)(q - data) + 4;
+            continue;
+        }
+        if (q[0] != ' ' && q[0] != '#' && q[0] != '\n' &&
+            siml_parallel_entry_ok(data, q)) {
+            *entry = 1;
+            return (size_t)(q - data);
+        }
+    }
+}
+
+static long siml_parallel_count_lines(const char *s, size_t len) {
+    const char *end = s + len;
+    long n = 0;
+
+    while ((s = (const char *)memchr(s, '\n', (size_t)(end - s))) != 0) {
+        n += 1;
+        s += 1;
+    }
+    return n;
+}
+
+/* Parse one unit into its event list. Returns 0 if the stream ends with an
+ * error in this unit.
+ */
+static int siml_parallel_parse(siml_parallel_unit *u, int validate_utf8) {
+    siml_parser p;
+    siml_event ev;
+    siml_event_type t;
+    size_t len = u->to_entry ? u->avail : u->len;
+    long entry_line = 0;
+
+    if (u->start == SIML_RESUME_ENTRY) {
+        siml_parser_init_buffer_entry(&p, u->data, len);
+    } else if (u->start == SIML_RESUME_SEPARATOR) {
+        siml_parser_init_buffer_resume(&p, u->data, len);
+    } else {
+        siml_parser_init_buffer(&p, u->data, len);
+    }
+    p.validate_utf8 = validate_utf8;
+    u->count = 0;
+    if (u->to_entry) {
+        entry_line = siml_parallel_count_lines(u->data, u->len) + 1;
+    }
+
+    for (;;) {
+        t = siml_next(&p, &ev);
+        ev.type = t;  /* not always set on errors */
+        if (u->to_entry &&
+            (ev.line > entry_line ||
+             (ev.line == entry_line && t != SIML_EVENT_MAPPING_END &&
+              t != SIML_EVENT_SEQUENCE_END &&
+              t != SIML_EVENT_BLOCK_SCALAR_END && t != SIML_EVENT_ERROR))) {
+            /* The entry's own events come from the next unit. */
+            u->lines = entry_line - 1;
+            return 1;
+        }
+        if (t == SIML_EVENT_ERROR && !u->last && !u->to_entry &&
+            ev.error_code == SIML_ERR_SEPARATOR_AFTER_DOC) {
+            /* The unit ends at its separator; the next unit goes on. */
+            break;
+        }
+        if (u->count == u->cap) {
+            size_t cap = u->cap * 2;
+            siml_event *events;
+            events = (siml_event *)realloc(u->events, cap * sizeof(siml_event));
+            if (!events) {
+                /* Report in place of the last event kept. */
+                siml_clear_event(&ev);
+                ev.type = SIML_EVENT_ERROR;
+                ev.error_code = SIML_ERR_IO;
+                ev.error_message = "out of memory";
+                ev.line = p.line_no;
+                u->events[u->count - 1] = ev;
+                u->lines = p.line_no;
+                return 0;
+            }
+            u->events = events;
+            u->cap = cap;
+        }
+        if (t == SIML_EVENT_ERROR) {
+            size_t n = strlen(ev.error_message);
+            if (n >= sizeof(u->error_buf)) n = sizeof(u->error_buf) - 1;
+            memcpy(u->error_buf, ev.error_message, n);
+            u->error_buf[n] = '\0';
+            ev.error_message = u->error_buf;
+        }
+        u->events[u->count++] = ev;
+        if (t == SIML_EVENT_ERROR) {
+            u->lines = p.line_no;
+            return 0;
+        }
+        if (t == SIML_EVENT_STREAM_END) break;
+    }
+    u->lines = p.line_no;
+    return 1;
+}
+
+/* Worker thread: claim the next unit while the ring has room, parse it. */
+static void *siml_parallel_thread(void *arg) {
+    siml_parallel *pp = (siml_parallel *)arg;
+
+    for (;;) {
+        siml_parallel_unit *u;
+        size_t start;
+        unsigned long seq;
+        int validate_utf8;
+        int entry;
+        int ok;
+
+        (void)pthread_mutex_lock(&pp->mutex);
+        while (!pp->stop && (!pp->go ||
+               (!pp->split_done && pp->claimed - pp->current >= pp->nunits))) {
+            (void)pthread_cond_wait(&pp->cond, &pp->mutex);
+        }
+        if (pp->stop || pp->split_done) {
+            (void)pthread_mutex_unlock(&pp->mutex);
+            return 0;
+        }
+        seq = pp->claimed++;
+        u = &pp->units[seq % pp->nunits];
+        start = pp->split_pos;
+        pp->split_pos = siml_parallel_split(pp->data, pp->len,
+                                            start + pp->unit_size, &entry);
+        if (pp->split_pos == pp->len) pp->split_done = 1;
+        u->data = pp->data + start;
+        u->len = pp->split_pos - start;
+        u->avail = pp->len - start;
+        u->start = pp->split_start;
+        u->to_entry = entry;
+        u->last = (pp->split_pos == pp->len);
+        pp->split_start = entry ? SIML_RESUME_ENTRY : SIML_RESUME_SEPARATOR;
+        u->done = 0;
+        validate_utf8 = pp->validate_utf8;
+        (void)pthread_mutex_unlock(&pp->mutex);
+
+        ok = siml_parallel_parse(u, validate_utf8);
+
+        (void)pthread_mutex_lock(&pp->mutex);
+        u->done = 1;
+        if (!ok) pp->split_done = 1;
+        (void)pthread_cond_broadcast(&pp->cond);
+        (void)pthread_mutex_unlock(&pp->mutex);
+    }
+}
+
+int siml_parallel_init(siml_parallel *pp, const char *data, size_t len,
+                       int threads) {
+    size_t i;
+
+    if (!pp) return 0;
+    if (threads <= 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = n > 0 ? (int)n : 1;
+    }
+    pp->validate_utf8 = SIML_VALIDATE_UTF8;
+    pp->unit_size = SIML_PARALLEL_UNIT_SIZE;
+    pp->data = data;
+    pp->len = len;
+    pp->nunits = (size_t)threads * SIML_PARALLEL_UNITS_PER_THREAD;
+    pp->units = (siml_parallel_unit *)malloc(pp->nunits *
+                                             sizeof(siml_parallel_unit));
+    pp->threads = (pthread_t *)malloc((size_t)threads * sizeof(pthread_t));
+    pp->split_pos = 0;
+    pp->split_start = SIML_RESUME_NONE;
+    pp->claimed = 0;
+    pp->split_done = 0;
+    pp->current = 0;
+    pp->pos = 0;
+    pp->line_base = 0;
+    pp->finished = 0;
+    pp->go = 0;
+    pp->stop = 0;
+    pp->nthreads = 0;
+    if (!pp->units || !pp->threads) {
+        free(pp->units);
+        free(pp->threads);
+        pp->units = 0;
+        pp->threads = 0;
+        return 0;
+    }
+    for (i = 0; i < pp->nunits; ++i) {
+        pp->units[i].count = 0;
+        pp->units[i].cap = 1024;
+        pp->units[i].events = (siml_event *)malloc(pp->units[i].cap *
+                                                   sizeof(siml_event));
+        if (!pp->units[i].events) {
+            while (i > 0) free(pp->units[--i].events);
+            free(pp->units);
+            free(pp->threads);
+            pp->units = 0;
+            pp->threads = 0;
+            return 0;
+        }
+    }
+    (void)pthread_mutex_init(&pp->mutex, 0);
+    (void)pthread_cond_init(&pp->cond, 0);
+    while (pp->nthreads < threads) {
+        if (pthread_create(&pp->threads[pp->nthreads], 0,
+                           siml_parallel_thread, pp) != 0) {
+            siml_parallel_free(pp);
+            return 0;
+        }
+        pp->nthreads += 1;
+    }
+    return 1;
+}
+
+void siml_parallel_free(siml_parallel *pp) {
+    size_t i;
+    int k;
+
+    if (!pp || !pp->units) return;
+    (void)pthread_mutex_lock(&pp->mutex);
+    pp->stop = 1;
+    (void)pthread_cond_broadcast(&pp->cond);
+    (void)pthread_mutex_unlock(&pp->mutex);
+    for (k = 0; k < pp->nthreads; ++k) {
+        (void)pthread_join(pp->threads[k], 0);
+    }
+    (void)pthread_cond_destroy(&pp->cond);
+    (void)pthread_mutex_destroy(&pp->mutex);
+    for (i = 0; i < pp->nunits; ++i) {
+        free(pp->units[i].events);
+    }
+    free(pp->units);
+    free(pp->threads);
+    pp->units = 0;
+    pp->threads = 0;
+    pp->nthreads = 0;
+}
+
+siml_event_type siml_parallel_next(siml_parallel *pp, siml_event *ev) {
+    siml_parallel_unit *u;
+
+    if (!pp || !ev || !pp->units) return SIML_EVENT_ERROR;
+    if (pp->finished) {
+        *ev = pp->final;
+        return ev->type;
+    }
+
+    u = &pp->units[pp->current % pp->nunits];
+    if (pp->pos == 0) {
+        (void)pthread_mutex_lock(&pp->mutex);
+        if (!pp->go) {
+            pp->go = 1;
+            (void)pthread_cond_broadcast(&pp->cond);
+        }
+        while (pp->current >= pp->claimed || !u->done) {
+            (void)pthread_cond_wait(&pp->cond, &pp->mutex);
+        }
+        (void)pthread_mutex_unlock(&pp->mutex);
+    }
+
+    *ev = u->events[pp->pos++];
+    ev->line += pp->line_base;
+    if (ev->type == SIML_EVENT_STREAM_END || ev->type == SIML_EVENT_ERROR) {
+        pp->finished = 1;
+        pp->final = *ev;
+    } else if (pp->pos == u->count) {
+        /* Unit used up: hand its slot back to the workers. */
+        pp->line_base += u->lines;
+        pp->pos = 0;
+        (void)pthread_mutex_lock(&pp->mutex);
+        pp->current += 1;
+        (void)pthread_cond_broadcast(&pp->cond);
+        (void)pthread_mutex_unlock(&pp->mutex);
+    }
+    return ev->type;
+}
+
+#endif /* SIML_IMPLEMENTATION */
+
+#endif /* SIML_PARALLEL_H_INCLUDED */
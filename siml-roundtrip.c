@@ -1,237 +1,106 @@
+#define _DEFAULT_SOURCE
+
+#include <fcntl.h>
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #define SIML_IMPLEMENTATION
 #include "siml.h"
+#include "siml-io.h"
+
+/* Parses a file and writes it back out through siml_emitter. By default the
+ * text is compared with the source as it is emitted; -o writes it to a file
+ * or, for "-", to stdout instead.
+ */
+
+static char out_buf[65536];
 
-struct mem_reader {
+/* The source, compared with the emitted text piece by piece. A source that
+ * lacks its final newline is written back with it.
+ */
+struct compare {
     const char *data;
     size_t len;
     size_t pos;
+    size_t extra;   /* 1 if the text ends in one more LF than the source */
 };
 
-struct buffer {
-    char *data;
-    size_t len;
-    size_t cap;
-};
-
-static int siml_mem_read_line(void *userdata,
-                              const char **out_line,
-                              size_t *out_len) {
-    struct mem_reader *r;
-    size_t start;
-    size_t i;
-    int saw_lf;
-
-    r = (struct mem_reader *)userdata;
-    if (!r || !out_line || !out_len) {
-        return -1;
-    }
-    if (r->pos >= r->len) {
-        return 0;
-    }
-
-    start = r->pos;
-    i = start;
-    saw_lf = 0;
-    while (i < r->len && r->data[i] != '\n') {
-        i += 1;
-    }
-
-    if (i < r->len && r->data[i] == '\n') {
-        saw_lf = 1;
-    }
-    *out_line = r->data + start;
-    *out_len = i - start;
-    r->pos = (i < r->len) ? (i + 1) : i;
-    if (!saw_lf && r->pos >= r->len && *out_len > 0) {
-        return 2;
-    }
-    return 1;
-}
-
-static int buf_reserve(struct buffer *b, size_t extra) {
-    size_t needed;
-    size_t new_cap;
-    char *new_data;
-
-    if (!b) return 0;
-    needed = b->len + extra;
-    if (needed <= b->cap) return 1;
-    new_cap = b->cap ? b->cap : 256;
-    while (new_cap < needed) {
-        new_cap *= 2;
-    }
-    new_data = (char *)realloc(b->data, new_cap);
-    if (!new_data) return 0;
-    b->data = new_data;
-    b->cap = new_cap;
-    return 1;
-}
-
-static int buf_append(struct buffer *b, const char *s, size_t len) {
-    if (!buf_reserve(b, len)) return 0;
-    memcpy(b->data + b->len, s, len);
-    b->len += len;
-    return 1;
-}
-
-static int buf_append_char(struct buffer *b, char c) {
-    if (!buf_reserve(b, 1)) return 0;
-    b->data[b->len++] = c;
-    return 1;
-}
+static int compare_write(void *userdata, const siml_slice *pieces, int count) {
+    struct compare *c = (struct compare *)userdata;
+    int i;
 
-static int buf_append_spaces(struct buffer *b, size_t count) {
-    size_t i;
-    if (!buf_reserve(b, count)) return 0;
     for (i = 0; i < count; ++i) {
-        b->data[b->len++] = ' ';
-    }
-    return 1;
-}
-
-static int emit_inline_comment(struct buffer *b,
-                               unsigned int spaces,
-                               const siml_slice *comment) {
-    if (!comment || comment->len == 0) return 1;
-    if (!buf_append_spaces(b, (size_t)spaces)) return 0;
-    if (!buf_append(b, "# ", 2)) return 0;
-    if (!buf_append(b, comment->ptr, comment->len)) return 0;
-    return 1;
-}
-
-static int emit_line_end(struct buffer *b) {
-    return buf_append_char(b, '\n');
-}
-
-static int emit_prefix(struct buffer *b, size_t indent,
-                       const char *key, size_t key_len,
-                       int in_sequence, int has_inline_value) {
-    if (!buf_append_spaces(b, indent)) return 0;
-    if (in_sequence) {
-        if (!buf_append(b, "-", 1)) return 0;
-        if (has_inline_value) {
-            if (!buf_append(b, " ", 1)) return 0;
-        }
-        return 1;
-    }
-    if (!buf_append(b, key, key_len)) return 0;
-    if (has_inline_value) {
-        if (!buf_append(b, ": ", 2)) return 0;
-    } else {
-        if (!buf_append(b, ":", 1)) return 0;
-    }
-    return 1;
-}
-
-static int build_flow_sequence(siml_parser *parser,
-                               struct buffer *b,
-                               siml_event *ev) {
-    int first = 1;
-
-    if (!buf_append_char(b, '[')) return 0;
+        const char *s = pieces[i].ptr;
+        size_t n = pieces[i].len;
+        size_t m;
 
-    for (;;) {
-        siml_event_type t = siml_next(parser, ev);
-        if (t == SIML_EVENT_ERROR) {
-            return 0;
-        }
-        if (t == SIML_EVENT_SEQUENCE_END) {
-            if (!buf_append_char(b, ']')) return 0;
-            break;
-        }
-        if (t == SIML_EVENT_SEQUENCE_START) {
-            if (!first) {
-                if (!buf_append_char(b, ',')) return 0;
-            }
-            first = 0;
-            if (!build_flow_sequence(parser, b, ev)) return 0;
-            continue;
-        }
-        if (t == SIML_EVENT_SCALAR) {
-            if (!first) {
-                if (!buf_append_char(b, ',')) return 0;
-            }
-            first = 0;
-            if (!buf_append(b, ev->value.ptr, ev->value.len)) return 0;
-            continue;
-        }
-        return 0;
+        if (n == 0) continue;
+        if (n > c->len + c->extra - c->pos) return 0;
+        m = n < c->len - c->pos ? n : c->len - c->pos;
+        if (memcmp(c->data + c->pos, s, m) != 0) return 0;
+        if (m < n && s[m] != '\n') return 0;
+        c->pos += n;
     }
     return 1;
 }
 
 int main(int argc, char **argv) {
-    const char *filename;
-    FILE *fp;
-    long file_size;
-    size_t read_size;
-    char *file_data;
-    struct mem_reader reader;
-    struct buffer out;
+    const char *filename = NULL;
+    const char *out_path = NULL;
+    siml_mmap_reader reader;
     siml_parser parser;
+    siml_emitter emitter;
     siml_event ev;
+    struct compare cmp;
+    int fd = -1;
+    int argi;
     int rc;
-    size_t stack_indent[SIML_MAX_NESTING];
-    siml_container_type stack_type[SIML_MAX_NESTING];
-    size_t depth;
-    size_t cur_indent;
-    int in_sequence;
-
-    if (argc != 2) {
-        (void)fprintf(stderr, "Usage: %s <file.siml>\n", argv[0]);
-        return 1;
-    }
 
-    filename = argv[1];
-    fp = fopen(filename, "rb");
-    if (!fp) {
-        perror(filename);
-        return 1;
-    }
-    if (fseek(fp, 0, SEEK_END) != 0) {
-        perror(filename);
-        (void)fclose(fp);
-        return 1;
+    for (argi = 1; argi < argc; ++argi) {
+        if (strcmp(argv[argi], "-o") == 0 && argi + 1 < argc) {
+            out_path = argv[++argi];
+        } else if (argi + 1 == argc && argv[argi][0] != '-') {
+            filename = argv[argi];
+        } else {
+            break;
+        }
     }
-    file_size = ftell(fp);
-    if (file_size < 0) {
-        perror(filename);
-        (void)fclose(fp);
+    if (!filename) {
+        (void)fprintf(stderr,
+                      "Usage: %s [-o out] <file.siml>\n"
+                      "  -o writes the emitted text to out (- for stdout)\n"
+                      "     instead of comparing it with <file.siml>\n",
+                      argv[0]);
         return 1;
     }
-    if (fseek(fp, 0, SEEK_SET) != 0) {
+
+    if (!siml_mmap_reader_open(&reader, filename)) {
         perror(filename);
-        (void)fclose(fp);
         return 1;
     }
+    cmp.data = reader.mem.data;
+    cmp.len = reader.mem.len;
+    cmp.pos = 0;
+    cmp.extra = (cmp.len > 0 && cmp.data[cmp.len - 1] != '\n') ? 1 : 0;
 
-    file_data = (char *)malloc((size_t)file_size);
-    if (!file_data) {
-        (void)fclose(fp);
-        return 1;
-    }
-    read_size = fread(file_data, 1, (size_t)file_size, fp);
-    (void)fclose(fp);
-    if (read_size != (size_t)file_size) {
-        free(file_data);
-        return 1;
+    if (!out_path) {
+        siml_emitter_init(&emitter, out_buf, sizeof(out_buf), compare_write,
+                          &cmp);
+    } else {
+        fd = strcmp(out_path, "-") == 0
+                 ? 1
+                 : open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) {
+            perror(out_path);
+            siml_mmap_reader_close(&reader);
+            return 1;
+        }
+        siml_emitter_init(&emitter, out_buf, sizeof(out_buf), siml_fd_write,
+                          &fd);
     }
 
-    reader.data = file_data;
-    reader.len = read_size;
-    reader.pos = 0;
-
-    out.data = NULL;
-    out.len = 0;
-    out.cap = 0;
-
-    depth = 0;
-
-    siml_parser_init(&parser, siml_mem_read_line, &reader);
+    siml_parser_init_buffer(&parser, reader.mem.data, reader.mem.len);
 
     rc = 0;
     for (;;) {
@@ -243,184 +112,26 @@ int main(int argc, char **argv) {
             rc = 1;
             break;
         }
-        if (t == SIML_EVENT_STREAM_END) {
-            break;
-        }
-
-        in_sequence = (depth > 0 && stack_type[depth - 1] == SIML_CONTAINER_SEQ);
-        cur_indent = (depth > 0) ? stack_indent[depth - 1] : 0;
-
-        switch (t) {
-        case SIML_EVENT_STREAM_START:
-            break;
-        case SIML_EVENT_DOCUMENT_START:
-            break;
-        case SIML_EVENT_DOCUMENT_END:
-            if (parser.awaiting_document) {
-                if (!buf_append(&out, "---", 3) || !emit_line_end(&out)) {
-                    rc = 1;
-                }
-            }
-            break;
-        case SIML_EVENT_COMMENT:
-            if (!buf_append(&out, ev.value.ptr, ev.value.len) ||
-                !emit_line_end(&out)) {
-                rc = 1;
-            }
-            break;
-        case SIML_EVENT_MAPPING_START:
-            if (ev.key.len > 0 || in_sequence) {
-                if (!emit_prefix(&out, cur_indent,
-                                 ev.key.ptr, ev.key.len,
-                                 in_sequence, 0) ||
-                    !emit_line_end(&out)) {
-                    rc = 1;
-                }
-            }
-            if (depth >= SIML_MAX_NESTING) {
-                rc = 1;
-                break;
-            }
-            stack_type[depth] = SIML_CONTAINER_MAP;
-            stack_indent[depth] = (depth == 0) ? 0 : (cur_indent + 2);
-            depth += 1;
-            break;
-        case SIML_EVENT_SEQUENCE_START:
-            if (ev.seq_style == SIML_SEQ_STYLE_FLOW) {
-                struct buffer flow;
-                siml_slice key;
-                siml_slice comment;
-                unsigned int comment_spaces;
-                char key_buf[SIML_MAX_KEY_LEN + 1];
-                char comment_buf[SIML_MAX_INLINE_COMMENT_TEXT_LEN + 1];
-
-                key.len = ev.key.len;
-                if (key.len > SIML_MAX_KEY_LEN) key.len = SIML_MAX_KEY_LEN;
-                if (key.len > 0) {
-                    memcpy(key_buf, ev.key.ptr, key.len);
-                }
-                key.ptr = key_buf;
-                key_buf[key.len] = '\0';
-
-                comment.len = ev.inline_comment.len;
-                if (comment.len > SIML_MAX_INLINE_COMMENT_TEXT_LEN) {
-                    comment.len = SIML_MAX_INLINE_COMMENT_TEXT_LEN;
-                }
-                if (comment.len > 0) {
-                    memcpy(comment_buf, ev.inline_comment.ptr, comment.len);
-                }
-                comment.ptr = comment_buf;
-                comment_buf[comment.len] = '\0';
-                comment_spaces = ev.inline_comment_spaces;
-
-                flow.data = NULL;
-                flow.len = 0;
-                flow.cap = 0;
-                if (!build_flow_sequence(&parser, &flow, &ev)) {
-                    free(flow.data);
-                    rc = 1;
-                    break;
-                }
-                in_sequence = (depth > 0 &&
-                               stack_type[depth - 1] == SIML_CONTAINER_SEQ);
-                cur_indent = (depth > 0) ? stack_indent[depth - 1] : 0;
-                if (!emit_prefix(&out, cur_indent,
-                                 key.ptr, key.len,
-                                 in_sequence, 1) ||
-                    !buf_append(&out, flow.data, flow.len) ||
-                    !emit_inline_comment(&out, comment_spaces,
-                                         &comment) ||
-                    !emit_line_end(&out)) {
-                    free(flow.data);
-                    rc = 1;
-                    break;
-                }
-                free(flow.data);
-                break;
-            }
-
-            if (ev.key.len > 0 || in_sequence) {
-                if (!emit_prefix(&out, cur_indent,
-                                 ev.key.ptr, ev.key.len,
-                                 in_sequence, 0) ||
-                    !emit_line_end(&out)) {
-                    rc = 1;
-                }
-            }
-            if (depth >= SIML_MAX_NESTING) {
-                rc = 1;
-                break;
-            }
-            stack_type[depth] = SIML_CONTAINER_SEQ;
-            stack_indent[depth] = (depth == 0) ? 0 : (cur_indent + 2);
-            depth += 1;
-            break;
-        case SIML_EVENT_MAPPING_END:
-        case SIML_EVENT_SEQUENCE_END:
-            if (depth > 0) depth -= 1;
-            break;
-        case SIML_EVENT_SCALAR:
-            if (!emit_prefix(&out, cur_indent,
-                             ev.key.ptr, ev.key.len,
-                             in_sequence, 1) ||
-                !buf_append(&out, ev.value.ptr, ev.value.len) ||
-                !emit_inline_comment(&out, ev.inline_comment_spaces,
-                                     &ev.inline_comment) ||
-                !emit_line_end(&out)) {
-                rc = 1;
-            }
-            break;
-        case SIML_EVENT_BLOCK_SCALAR_START:
-            if (!emit_prefix(&out, cur_indent,
-                             ev.key.ptr, ev.key.len,
-                             in_sequence, 1) ||
-                !buf_append(&out, "|", 1) ||
-                !emit_inline_comment(&out, ev.inline_comment_spaces,
-                                     &ev.inline_comment) ||
-                !emit_line_end(&out)) {
-                rc = 1;
-            }
-            break;
-        case SIML_EVENT_BLOCK_SCALAR_LINE:
-            if (ev.value.len == 0) {
-                if (!emit_line_end(&out)) {
-                    rc = 1;
-                }
-            } else {
-                if (!buf_append_spaces(&out, cur_indent + 2) ||
-                    !buf_append(&out, ev.value.ptr, ev.value.len) ||
-                    !emit_line_end(&out)) {
-                    rc = 1;
-                }
-            }
-            break;
-        case SIML_EVENT_BLOCK_SCALAR_END:
-            break;
-        case SIML_EVENT_NONE:
-        case SIML_EVENT_ERROR:
-        default:
+        if (!siml_emit(&emitter, &ev)) {
             rc = 1;
             break;
         }
-
-        if (rc != 0) break;
+        if (t == SIML_EVENT_STREAM_END) break;
     }
 
-    if (rc == 0) {
-        if (read_size == 0) {
-            if (out.len != 0) rc = 1;
-        } else if (file_data[read_size - 1] != '\n' && out.len > 0 &&
-                   out.data[out.len - 1] == '\n') {
-            out.len -= 1;
-        }
-        if (out.len != read_size ||
-            (out.len > 0 && memcmp(out.data, file_data, out.len) != 0)) {
+    if (!out_path) {
+        if (emitter.failed || (rc == 0 && cmp.pos != cmp.len + cmp.extra)) {
             (void)fprintf(stderr, "roundtrip mismatch: %s\n", filename);
             rc = 1;
         }
+    } else {
+        if (emitter.failed) perror(out_path);
+        if (fd != 1 && close(fd) != 0 && rc == 0) {
+            perror(out_path);
+            rc = 1;
+        }
     }
 
-    free(out.data);
-    free(file_data);
+    siml_mmap_reader_close(&reader);
     return rc;
 }
@@ -7,7 +7,8 @@
  * Header-only, pure ANSI C89 implementation.
  *
  * - No dynamic allocation.
- * - No I/O. The caller provides a line-reading callback.
+ * - No I/O. The caller provides a line-reading callback, a complete buffer,
+ *   or pushes input chunks with siml_feed().
  * - Pull parser API: the caller repeatedly calls siml_next() to obtain events.
  */
 
@@ -25,6 +26,21 @@ extern "C" {
 #define SIML_MAX_NESTING 32
 #endif
 
+#ifndef SIML_MAX_SUBSCRIPTIONS
+#define SIML_MAX_SUBSCRIPTIONS 32
+#endif
+#if SIML_MAX_SUBSCRIPTIONS > 32
+#error "SIML_MAX_SUBSCRIPTIONS must fit the unsigned long subscription masks"
+#endif
+
+/* Segments of all subscription paths together */
+#ifndef SIML_MAX_SUB_SEGMENTS
+#define SIML_MAX_SUB_SEGMENTS 128
+#endif
+#if SIML_MAX_SUB_SEGMENTS > 255
+#error "SIML_MAX_SUB_SEGMENTS must fit the unsigned char segment offsets"
+#endif
+
 #ifndef SIML_MAX_LINE_LEN
 #define SIML_MAX_LINE_LEN 4608
 #endif
@@ -32,6 +48,9 @@ extern "C" {
 #ifndef SIML_MAX_INLINE_VALUE_LEN
 #define SIML_MAX_INLINE_VALUE_LEN 2048
 #endif
+#if SIML_MAX_INLINE_VALUE_LEN > 65535
+#error "SIML_MAX_INLINE_VALUE_LEN must fit the unsigned short flow tables"
+#endif
 
 #ifndef SIML_MAX_FLOW_ELEMENT_LEN
 #define SIML_MAX_FLOW_ELEMENT_LEN 128
@@ -53,6 +72,26 @@ extern "C" {
 #define SIML_MAX_BLOCK_LINE_LEN 4096
 #endif
 
+/* Default for siml_parser.validate_utf8. When enabled, every line is checked
+ * for well-formed UTF-8 (SPEC 3.1) and SIML_ERR_UTF8_INVALID is reported.
+ */
+#ifndef SIML_VALIDATE_UTF8
+#define SIML_VALIDATE_UTF8 0
+#endif
+
+/* Revision of what the parser accepts and reports, raised with every change
+ * to the outcome of a parse, so that stored outcomes (siml-cache.h) are not
+ * taken across it.
+ */
+#define SIML_PARSER_REVISION 2
+
+/* The SSE2, SSSE3 and AVX2 scanning paths are chosen at compile time from
+ * what the compiler targets (__SSE2__, __SSSE3__, __AVX2__); there is no
+ * runtime dispatch. Build with -mssse3 or -mavx2 (meson -Dsimd=ssse3 or
+ * avx2) to use the wider paths on CPUs that have them. Define SIML_NO_SIMD
+ * to force the portable scalar scanning code.
+ */
+
 /* Error codes */
 typedef enum siml_error_code {
     SIML_ERR_NONE = 0,
@@ -112,7 +151,8 @@ typedef enum siml_error_code {
     SIML_ERR_BLOCK_LEADING_BLANK,
     SIML_ERR_BLOCK_TRAILING_BLANK,
     SIML_ERR_BLOCK_LINE_TOO_LONG,
-    SIML_ERR_BLOCK_WHITESPACE_ONLY
+    SIML_ERR_BLOCK_WHITESPACE_ONLY,
+    SIML_ERR_UTF8_INVALID
 } siml_error_code;
 
 /* Event types for the pull parser */
@@ -131,7 +171,8 @@ typedef enum siml_event_type {
     SIML_EVENT_DOCUMENT_END,
     SIML_EVENT_STREAM_END,
     SIML_EVENT_COMMENT,
-    SIML_EVENT_ERROR
+    SIML_EVENT_ERROR,
+    SIML_EVENT_NEED_MORE  /* push input: feed another chunk, then call again */
 } siml_event_type;
 
 typedef enum siml_seq_style {
@@ -158,6 +199,26 @@ typedef int (*siml_read_line_fn)(void *userdata,
                                  const char **out_line,
                                  size_t *out_len);
 
+/* In-memory line reader ------------------------------------------------- */
+
+/* Reads lines from a caller-owned buffer. Lines point into the buffer.
+ *
+ * LF positions are found 32 bytes at a time and cached as a bitmask, so a run
+ * of short lines costs one vector compare rather than one scan per line.
+ */
+typedef struct siml_mem_reader_s {
+    const char  *data;
+    size_t       len;
+    size_t       pos;
+    size_t       scan;     /* bytes before this offset have been scanned */
+    unsigned int lf_mask;  /* unconsumed LFs in [scan - 32, scan) */
+} siml_mem_reader;
+
+void siml_mem_reader_init(siml_mem_reader *r, const char *data, size_t len);
+
+/* siml_read_line_fn over a siml_mem_reader. */
+int siml_mem_read_line(void *userdata, const char **out_line, size_t *out_len);
+
 /* Event structure filled by siml_next().
  *
  *  - key/value are empty slices for stream/document/container events.
@@ -178,6 +239,7 @@ typedef struct siml_event_s {
     long             line;                  /* 1-based physical line number */
     siml_error_code  error_code;
     const char      *error_message;         /* static string; never NULL for ERROR */
+    unsigned int     key_id;                /* siml_keytab id of key; 0 if none */
 } siml_event;
 
 /* Internal types */
@@ -187,6 +249,13 @@ typedef enum siml_mode_e {
     SIML_MODE_BLOCK
 } siml_mode;
 
+/* Where buffer input starts within its stream */
+typedef enum siml_resume_kind_e {
+    SIML_RESUME_NONE = 0,      /* at the start */
+    SIML_RESUME_SEPARATOR,     /* after a document separator line */
+    SIML_RESUME_ENTRY          /* at an indent-0 entry of the root node */
+} siml_resume_kind;
+
 typedef enum siml_container_type_e {
     SIML_CONTAINER_MAP = 0,
     SIML_CONTAINER_SEQ = 1
@@ -198,26 +267,128 @@ typedef struct siml_container_s {
     int                 item_count;
 } siml_container;
 
+/* Per-line descriptor, filled by one scan when a line is fetched. Positions
+ * equal the line length when the byte does not occur.
+ */
+typedef struct siml_line_info_s {
+    size_t indent;       /* leading spaces; first non-space byte */
+    size_t trimmed_len;  /* length without trailing spaces */
+    size_t tab_pos;      /* first '\t' */
+    size_t cr_pos;       /* first '\r' */
+    size_t colon_pos;    /* first ':' */
+    size_t hash_pos;     /* first '#' preceded by a space */
+    size_t non_ascii;    /* first byte >= 0x80 */
+} siml_line_info;
+
+/* 32-byte blocks in the stage-1 index window; any line short enough to be
+ * accepted fits in one window.
+ */
+#define SIML_INDEX_BLOCKS ((SIML_MAX_LINE_LEN + 64) / 32)
+
+/* Stage-1 structural index over a window of buffer input: one bit per byte
+ * for each class the line checks use. Offsets are relative to the buffer.
+ */
+typedef struct siml_index_s {
+    size_t       base;   /* first indexed byte, a multiple of 32 */
+    size_t       end;    /* one past the last indexed byte */
+    unsigned int lf[SIML_INDEX_BLOCKS];
+    unsigned int space[SIML_INDEX_BLOCKS];
+    unsigned int tab[SIML_INDEX_BLOCKS];
+    unsigned int cr[SIML_INDEX_BLOCKS];
+    unsigned int colon[SIML_INDEX_BLOCKS];
+    unsigned int hash[SIML_INDEX_BLOCKS];   /* '#' preceded by a space */
+    unsigned int high[SIML_INDEX_BLOCKS];
+    unsigned int delim[SIML_INDEX_BLOCKS];  /* '[', ']' and ',' */
+} siml_index;
+
+typedef enum siml_input_kind_e {
+    SIML_INPUT_CALLBACK = 0,
+    SIML_INPUT_BUFFER,
+    SIML_INPUT_PUSH
+} siml_input_kind;
+
 typedef enum siml_pending_kind_e {
     SIML_PENDING_NONE = 0,
     SIML_PENDING_MAP,
     SIML_PENDING_SEQ
 } siml_pending_kind;
 
+/* Key table: gives every distinct key a small id, 1 for the first key
+ * interned, 2 for the next, and so on. All storage is one block supplied by
+ * the caller; ids stay valid as long as the table does.
+ */
+typedef struct siml_keytab_entry_s {
+    unsigned int hash;
+    unsigned int len;
+    size_t       offset;        /* of the NUL-terminated text */
+} siml_keytab_entry;
+
+typedef struct siml_keytab_s {
+    unsigned int      *slots;   /* id per slot, 0 if empty */
+    unsigned int       mask;    /* slot count - 1 */
+    siml_keytab_entry *entries; /* entries[id - 1] */
+    unsigned int       count;
+    unsigned int       cap;
+    char              *text;
+    size_t             text_len;
+    size_t             text_cap;
+} siml_keytab;
+
+/* Segment of a subscription path: len bytes at off in the path, or any key
+ * or sequence item for len 0.
+ */
+typedef struct siml_sub_seg_s {
+    unsigned short off;
+    unsigned short len;
+} siml_sub_seg;
+
+/* How siml_skip() checks the lines it steps over. */
+typedef enum siml_skip_mode {
+    SIML_SKIP_VALIDATE = 0,  /* parse them; every error is reported */
+    SIML_SKIP_LINES,         /* line rules only: length, CR, BOM, UTF-8 */
+    SIML_SKIP_INDENT         /* indentation only */
+} siml_skip_mode;
+
 /* Parser state */
 typedef struct siml_parser_s {
+    /* Options; set after init, kept by reset */
+    int               validate_utf8; /* boolean, default SIML_VALIDATE_UTF8 */
+    const char *const *sub_paths;  /* siml_subscribe() */
+    int               sub_count;
+    siml_skip_mode    sub_mode;
+    /* Paths compiled by siml_subscribe(): path i has the segments
+     * sub_segs[sub_first[i]] up to sub_segs[sub_first[i + 1]].
+     */
+    siml_sub_seg      sub_segs[SIML_MAX_SUB_SEGMENTS];
+    unsigned char     sub_first[SIML_MAX_SUBSCRIPTIONS + 1];
+    siml_keytab      *keytab;        /* siml_parser_set_keytab() */
+
     /* User-supplied input */
+    siml_input_kind   input;
     siml_read_line_fn read_line;
     void             *userdata;
+    siml_mem_reader   buffer;      /* SIML_INPUT_BUFFER; current PUSH chunk */
+    union {
+        siml_index    index;       /* SIML_INPUT_BUFFER */
+        char          hold_buf[SIML_MAX_LINE_LEN];  /* PUSH: see cr_held */
+    } u;
+    siml_resume_kind  resume;      /* SIML_INPUT_BUFFER */
+    long              line_base;   /* SIML_INPUT_BUFFER: lines before data */
+    int               feed_done;   /* boolean, SIML_INPUT_PUSH */
 
     /* Current physical line */
     const char       *line;
     size_t            line_len;
     long              line_no;
+    siml_line_info    info;
     int               have_line;   /* boolean */
     int               at_eof;      /* boolean */
     int               have_peek;   /* boolean */
-    size_t            peek_len;
+    size_t            peek_len;    /* PUSH: partial line carried over chunks */
+    int               cr_held;     /* PUSH: boolean: hold_buf has a line
+                                    * ending in CR, hold_len bytes, that
+                                    * waits for the line after it */
+    size_t            hold_len;
     char              peek_buf[SIML_MAX_LINE_LEN + 1];
     siml_error_code   line_cr_code;
 
@@ -233,11 +404,22 @@ typedef struct siml_parser_s {
     /* Container stack */
     siml_container    stack[SIML_MAX_NESTING];
     int               depth;
+    int               skip_depth;  /* siml_skip() draining to this depth */
+
+    /* Subscription filter: nesting of the innermost reported node, the
+     * subscriptions still matching below each level, and the level of the
+     * matched node being reported whole.
+     */
+    int               sub_level;
+    int               sub_match_level;
+    int               sub_skipping;  /* boolean: skipping an unmatched node */
+    unsigned long     sub_mask[SIML_MAX_NESTING + 1];
 
     /* Pending header-only value */
     siml_pending_kind pending_kind;
     size_t            pending_indent;
-    char              pending_key[SIML_MAX_KEY_LEN + 1];
+    const char       *pending_key;
+    char              pending_key_buf[SIML_MAX_KEY_LEN + 1];
     size_t            pending_key_len;
 
     /* Pending end/start events */
@@ -248,7 +430,8 @@ typedef struct siml_parser_s {
     int               pending_container_start;
     siml_container_type pending_container_type;
     siml_seq_style    pending_seq_style;
-    char              pending_container_key[SIML_MAX_KEY_LEN + 1];
+    const char       *pending_container_key;
+    char              pending_container_key_buf[SIML_MAX_KEY_LEN + 1];
     size_t            pending_container_key_len;
     int               pending_stream_end;
 
@@ -258,7 +441,16 @@ typedef struct siml_parser_s {
     size_t            flow_stack_end[SIML_MAX_NESTING];
     size_t            flow_stack_pos[SIML_MAX_NESTING];
     int               flow_stack_started[SIML_MAX_NESTING];
-    char              flow_key[SIML_MAX_KEY_LEN + 1];
+    /* Flow value tables built by one pass over the value, offsets relative
+     * to its start: the '[', ']' and ',' bitmap, and for the n-th '[' the
+     * offset of its matching ']'. A balanced value has at most half its
+     * length in '['.
+     */
+    unsigned int      flow_delims[(SIML_MAX_INLINE_VALUE_LEN + 31) / 32];
+    unsigned short    flow_match[SIML_MAX_INLINE_VALUE_LEN / 2];
+    size_t            flow_next_open;
+    const char       *flow_key;
+    char              flow_key_buf[SIML_MAX_KEY_LEN + 1];
     size_t            flow_key_len;
     unsigned int      flow_inline_spaces;
     const char       *flow_inline_comment;
@@ -266,7 +458,8 @@ typedef struct siml_parser_s {
 
     /* Block scalar parsing state */
     size_t            block_indent;
-    char              block_key[SIML_MAX_KEY_LEN + 1];
+    const char       *block_key;
+    char              block_key_buf[SIML_MAX_KEY_LEN + 1];
     size_t            block_key_len;
     unsigned int      block_inline_spaces;
     const char       *block_inline_comment;
@@ -291,15 +484,288 @@ void siml_parser_init(siml_parser *p,
                       siml_read_line_fn read_line,
                       void *userdata);
 
-/* Reset parser to initial state but keep the same read callback and userdata. */
+/* Initialize parser over a complete in-memory stream of len bytes.
+ *
+ * Lines are split inline without the read callback. Since the input outlives
+ * every event, all event slices (including keys) point into data; it must
+ * stay valid for as long as events are used.
+ */
+void siml_parser_init_buffer(siml_parser *p, const char *data, size_t len);
+
+/* Initialize a buffer parser over the part of a stream that follows a
+ * document separator line. No STREAM_START is emitted; events and errors are
+ * those a parser of the whole stream would report after the separator, with
+ * line numbers counted from the start of data. Lets independent parsers
+ * handle the documents of one stream.
+ */
+void siml_parser_init_buffer_resume(siml_parser *p, const char *data,
+                                    size_t len);
+
+/* Initialize a buffer parser over the part of a document that starts with a
+ * top-level entry: an indent-0 key or "- " line that is not the document's
+ * first line. The root container is taken to be open, of the kind of that
+ * line, so no STREAM_START, DOCUMENT_START or root container start is
+ * emitted. Line numbers count from the start of data. Lets independent
+ * parsers handle parts of one large document.
+ */
+void siml_parser_init_buffer_entry(siml_parser *p, const char *data,
+                                   size_t len);
+
+/* Initialize a buffer parser at the start of a document, as recorded by a
+ * document index: data is either the start of the stream (line 1) or the
+ * line after a separator, and that line is line number line of the stream.
+ * Events and errors are those a parser of the whole stream would report from
+ * there on, with the same line numbers. A caller reading one document stops
+ * at its DOCUMENT_END.
+ */
+void siml_parser_init_buffer_at(siml_parser *p, const char *data, size_t len,
+                                long line);
+
+/* Initialize parser for push input. The stream is supplied in chunks of any
+ * size with siml_feed() and terminated with siml_feed_end().
+ */
+void siml_parser_init_push(siml_parser *p);
+
+/* Supply the next chunk of a push stream. Returns 1 on success, 0 if the
+ * previous chunk has not been consumed yet or the stream was already ended.
+ *
+ * Complete lines are parsed in place, so data must stay valid until
+ * siml_next() returns SIML_EVENT_NEED_MORE. Only a line that straddles two
+ * chunks is copied (at most SIML_MAX_LINE_LEN + 1 bytes).
+ */
+int siml_feed(siml_parser *p, const char *data, size_t len);
+
+/* Mark the end of a push stream. */
+void siml_feed_end(siml_parser *p);
+
+/* Reset parser to initial state but keep the same input. A buffer parser
+ * rewinds to the start of its buffer; a push parser drops buffered input and
+ * waits for siml_feed() again.
+ */
 void siml_parser_reset(siml_parser *p);
 
 /* Main pull API: obtain the next event from the stream.
  *
- * Errors are reported as SIML_EVENT_ERROR.
+ * Errors are reported as SIML_EVENT_ERROR. A push parser that has consumed
+ * its chunk returns SIML_EVENT_NEED_MORE without changing state; it never
+ * blocks.
  */
 siml_event_type siml_next(siml_parser *p, siml_event *ev);
 
+/* Skip the rest of the innermost open node (a mapping or sequence whose
+ * START was returned, or a block scalar) and return its END event.
+ *
+ * Except with SIML_SKIP_VALIDATE, nested events are never produced: block
+ * nodes end at the first line indented less than their items, which
+ * canonical indentation makes exact. Errors inside the skipped lines beyond
+ * those of mode go unreported. With nothing open, this is siml_next(). A
+ * push parser may return SIML_EVENT_NEED_MORE; feed it and call siml_skip()
+ * again.
+ */
+siml_event_type siml_skip(siml_parser *p, siml_event *ev, siml_skip_mode mode);
+
+/* Report only the nodes at the given key paths, with everything below them,
+ * plus the mappings and sequences that lead to them; other nodes are skipped
+ * inside siml_next() as siml_skip() does with mode. Stream and document
+ * events are always reported.
+ *
+ * A path is a list of keys below the document root joined by '.'; the
+ * segment "*" matches any key or sequence item, so "range.*" reports the
+ * children of range together with the range mapping itself. [key] is a key
+ * taken literally, so a key that contains '.' can be named: "[range.min]",
+ * "limits[range.min]". Unlike siml_path_compile() (siml-dom.h) there are no
+ * [n] item steps; "*" stands for items. The paths are compiled here, not
+ * copied, and must outlive the parser; they are kept by reset. Returns 0
+ * for more than SIML_MAX_SUBSCRIPTIONS paths, more than
+ * SIML_MAX_SUB_SEGMENTS segments in all, or a malformed path (an empty
+ * segment, unbalanced brackets, or [ followed by a digit). A count of 0
+ * reports everything again.
+ */
+int siml_subscribe(siml_parser *p, const char *const *paths, int count,
+                   siml_skip_mode mode);
+
+/* Lay a key table out in size bytes at mem, which must be aligned for a
+ * size_t; about SIML_KEYTAB_KEY_BYTES per key. Returns 0 if size is too
+ * small.
+ */
+int siml_keytab_init(siml_keytab *t, void *mem, size_t size);
+
+/* Bytes per key of siml_keytab_init(), and a size that surely holds n keys
+ * of text bytes in all (NULs included): rounding the slots to a power of
+ * two can halve the keys, and entries and slots take at most half the
+ * memory, the text the rest.
+ */
+#define SIML_KEYTAB_KEY_BYTES 48
+#define SIML_KEYTAB_SIZE(n, text) \
+    (2 * SIML_KEYTAB_KEY_BYTES * (size_t)(n) + 2 * (size_t)(text))
+
+/* Id of a key, adding it if new. Returns 0 once the table is full. */
+unsigned int siml_keytab_intern(siml_keytab *t, const char *key, size_t len);
+
+/* Id of a key already in the table, or 0. */
+unsigned int siml_keytab_find(const siml_keytab *t, const char *key,
+                              size_t len);
+
+/* Text of id; an empty slice for an unknown id. */
+siml_slice siml_keytab_key(const siml_keytab *t, unsigned int id);
+
+/* Intern the key of every event p reports into t and set ev->key_id. Keys
+ * held across lines of a push or callback parser then point into t instead
+ * of being copied. Pass 0 to detach; kept by reset. The table may be shared
+ * by parsers used one after another, not at the same time.
+ */
+void siml_parser_set_keytab(siml_parser *p, siml_keytab *t);
+
+/* Event tape ------------------------------------------------------------
+ *
+ * A tape is the event stream of a buffer parser in compact form: one type
+ * byte per event, then varint line delta, slice offsets and lengths into the
+ * source buffer, and inline comment spacing. Replaying it yields the same
+ * events as parsing the source again, without re-validating it.
+ *
+ * A tape starts with a header that records the source length and content
+ * hash, SIML_PARSER_REVISION, the SIML_MAX_* limits and validate_utf8;
+ * siml_tape_reader_init() rejects it for any other source, or for a parse
+ * that could report other events.
+ */
+
+/* Upper bound on the bytes written by one siml_tape_write_header() or
+ * siml_tape_write() call.
+ */
+#define SIML_TAPE_MAX_RECORD 320
+
+typedef struct siml_tape_writer_s {
+    int           validate_utf8; /* boolean: that of the parser recorded */
+    const char   *base;       /* source buffer */
+    size_t        len;
+    size_t        pos;        /* end of the previous slice */
+    long          line;       /* line of the previous event */
+} siml_tape_writer;
+
+typedef struct siml_tape_reader_s {
+    const char   *base;       /* source buffer */
+    size_t        len;
+    const unsigned char *cur; /* next record */
+    const unsigned char *end;
+    size_t        pos;
+    long          line;
+    int           done;       /* boolean: final is repeated */
+    siml_event    final;
+} siml_tape_reader;
+
+/* Start a tape for the source buffer data of len bytes; validate_utf8 is
+ * SIML_VALIDATE_UTF8 until the caller sets that of its parser.
+ */
+void siml_tape_writer_init(siml_tape_writer *w, const char *data, size_t len);
+
+/* Write the tape header to out. Returns the number of bytes written. */
+size_t siml_tape_write_header(siml_tape_writer *w, char *out);
+
+/* Append the event that siml_next() returned as t to out. Returns the number
+ * of bytes written, or 0 if a slice of ev does not point into the source
+ * (events of a non-buffer parser cannot be recorded).
+ */
+size_t siml_tape_write(siml_tape_writer *w, siml_event_type t,
+                       const siml_event *ev, char *out);
+
+/* Start replaying tape (tape_len bytes) against its source buffer, for a
+ * parse with the given validate_utf8. Returns 1 on success, 0 if the header
+ * is missing or was written for another source, parser revision, limits or
+ * validate_utf8.
+ */
+int siml_tape_reader_init(siml_tape_reader *r, const char *tape,
+                          size_t tape_len, const char *data, size_t len,
+                          int validate_utf8);
+
+/* Replay the next event; the same contract as siml_next(). Slices point into
+ * the source, error messages into the tape. A damaged tape ends with an
+ * SIML_ERR_IO error.
+ */
+siml_event_type siml_tape_next(siml_tape_reader *r, siml_event *ev);
+
+/* Emitter ---------------------------------------------------------------
+ *
+ * Writes SIML text from the events siml_next() reports or from direct
+ * calls, with two-space indentation, flow sequences on one line, and
+ * comments and inline comment spacing kept. Source in that layout is
+ * written back byte for byte.
+ *
+ * Text collects in a buffer the caller provides. When it is full, the
+ * write callback gets it; a value too long to buffer is handed over in the
+ * same call, after the buffered text, rather than copied. The emitter
+ * never allocates, and keeps no pointer into the events it is given.
+ *
+ * Documents are separated by "---" when the next document or a comment
+ * follows a document end, which is where a parser reports the separator.
+ */
+
+/* Write callback: write count pieces, in order and in full. Must return 1
+ * on success, 0 on failure.
+ */
+typedef int (*siml_write_fn)(void *userdata,
+                             const siml_slice *pieces,
+                             int count);
+
+typedef struct siml_emitter_s {
+    char          *buf;
+    size_t         cap;
+    size_t         len;           /* bytes buffered */
+    siml_write_fn  write;
+    void          *userdata;
+    unsigned char  stack[SIML_MAX_NESTING]; /* siml_container_type */
+    int            depth;
+    int            flow;          /* open flow sequences */
+    int            flow_first;    /* boolean: no item yet at this flow level */
+    int            document_end;  /* boolean: a separator goes before more */
+    int            failed;        /* boolean: every call fails from now on */
+    unsigned int   comment_spaces; /* pending inline comment */
+    size_t         comment_len;   /* 0 if none is pending */
+    char           comment[SIML_MAX_INLINE_COMMENT_TEXT_LEN];
+} siml_emitter;
+
+/* Set up e to write through write(userdata, ...), buffering up to cap bytes
+ * at buf. A cap of 0 hands every piece to the callback as it comes.
+ */
+void siml_emitter_init(siml_emitter *e, char *buf, size_t cap,
+                       siml_write_fn write, void *userdata);
+
+/* Write event ev as siml_next() reported it. Stream events write nothing;
+ * SIML_EVENT_STREAM_END flushes. Returns 1, or 0 for SIML_EVENT_ERROR, when
+ * the callback failed, and for an event that does not fit what came before
+ * (such as a mapping in a flow sequence or nesting past SIML_MAX_NESTING);
+ * after the last two, every call fails.
+ */
+int siml_emit(siml_emitter *e, const siml_event *ev);
+
+/* Direct calls, with the same results. A key is ignored for the items of a
+ * sequence; siml_emit_end() closes the innermost mapping or sequence.
+ */
+int siml_emit_document_start(siml_emitter *e);
+int siml_emit_document_end(siml_emitter *e);
+int siml_emit_mapping_start(siml_emitter *e, const char *key, size_t key_len);
+int siml_emit_sequence_start(siml_emitter *e, const char *key, size_t key_len,
+                             siml_seq_style style);
+int siml_emit_end(siml_emitter *e);
+int siml_emit_scalar(siml_emitter *e, const char *key, size_t key_len,
+                     const char *value, size_t value_len);
+int siml_emit_block_scalar_start(siml_emitter *e, const char *key,
+                                 size_t key_len);
+int siml_emit_block_scalar_line(siml_emitter *e, const char *text,
+                                size_t len);
+
+/* Write a comment line; text is the whole line, from its first byte. */
+int siml_emit_comment(siml_emitter *e, const char *text, size_t len);
+
+/* End the line of the next scalar, block scalar or flow sequence with
+ * "# text" after spaces spaces. text is copied, up to
+ * SIML_MAX_INLINE_COMMENT_TEXT_LEN bytes.
+ */
+int siml_emit_inline_comment(siml_emitter *e, unsigned int spaces,
+                             const char *text, size_t len);
+
+/* Hand the buffered text to the callback. Returns 1, or 0 when it failed. */
+int siml_emit_flush(siml_emitter *e);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -307,28 +773,528 @@ siml_event_type siml_next(siml_parser *p, siml_event *ev);
 /* ---------------- Implementation ---------------- */
 #ifdef SIML_IMPLEMENTATION
 
-#include <string.h> /* memcpy */
+#include <string.h> /* memcpy, memchr */
+
+#if !defined(SIML_NO_SIMD) && defined(__SSE2__)
+#define SIML_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+#if !defined(SIML_NO_SIMD) && defined(__SSSE3__)
+#define SIML_HAVE_SSSE3 1
+#include <tmmintrin.h>
+#endif
+#if !defined(SIML_NO_SIMD) && defined(__AVX2__)
+#define SIML_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
 
 /* Internal helpers ------------------------------------------------------ */
 
-static int siml_is_alpha(char c) {
-    return ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'));
+/* Helpers shared with the companion headers; a translation unit that
+ * includes none of them may not use every one.
+ */
+#if defined(__GNUC__)
+#define SIML_SHARED __attribute__((unused))
+#else
+#define SIML_SHARED
+#endif
+
+/* 32-bit little-endian words, as tapes and the companion headers' images
+ * store their numbers.
+ */
+static SIML_SHARED unsigned long siml_get32(const unsigned char *in) {
+    return (unsigned long)in[0] | ((unsigned long)in[1] << 8) |
+           ((unsigned long)in[2] << 16) | ((unsigned long)in[3] << 24);
 }
 
-static int siml_is_digit(char c) {
-    return (c >= '0' && c <= '9');
+static SIML_SHARED void siml_put32(unsigned char *out, unsigned long v) {
+    out[0] = (unsigned char)(v & 0xFF);
+    out[1] = (unsigned char)((v >> 8) & 0xFF);
+    out[2] = (unsigned char)((v >> 16) & 0xFF);
+    out[3] = (unsigned char)((v >> 24) & 0xFF);
 }
 
-static int siml_is_key_char(char c) {
-    return siml_is_alpha(c) || siml_is_digit(c) || c == '_' || c == '-' || c == '.';
+/* 32-bit FNV-1a, the key hash of the companion headers' lookup tables. */
+static SIML_SHARED unsigned long siml_fnv1a(const char *s, size_t len) {
+    unsigned long h = 2166136261ul;
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        h = ((h ^ (unsigned char)s[i]) * 16777619ul) & 0xFFFFFFFFul;
+    }
+    return h;
 }
 
-static int siml_is_space_only(const char *s, size_t len) {
+static unsigned int siml_ctz(unsigned int m) {
+#if defined(__GNUC__)
+    return (unsigned int)__builtin_ctz(m);
+#else
+    unsigned int n = 0;
+    while ((m & 1u) == 0) {
+        m >>= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+#if defined(SIML_HAVE_SSE2)
+/* Bitmask of the LF bytes in the 32 bytes at s. */
+static unsigned int siml_lf_mask32(const char *s) {
+#if defined(SIML_HAVE_AVX2)
+    return (unsigned int)_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)s),
+                          _mm256_set1_epi8('\n')));
+#else
+    const __m128i lf = _mm_set1_epi8('\n');
+    unsigned int lo = (unsigned int)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)s), lf));
+    unsigned int hi = (unsigned int)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s + 16)), lf));
+    return lo | (hi << 16);
+#endif
+}
+#endif
+
+/* Return a pointer to the first LF in [s, end), or NULL if there is none. */
+static const char *siml_find_lf(const char *s, const char *end) {
+#if defined(SIML_HAVE_SSE2)
+    while (end - s >= 32) {
+        unsigned int m = siml_lf_mask32(s);
+        if (m != 0) return s + siml_ctz(m);
+        s += 32;
+    }
+    while (s < end) {
+        if (*s == '\n') return s;
+        ++s;
+    }
+    return 0;
+#else
+    if (s >= end) return 0;
+    return (const char *)memchr(s, '\n', (size_t)(end - s));
+#endif
+}
+
+#if defined(SIML_HAVE_SSE2)
+static unsigned int siml_bsr(unsigned int m) {
+#if defined(__GNUC__)
+    return 31u - (unsigned int)__builtin_clz(m);
+#else
+    unsigned int n = 31;
+    while ((m & 0x80000000u) == 0) {
+        m <<= 1;
+        --n;
+    }
+    return n;
+#endif
+}
+
+/* Bitmasks of the bytes in the 32 bytes at s that the line checks care
+ * about. The block is loaded once and compared against each class.
+ */
+typedef struct siml_masks32_s {
+    unsigned int space;
+    unsigned int tab;
+    unsigned int cr;
+    unsigned int colon;
+    unsigned int hash;
+    unsigned int high;   /* bytes >= 0x80 */
+    unsigned int lf;
+    unsigned int delim;  /* '[', ']' and ',' */
+} siml_masks32;
+
+static void siml_classify32(const char *s, siml_masks32 *m) {
+#if defined(SIML_HAVE_AVX2)
+    const __m256i v = _mm256_loadu_si256((const __m256i *)s);
+    m->high = (unsigned int)_mm256_movemask_epi8(v);
+#define SIML_EQ32(c) \
+    ((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))))
+#else
+    const __m128i lo = _mm_loadu_si128((const __m128i *)s);
+    const __m128i hi = _mm_loadu_si128((const __m128i *)(s + 16));
+    m->high = (unsigned int)_mm_movemask_epi8(lo) |
+              ((unsigned int)_mm_movemask_epi8(hi) << 16);
+#define SIML_EQ32(c) \
+    ((unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(lo, _mm_set1_epi8(c))) | \
+     ((unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(hi, _mm_set1_epi8(c))) << 16))
+#endif
+    m->space = SIML_EQ32(' ');
+    m->tab   = SIML_EQ32('\t');
+    m->cr    = SIML_EQ32('\r');
+    m->colon = SIML_EQ32(':');
+    m->hash  = SIML_EQ32('#');
+    m->lf    = SIML_EQ32('\n');
+    m->delim = SIML_EQ32('[') | SIML_EQ32(']') | SIML_EQ32(',');
+#undef SIML_EQ32
+}
+
+/* Whitespace and flow delimiter ('[', ']', ',') bitmasks of 32 bytes. */
+static void siml_flow_classify32(const char *s, unsigned int *ws,
+                                 unsigned int *delim) {
+#if defined(SIML_HAVE_AVX2)
+    const __m256i v = _mm256_loadu_si256((const __m256i *)s);
+    *ws = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))));
+    *delim = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('[')),
+                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(']'))),
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','))));
+#else
+    const __m128i lo = _mm_loadu_si128((const __m128i *)s);
+    const __m128i hi = _mm_loadu_si128((const __m128i *)(s + 16));
+#define SIML_WS16(v) \
+    ((unsigned int)_mm_movemask_epi8(_mm_or_si128( \
+        _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), \
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')))))
+#define SIML_DELIM16(v) \
+    ((unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128( \
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('[')), \
+        _mm_cmpeq_epi8(v, _mm_set1_epi8(']'))), \
+        _mm_cmpeq_epi8(v, _mm_set1_epi8(',')))))
+    *ws = SIML_WS16(lo) | (SIML_WS16(hi) << 16);
+    *delim = SIML_DELIM16(lo) | (SIML_DELIM16(hi) << 16);
+#undef SIML_WS16
+#undef SIML_DELIM16
+#endif
+}
+#endif
+
+/* Fill the line descriptor in a single pass over the line. */
+static void siml_scan_line(siml_line_info *li, const char *s, size_t len) {
+#if defined(SIML_HAVE_SSE2)
+    char tail[32];
+    size_t base;
+    unsigned int prev_space = 0;
+#else
     size_t i;
+#endif
+
+    li->indent      = len;
+    li->trimmed_len = 0;
+    li->tab_pos     = len;
+    li->cr_pos      = len;
+    li->colon_pos   = len;
+    li->hash_pos    = len;
+    li->non_ascii   = len;
+
+#if defined(SIML_HAVE_SSE2)
+    for (base = 0; base < len; base += 32) {
+        siml_masks32 m;
+        unsigned int valid = 0xFFFFFFFFu;
+        unsigned int bits;
+
+        if (len - base < 32) {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, s + base, len - base);
+            valid = (1u << (len - base)) - 1u;
+            siml_classify32(tail, &m);
+        } else {
+            siml_classify32(s + base, &m);
+        }
+
+        bits = ~m.space & valid;
+        if (bits != 0) {
+            if (li->indent == len) li->indent = base + siml_ctz(bits);
+            li->trimmed_len = base + siml_bsr(bits) + 1;
+        }
+        if (li->tab_pos == len && m.tab != 0) {
+            li->tab_pos = base + siml_ctz(m.tab);
+        }
+        if (li->cr_pos == len && m.cr != 0) {
+            li->cr_pos = base + siml_ctz(m.cr);
+        }
+        if (li->colon_pos == len && m.colon != 0) {
+            li->colon_pos = base + siml_ctz(m.colon);
+        }
+        if (li->hash_pos == len) {
+            bits = m.hash & ((m.space << 1) | prev_space);
+            if (bits != 0) li->hash_pos = base + siml_ctz(bits);
+        }
+        if (li->non_ascii == len && m.high != 0) {
+            li->non_ascii = base + siml_ctz(m.high);
+        }
+        prev_space = m.space >> 31;
+    }
+#else
     for (i = 0; i < len; ++i) {
-        if (s[i] != ' ') return 0;
+        char c = s[i];
+        if (c == ' ') continue;
+        if (li->indent == len) li->indent = i;
+        li->trimmed_len = i + 1;
+        if ((unsigned char)c >= 0x80) {
+            if (li->non_ascii == len) li->non_ascii = i;
+        } else if (c == '\t') {
+            if (li->tab_pos == len) li->tab_pos = i;
+        } else if (c == '\r') {
+            if (li->cr_pos == len) li->cr_pos = i;
+        } else if (c == ':') {
+            if (li->colon_pos == len) li->colon_pos = i;
+        } else if (c == '#') {
+            if (li->hash_pos == len && i > 0 && s[i - 1] == ' ') {
+                li->hash_pos = i;
+            }
+        }
+    }
+#endif
+}
+
+#if defined(SIML_HAVE_SSE2)
+/* Index the window of blocks starting with the one that holds pos. */
+static void siml_index_fill(siml_index *x, const char *data, size_t len,
+                            size_t pos) {
+    size_t base = pos - pos % 32;
+    size_t k;
+    unsigned int prev_space = 0;
+
+    if (base > 0 && data[base - 1] == ' ') prev_space = 1;
+    x->base = base;
+    for (k = 0; k < SIML_INDEX_BLOCKS && base < len; ++k, base += 32) {
+        siml_masks32 m;
+        if (len - base < 32) {
+            char tail[32];
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, data + base, len - base);
+            siml_classify32(tail, &m);
+        } else {
+            siml_classify32(data + base, &m);
+        }
+        x->lf[k]    = m.lf;
+        x->space[k] = m.space;
+        x->tab[k]   = m.tab;
+        x->cr[k]    = m.cr;
+        x->colon[k] = m.colon;
+        x->hash[k]  = m.hash & ((m.space << 1) | prev_space);
+        x->high[k]  = m.high;
+        x->delim[k] = m.delim;
+        prev_space = m.space >> 31;
+    }
+    x->end = base < len ? base : len;
+}
+
+/* First set bit of bm in [a, b), or b. Offsets are window-relative. */
+static size_t siml_bits_first(const unsigned int *bm, size_t a, size_t b) {
+    size_t w = a / 32;
+    unsigned int m;
+
+    if (a >= b) return b;
+    m = bm[w] & (0xFFFFFFFFu << (a % 32));
+    while (m == 0) {
+        if (++w * 32 >= b) return b;
+        m = bm[w];
+    }
+    a = w * 32 + siml_ctz(m);
+    return a < b ? a : b;
+}
+
+/* Fill the line descriptor for window bytes [a, b) from the index, one
+ * word of every class at a time.
+ */
+static void siml_index_describe(const siml_index *x, siml_line_info *li,
+                                size_t a, size_t b) {
+    size_t len = b - a;
+    size_t w = a / 32;
+    size_t last_w = (b - 1) / 32;
+    unsigned int lo = 0xFFFFFFFFu << (a % 32);
+
+    li->indent      = len;
+    li->trimmed_len = 0;
+    li->tab_pos     = len;
+    li->cr_pos      = len;
+    li->colon_pos   = len;
+    li->hash_pos    = len;
+    li->non_ascii   = len;
+    if (len == 0) return;
+
+    for (; w <= last_w; ++w, lo = 0xFFFFFFFFu) {
+        size_t top = b - w * 32;
+        unsigned int valid = lo & (top >= 32 ? 0xFFFFFFFFu : (1u << top) - 1u);
+        size_t off = w * 32 - a;   /* may wrap; only used with a set bit */
+        unsigned int m;
+
+        m = ~x->space[w] & valid;
+        if (m != 0) {
+            if (li->indent == len) li->indent = off + siml_ctz(m);
+            li->trimmed_len = off + siml_bsr(m) + 1;
+        }
+        m = x->tab[w] & valid;
+        if (m != 0 && li->tab_pos == len) li->tab_pos = off + siml_ctz(m);
+        m = x->cr[w] & valid;
+        if (m != 0 && li->cr_pos == len) li->cr_pos = off + siml_ctz(m);
+        m = x->colon[w] & valid;
+        if (m != 0 && li->colon_pos == len) li->colon_pos = off + siml_ctz(m);
+        m = x->hash[w] & valid;
+        if (m != 0 && li->hash_pos == len) li->hash_pos = off + siml_ctz(m);
+        m = x->high[w] & valid;
+        if (m != 0 && li->non_ascii == len) li->non_ascii = off + siml_ctz(m);
+    }
+}
+#endif
+
+/* UTF-8 validation tables. Bytes map to classes:
+ *   0 00..7F, 1 80..8F, 2 90..9F, 3 A0..BF, 4 C2..DF, 5 E0, 6 E1..EC EE..EF,
+ *   7 ED, 8 F0, 9 F1..F3, 10 F4, 11 C0 C1 F5..FF.
+ * A lead byte's class gives the sequence length (0 if it cannot start one)
+ * and the allowed range of the second byte, which rules out overlong forms,
+ * surrogates and code points above U+10FFFF.
+ */
+static const unsigned char siml_utf8_class[256] = {
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+     1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+     2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+     3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+     3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    11,11, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+     4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+     5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 7, 6, 6,
+     8, 9, 9, 9,10,11,11,11,11,11,11,11,11,11,11,11
+};
+
+static const unsigned char siml_utf8_len[12] = {
+    1, 0, 0, 0, 2, 3, 3, 3, 4, 4, 4, 0
+};
+
+static const unsigned char siml_utf8_lo[12] = {
+    0, 0, 0, 0, 0x80, 0xA0, 0x80, 0x80, 0x90, 0x80, 0x80, 0
+};
+
+static const unsigned char siml_utf8_hi[12] = {
+    0, 0, 0, 0, 0xBF, 0xBF, 0xBF, 0x9F, 0xBF, 0xBF, 0x8F, 0
+};
+
+#if defined(SIML_HAVE_SSSE3)
+/* Vectorized lookup validation of 16 bytes (Keiser and Lemire, "Validating
+ * UTF-8 in less than one instruction per byte"). Each pair of adjacent bytes
+ * is classified by three 16-entry nibble tables; a set bit in the result
+ * marks an error. prev holds the preceding 16 bytes.
+ */
+static __m128i siml_utf8_check16(__m128i in, __m128i prev) {
+    const __m128i nib = _mm_set1_epi8(0x0F);
+    const __m128i prev1 = _mm_alignr_epi8(in, prev, 15);
+    const __m128i prev2 = _mm_alignr_epi8(in, prev, 14);
+    const __m128i prev3 = _mm_alignr_epi8(in, prev, 13);
+    /* 0x01 too short, 0x02 too long, 0x04 overlong 3, 0x08 too large,
+     * 0x10 surrogate, 0x20 overlong 2, 0x40 too large 1000 / overlong 4,
+     * 0x80 two continuations.
+     */
+    const __m128i byte_1_high = _mm_shuffle_epi8(
+        _mm_setr_epi8(0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02,
+                      (char)0x80, (char)0x80, (char)0x80, (char)0x80,
+                      0x21, 0x01, 0x15, 0x49),
+        _mm_and_si128(_mm_srli_epi16(prev1, 4), nib));
+    const __m128i byte_1_low = _mm_shuffle_epi8(
+        _mm_setr_epi8((char)0xE7, (char)0xA3, (char)0x83, (char)0x83,
+                      (char)0x8B, (char)0xCB, (char)0xCB, (char)0xCB,
+                      (char)0xCB, (char)0xCB, (char)0xCB, (char)0xCB,
+                      (char)0xCB, (char)0xDB, (char)0xCB, (char)0xCB),
+        _mm_and_si128(prev1, nib));
+    const __m128i byte_2_high = _mm_shuffle_epi8(
+        _mm_setr_epi8(0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+                      (char)0xE6, (char)0xAE, (char)0xBA, (char)0xBA,
+                      0x01, 0x01, 0x01, 0x01),
+        _mm_and_si128(_mm_srli_epi16(in, 4), nib));
+    const __m128i special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low),
+                                          byte_2_high);
+    /* Third and fourth bytes of 3- and 4-byte sequences must be
+     * continuations; special has 0x80 exactly where two continuations meet.
+     */
+    const __m128i must23 = _mm_or_si128(
+        _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80))),
+        _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80))));
+    return _mm_xor_si128(_mm_and_si128(must23, _mm_set1_epi8((char)0x80)),
+                         special);
+}
+
+/* Nonzero where the last bytes of v start a sequence that needs more. */
+static __m128i siml_utf8_incomplete16(__m128i v) {
+    return _mm_subs_epu8(v, _mm_setr_epi8(
+        (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF,
+        (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF,
+        (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF,
+        (char)0xFF, (char)0xEF, (char)0xDF, (char)0xBF));
+}
+#endif
+
+/* Check that s[from, len) is well-formed UTF-8; s[0, from) is ASCII. */
+static int siml_utf8_valid(const char *s, size_t len, size_t from) {
+#if defined(SIML_HAVE_SSSE3)
+    __m128i prev = _mm_setzero_si128();
+    __m128i err = _mm_setzero_si128();
+    size_t i;
+
+    for (i = from; i < len; i += 16) {
+        __m128i in;
+        if (len - i < 16) {
+            char tail[16];
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, s + i, len - i);
+            in = _mm_loadu_si128((const __m128i *)tail);
+        } else {
+            in = _mm_loadu_si128((const __m128i *)(s + i));
+        }
+        if (_mm_movemask_epi8(in) == 0) {
+            /* ASCII block: only a sequence cut off by it can be wrong. */
+            err = _mm_or_si128(err, siml_utf8_incomplete16(prev));
+        } else {
+            err = _mm_or_si128(err, siml_utf8_check16(in, prev));
+        }
+        prev = in;
+    }
+    err = _mm_or_si128(err, siml_utf8_incomplete16(prev));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(err, _mm_setzero_si128())) == 0xFFFF;
+#else
+    const unsigned char *u = (const unsigned char *)s;
+    size_t i = from;
+
+    while (i < len) {
+        unsigned int cls;
+        size_t n;
+
+        if (u[i] < 0x80) {
+#if defined(SIML_HAVE_SSE2)
+            while (len - i >= 16 &&
+                   _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i))) == 0) {
+                i += 16;
+            }
+            while (i < len && u[i] < 0x80) {
+                ++i;
+            }
+#else
+            ++i;
+#endif
+            continue;
+        }
+        cls = siml_utf8_class[u[i]];
+        n = siml_utf8_len[cls];
+        if (n == 0 || len - i < n) return 0;
+        if (u[i + 1] < siml_utf8_lo[cls] || u[i + 1] > siml_utf8_hi[cls]) {
+            return 0;
+        }
+        if (n > 2 && (u[i + 2] & 0xC0) != 0x80) return 0;
+        if (n > 3 && (u[i + 3] & 0xC0) != 0x80) return 0;
+        i += n;
     }
     return 1;
+#endif
+}
+
+static int siml_is_alpha(char c) {
+    return ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'));
+}
+
+static int siml_is_digit(char c) {
+    return (c >= '0' && c <= '9');
+}
+
+static int siml_is_key_char(char c) {
+    return siml_is_alpha(c) || siml_is_digit(c) || c == '_' || c == '-' || c == '.';
 }
 
 static int siml_is_space_or_tab_only(const char *s, size_t len) {
@@ -422,6 +1388,108 @@ static void siml_set_error_two(siml_parser *p, siml_error_code code,
     p->error_message = p->error_buf;
 }
 
+/* Key table ------------------------------------------------------------ */
+
+/* Keys are short: mix them four bytes at a time. */
+static unsigned int siml_keytab_hash(const char *key, size_t len) {
+    unsigned int h = 2166136261u ^ (unsigned int)len;
+    unsigned int w;
+    size_t i = 0;
+
+    for (; i + 4 <= len; i += 4) {
+        memcpy(&w, key + i, 4);
+        h = (h ^ w) * 0x9E3779B1u;
+        h ^= h >> 15;
+    }
+    for (; i < len; ++i) {
+        h = (h ^ (unsigned char)key[i]) * 16777619u;
+    }
+    return h ^ (h >> 16);
+}
+
+int siml_keytab_init(siml_keytab *t, void *mem, size_t size) {
+    size_t keys = size / SIML_KEYTAB_KEY_BYTES;
+    size_t slots = 1;
+
+    if (!t || !mem || keys < 2) return 0;
+    while (slots * 2 <= keys * 2 && slots * 2 <= 0x40000000UL) slots *= 2;
+    t->entries = (siml_keytab_entry *)mem;
+    t->cap = (unsigned int)(slots / 2);
+    t->slots = (unsigned int *)(t->entries + t->cap);
+    t->mask = (unsigned int)(slots - 1);
+    t->text = (char *)(t->slots + slots);
+    t->text_cap = size - (size_t)(t->text - (char *)mem);
+    t->text_len = 0;
+    t->count = 0;
+    memset(t->slots, 0, slots * sizeof(unsigned int));
+    return 1;
+}
+
+/* Slot holding key, or the empty slot where it would go. */
+static unsigned int siml_keytab_slot(const siml_keytab *t, const char *key,
+                                     size_t len, unsigned int h) {
+    unsigned int i = h & t->mask;
+
+    for (;;) {
+        unsigned int id = t->slots[i];
+        const siml_keytab_entry *e;
+
+        if (id == 0) return i;
+        e = &t->entries[id - 1];
+        if (e->hash == h && e->len == len &&
+            memcmp(t->text + e->offset, key, len) == 0) {
+            return i;
+        }
+        i = (i + 1) & t->mask;
+    }
+}
+
+unsigned int siml_keytab_find(const siml_keytab *t, const char *key,
+                              size_t len) {
+    if (!t || (!key && len > 0)) return 0;
+    return t->slots[siml_keytab_slot(t, key, len,
+                                     siml_keytab_hash(key, len))];
+}
+
+unsigned int siml_keytab_intern(siml_keytab *t, const char *key, size_t len) {
+    unsigned int h;
+    unsigned int i;
+    siml_keytab_entry *e;
+
+    if (!t || (!key && len > 0)) return 0;
+    h = siml_keytab_hash(key, len);
+    i = siml_keytab_slot(t, key, len, h);
+    if (t->slots[i] != 0) return t->slots[i];
+    if (t->count == t->cap || t->text_cap - t->text_len <= len) return 0;
+    e = &t->entries[t->count];
+    e->hash = h;
+    e->len = (unsigned int)len;
+    e->offset = t->text_len;
+    if (len > 0) memcpy(t->text + t->text_len, key, len);
+    t->text[t->text_len + len] = '\0';
+    t->text_len += len + 1;
+    t->count += 1;
+    t->slots[i] = t->count;
+    return t->count;
+}
+
+siml_slice siml_keytab_key(const siml_keytab *t, unsigned int id) {
+    siml_slice s;
+
+    s.ptr = "";
+    s.len = 0;
+    if (t && id >= 1 && id <= t->count) {
+        s.ptr = t->text + t->entries[id - 1].offset;
+        s.len = t->entries[id - 1].len;
+    }
+    return s;
+}
+
+void siml_parser_set_keytab(siml_parser *p, siml_keytab *t) {
+    if (!p) return;
+    p->keytab = t;
+}
+
 static void siml_clear_event(siml_event *ev) {
     ev->type                  = SIML_EVENT_NONE;
     ev->key.ptr               = 0;
@@ -435,6 +1503,7 @@ static void siml_clear_event(siml_event *ev) {
     ev->line                  = 0;
     ev->error_code            = SIML_ERR_NONE;
     ev->error_message         = 0;
+    ev->key_id                = 0;
 }
 
 static siml_slice siml_make_slice(const char *p, size_t len) {
@@ -444,14 +1513,244 @@ static siml_slice siml_make_slice(const char *p, size_t len) {
     return s;
 }
 
+/* Keep a key that must outlive the current line. Buffer input is stable, so
+ * the key is referenced in place; otherwise it is copied into buf.
+ */
+static const char *siml_keep_key(siml_parser *p, char *buf,
+                                 const char *key, size_t len) {
+    if (p->input == SIML_INPUT_BUFFER) return key;
+    if (p->keytab && len > 0) {
+        unsigned int id = siml_keytab_intern(p->keytab, key, len);
+        if (id != 0) {
+            return p->keytab->text + p->keytab->entries[id - 1].offset;
+        }
+    }
+    if (len > 0) {
+        memcpy(buf, key, len);
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+/* Append a partial line to the push carry buffer. Bytes beyond
+ * SIML_MAX_LINE_LEN + 1 are dropped; the line is rejected as too long anyway.
+ */
+static void siml_carry(siml_parser *p, const char *s, size_t len) {
+    size_t room = SIML_MAX_LINE_LEN + 1 - p->peek_len;
+    if (len > room) len = room;
+    if (len > 0) {
+        memcpy(p->peek_buf + p->peek_len, s, len);
+        p->peek_len += len;
+    }
+}
+
+/* A line ending in CR is a CRLF only if a complete line follows it; before
+ * the end of the input it is a stray CR, and before a final line without
+ * LF (or one too long) that error wins, as the callback path finds with its
+ * look-ahead. The
+ * next line has carried bytes in peek_buf and goes on at the reader
+ * position. Returns 1 with line_cr_code set, -1 on error, 2 if a push
+ * parser needs more input to tell.
+ */
+static int siml_cr_lookahead(siml_parser *p, size_t carried) {
+    siml_mem_reader *r = &p->buffer;
+    const char *rest = r->data + r->pos;
+    const char *lf = siml_find_lf(rest, r->data + r->len);
+    int done = p->input == SIML_INPUT_BUFFER || p->feed_done;
+
+    if (lf) {
+        if (carried + (size_t)(lf - rest) > SIML_MAX_LINE_LEN) {
+            siml_set_error(p, SIML_ERR_LINE_TOO_LONG,
+                           "physical line too long (max 4608 bytes)");
+            return -1;
+        }
+        p->line_cr_code = SIML_ERR_CRLF;
+        return 1;
+    }
+    if (!done) return 2;
+    if (carried == 0 && r->pos == r->len) {
+        p->line_cr_code = SIML_ERR_CR;
+        return 1;
+    }
+    p->at_eof = 1;
+    if (carried + (r->len - r->pos) > SIML_MAX_LINE_LEN) {
+        siml_set_error(p, SIML_ERR_LINE_TOO_LONG,
+                       "physical line too long (max 4608 bytes)");
+    } else {
+        siml_set_error(p, SIML_ERR_FINAL_LINE_NO_LF, "final line without LF");
+    }
+    return -1;
+}
+
+/* Make line the current line of a buffer or push parser. final is set when
+ * no LF follows it; described when p->info already holds its descriptor.
+ * A line too long is rejected as such even without an LF, as a chunked
+ * reader stops at the limit before it could tell.
+ * Returns 1, -1 on error, or 2 when a push parser holds the line until it
+ * sees the next one.
+ */
+static int siml_take_line(siml_parser *p, const char *line, size_t len,
+                          int final, int described) {
+    int rc;
+
+    p->line      = line;
+    p->line_len  = len;
+    p->have_line = 1;
+    p->line_no  += 1;
+    p->line_cr_code = SIML_ERR_NONE;
+    if (final) {
+        p->at_eof = 1;
+        if (len > SIML_MAX_LINE_LEN) {
+            siml_set_error(p, SIML_ERR_LINE_TOO_LONG,
+                           "physical line too long (max 4608 bytes)");
+        } else {
+            siml_set_error(p, SIML_ERR_FINAL_LINE_NO_LF,
+                           "final line without LF");
+        }
+        return -1;
+    }
+    if (!described) {
+        siml_scan_line(&p->info, line, len);
+    }
+    /* A line too long to keep whole is rejected as such, whatever follows
+     * it: a chunked reader never sees the CR at its end.
+     */
+    if (p->info.cr_pos + 1 < len) {
+        p->line_cr_code = SIML_ERR_CR;
+    } else if (p->info.cr_pos + 1 == len && len <= SIML_MAX_LINE_LEN) {
+        rc = siml_cr_lookahead(p, p->cr_held ? p->peek_len : 0);
+        if (rc == 2) {
+            /* Keep the line, and the start of the next in peek_buf, across
+             * chunks.
+             */
+            p->line_no  -= 1;
+            p->have_line = 0;
+            if (!p->cr_held) {
+                memcpy(p->u.hold_buf, line, len);
+                p->hold_len = len;
+                p->peek_len = 0;
+                p->cr_held  = 1;
+            }
+            siml_carry(p, p->buffer.data + p->buffer.pos,
+                       p->buffer.len - p->buffer.pos);
+            p->buffer.pos = p->buffer.len;
+            return 2;
+        }
+        if (rc < 0) {
+            p->cr_held = 0;
+            return -1;
+        }
+    }
+    p->cr_held = 0;
+    return 1;
+}
+
+#if defined(SIML_HAVE_SSE2)
+/* Buffer input: split the next line off the stage-1 index and describe it
+ * from the same bitmaps.
+ */
+static int siml_fetch_indexed(siml_parser *p) {
+    siml_mem_reader *r = &p->buffer;
+    siml_index *x = &p->u.index;
+    size_t pos = r->pos;
+    size_t lf;
+
+    if (pos >= r->len) {
+        p->at_eof    = 1;
+        p->have_line = 0;
+        return 0;
+    }
+    if (pos < x->base || pos >= x->end) {
+        siml_index_fill(x, r->data, r->len, pos);
+    }
+    lf = siml_bits_first(x->lf, pos - x->base, x->end - x->base) + x->base;
+    if (lf == x->end && x->end < r->len) {
+        /* The line runs past the window; index again from its start. */
+        siml_index_fill(x, r->data, r->len, pos);
+        lf = siml_bits_first(x->lf, pos - x->base, x->end - x->base) +
+             x->base;
+        if (lf == x->end && x->end < r->len) {
+            /* Longer than any acceptable line; only its length matters. */
+            const char *q = siml_find_lf(r->data + x->end, r->data + r->len);
+            lf = q ? (size_t)(q - r->data) : r->len;
+            r->pos = lf < r->len ? lf + 1 : r->len;
+            p->info.indent = p->info.trimmed_len = lf - pos;
+            p->info.tab_pos = p->info.cr_pos = p->info.colon_pos = lf - pos;
+            p->info.hash_pos = p->info.non_ascii = lf - pos;
+            return siml_take_line(p, r->data + pos, lf - pos, q == 0, 1);
+        }
+    }
+    if (lf == r->len) {
+        r->pos = r->len;
+        return siml_take_line(p, r->data + pos, lf - pos, 1, 1);
+    }
+    r->pos = lf + 1;
+    siml_index_describe(x, &p->info, pos - x->base, lf - x->base);
+    return siml_take_line(p, r->data + pos, lf - pos, 0, 1);
+}
+#endif
+
 /* Fetch next physical line into parser->line/line_len. Returns:
- *   1 on success, 0 on EOF, -1 on error.
+ *   1 on success, 0 on EOF, -1 on error, 2 if a push parser needs more input.
  */
 static int siml_fetch_line(siml_parser *p) {
     const char *line;
     size_t len;
     int rc;
 
+    if (p->input == SIML_INPUT_BUFFER) {
+        if (p->at_eof) {
+            p->have_line = 0;
+            return 0;
+        }
+#if defined(SIML_HAVE_SSE2)
+        return siml_fetch_indexed(p);
+#else
+        rc = siml_mem_read_line(&p->buffer, &line, &len);
+        if (rc == 0) {
+            p->at_eof    = 1;
+            p->have_line = 0;
+            return 0;
+        }
+        return siml_take_line(p, line, len, rc == 2, 0);
+#endif
+    }
+
+    if (p->input == SIML_INPUT_PUSH) {
+        if (p->at_eof) {
+            p->have_line = 0;
+            return 0;
+        }
+        p->have_line = 0;
+        if (p->cr_held) {
+            return siml_take_line(p, p->u.hold_buf, p->hold_len, 0, 0);
+        }
+        rc = siml_mem_read_line(&p->buffer, &line, &len);
+        if (rc == 1 && p->peek_len == 0) {
+            return siml_take_line(p, line, len, 0, 0);
+        }
+        if (rc == 1) {
+            /* The LF completes the line carried from earlier chunks. */
+            siml_carry(p, line, len);
+            len = p->peek_len;
+            p->peek_len = 0;
+            return siml_take_line(p, p->peek_buf, len, 0, 0);
+        }
+        if (rc == 2) {
+            siml_carry(p, line, len);
+        }
+        if (!p->feed_done) {
+            return 2;
+        }
+        if (p->peek_len == 0) {
+            p->at_eof = 1;
+            return 0;
+        }
+        len = p->peek_len;
+        p->peek_len = 0;
+        return siml_take_line(p, p->peek_buf, len, 1, 0);
+    }
+
     if (p->have_peek) {
         p->line = p->peek_buf;
         p->line_len = p->peek_len;
@@ -459,48 +1758,41 @@ static int siml_fetch_line(siml_parser *p) {
         p->have_line = 1;
         p->line_no += 1;
         p->line_cr_code = SIML_ERR_NONE;
-        {
-            size_t i;
-            int found_cr = 0;
-            for (i = 0; i < p->line_len; ++i) {
-                if (p->line[i] == '\r') {
-                    found_cr = 1;
-                    if (i + 1 < p->line_len) {
-                        p->line_cr_code = SIML_ERR_CR;
-                        return 1;
-                    }
+        siml_scan_line(&p->info, p->line, p->line_len);
+        if (p->info.cr_pos + 1 < p->line_len) {
+            p->line_cr_code = SIML_ERR_CR;
+            return 1;
+        }
+        if (p->info.cr_pos + 1 == p->line_len &&
+            p->line_len <= SIML_MAX_LINE_LEN) {
+            const char *peek_line;
+            size_t peek_len;
+            int peek_rc;
+            peek_rc = p->read_line(p->userdata, &peek_line, &peek_len);
+            if (peek_rc > 0) {
+                if (peek_len > SIML_MAX_LINE_LEN) {
+                    siml_set_error(p, SIML_ERR_LINE_TOO_LONG,
+                                   "physical line too long (max 4608 bytes)");
+                    return -1;
                 }
-            }
-            if (found_cr && p->line_len > 0 && p->line[p->line_len - 1] == '\r') {
-                const char *peek_line;
-                size_t peek_len;
-                int peek_rc;
-                peek_rc = p->read_line(p->userdata, &peek_line, &peek_len);
-                if (peek_rc > 0) {
-                    if (peek_rc == 2) {
-                        p->at_eof = 1;
-                        siml_set_error(p, SIML_ERR_FINAL_LINE_NO_LF,
-                                       "final line without LF");
-                        return -1;
-                    }
-                    if (peek_len > SIML_MAX_LINE_LEN) {
-                        siml_set_error(p, SIML_ERR_LINE_TOO_LONG,
-                                       "physical line too long (max 4608 bytes)");
-                        return -1;
-                    }
-                    memcpy(p->peek_buf, peek_line, peek_len);
-                    p->peek_buf[peek_len] = '\0';
-                    p->peek_len = peek_len;
-                    p->have_peek = 1;
-                    p->line_cr_code = SIML_ERR_CRLF;
-                } else if (peek_rc == 0) {
+                if (peek_rc == 2) {
                     p->at_eof = 1;
-                    p->line_cr_code = SIML_ERR_CR;
-                } else {
-                    siml_set_error(p, SIML_ERR_IO,
-                                   "I/O error while reading input");
+                    siml_set_error(p, SIML_ERR_FINAL_LINE_NO_LF,
+                                   "final line without LF");
                     return -1;
                 }
+                memcpy(p->peek_buf, peek_line, peek_len);
+                p->peek_buf[peek_len] = '\0';
+                p->peek_len = peek_len;
+                p->have_peek = 1;
+                p->line_cr_code = SIML_ERR_CRLF;
+            } else if (peek_rc == 0) {
+                p->at_eof = 1;
+                p->line_cr_code = SIML_ERR_CR;
+            } else {
+                siml_set_error(p, SIML_ERR_IO,
+                               "I/O error while reading input");
+                return -1;
             }
         }
         return 1;
@@ -518,52 +1810,49 @@ static int siml_fetch_line(siml_parser *p) {
         p->line_cr_code = SIML_ERR_NONE;
         if (rc == 2) {
             p->at_eof = 1;
-            siml_set_error(p, SIML_ERR_FINAL_LINE_NO_LF,
-                           "final line without LF");
+            if (len > SIML_MAX_LINE_LEN) {
+                siml_set_error(p, SIML_ERR_LINE_TOO_LONG,
+                               "physical line too long (max 4608 bytes)");
+            } else {
+                siml_set_error(p, SIML_ERR_FINAL_LINE_NO_LF,
+                               "final line without LF");
+            }
             return -1;
         }
-        {
-            size_t i;
-            int found_cr = 0;
-            for (i = 0; i < len; ++i) {
-                if (line[i] == '\r') {
-                    found_cr = 1;
-                    if (i + 1 < len) {
-                        p->line_cr_code = SIML_ERR_CR;
-                        return 1;
-                    }
+        siml_scan_line(&p->info, line, len);
+        if (p->info.cr_pos + 1 < len) {
+            p->line_cr_code = SIML_ERR_CR;
+            return 1;
+        }
+        if (p->info.cr_pos + 1 == len && len <= SIML_MAX_LINE_LEN) {
+            const char *peek_line;
+            size_t peek_len;
+            int peek_rc;
+            peek_rc = p->read_line(p->userdata, &peek_line, &peek_len);
+            if (peek_rc > 0) {
+                if (peek_len > SIML_MAX_LINE_LEN) {
+                    siml_set_error(p, SIML_ERR_LINE_TOO_LONG,
+                                   "physical line too long (max 4608 bytes)");
+                    return -1;
                 }
-            }
-            if (found_cr && len > 0 && line[len - 1] == '\r') {
-                const char *peek_line;
-                size_t peek_len;
-                int peek_rc;
-                peek_rc = p->read_line(p->userdata, &peek_line, &peek_len);
-                if (peek_rc > 0) {
-                    if (peek_rc == 2) {
-                        p->at_eof = 1;
-                        siml_set_error(p, SIML_ERR_FINAL_LINE_NO_LF,
-                                       "final line without LF");
-                        return -1;
-                    }
-                    if (peek_len > SIML_MAX_LINE_LEN) {
-                        siml_set_error(p, SIML_ERR_LINE_TOO_LONG,
-                                       "physical line too long (max 4608 bytes)");
-                        return -1;
-                    }
-                    memcpy(p->peek_buf, peek_line, peek_len);
-                    p->peek_buf[peek_len] = '\0';
-                    p->peek_len = peek_len;
-                    p->have_peek = 1;
-                    p->line_cr_code = SIML_ERR_CRLF;
-                } else if (peek_rc == 0) {
+                if (peek_rc == 2) {
                     p->at_eof = 1;
-                    p->line_cr_code = SIML_ERR_CR;
-                } else {
-                    siml_set_error(p, SIML_ERR_IO,
-                                   "I/O error while reading input");
+                    siml_set_error(p, SIML_ERR_FINAL_LINE_NO_LF,
+                                   "final line without LF");
                     return -1;
                 }
+                memcpy(p->peek_buf, peek_line, peek_len);
+                p->peek_buf[peek_len] = '\0';
+                p->peek_len = peek_len;
+                p->have_peek = 1;
+                p->line_cr_code = SIML_ERR_CRLF;
+            } else if (peek_rc == 0) {
+                p->at_eof = 1;
+                p->line_cr_code = SIML_ERR_CR;
+            } else {
+                siml_set_error(p, SIML_ERR_IO,
+                               "I/O error while reading input");
+                return -1;
             }
         }
         return 1;
@@ -593,7 +1882,7 @@ static int siml_check_line_common(siml_parser *p) {
                        "physical line too long (max 4608 bytes)");
         return 0;
     }
-    if (p->line_no == 1 && len >= 3) {
+    if (p->line_no == 1 && p->resume == SIML_RESUME_NONE && len >= 3) {
         if ((unsigned char)s[0] == 0xEF &&
             (unsigned char)s[1] == 0xBB &&
             (unsigned char)s[2] == 0xBF) {
@@ -609,12 +1898,15 @@ static int siml_check_line_common(siml_parser *p) {
         siml_set_error(p, SIML_ERR_CR, "CR is forbidden (\\r found)");
         return 0;
     }
+    if (p->validate_utf8 && p->info.non_ascii < len &&
+        !siml_utf8_valid(s, len, p->info.non_ascii)) {
+        siml_set_error(p, SIML_ERR_UTF8_INVALID, "invalid UTF-8 byte sequence");
+        return 0;
+    }
     return 1;
 }
 
 static int siml_check_line_nonblock(siml_parser *p) {
-    size_t i;
-    const char *s = p->line;
     size_t len = p->line_len;
 
     if (!siml_check_line_common(p)) return 0;
@@ -623,13 +1915,11 @@ static int siml_check_line_nonblock(siml_parser *p) {
         siml_set_error(p, SIML_ERR_BLANK_LINE, "blank lines are not allowed here");
         return 0;
     }
-    for (i = 0; i < len; ++i) {
-        if (s[i] == '\t') {
-            siml_set_error(p, SIML_ERR_TABS, "tabs are not allowed here");
-            return 0;
-        }
+    if (p->info.tab_pos < len) {
+        siml_set_error(p, SIML_ERR_TABS, "tabs are not allowed here");
+        return 0;
     }
-    if (siml_is_space_only(s, len)) {
+    if (p->info.indent == len) {
         siml_set_error(p, SIML_ERR_WHITESPACE_ONLY,
                        "whitespace-only lines are not allowed here");
         return 0;
@@ -637,12 +1927,9 @@ static int siml_check_line_nonblock(siml_parser *p) {
     return 1;
 }
 
-static int siml_count_indent(siml_parser *p, const char *s, size_t len,
-                             size_t *out_indent) {
-    size_t i = 0;
-    while (i < len && s[i] == ' ') {
-        ++i;
-    }
+/* Indentation of the current (non-blank) line, from its descriptor. */
+static int siml_count_indent(siml_parser *p, size_t *out_indent) {
+    size_t i = p->info.indent;
     if ((i % 2) != 0) {
         siml_set_error(p, SIML_ERR_INDENT_MULTIPLE,
                        "indentation must be a multiple of 2 spaces");
@@ -657,7 +1944,7 @@ static int siml_parse_comment_line(siml_parser *p, const char *s, size_t len,
     size_t indent = 0;
     size_t text_len = 0;
 
-    if (!siml_count_indent(p, s, len, &indent)) return -1;
+    if (!siml_count_indent(p, &indent)) return -1;
     *out_indent = indent;
     if (indent >= len) return 0;
     if (s[indent] != '#') return 0;
@@ -718,9 +2005,12 @@ static int siml_parse_inline_comment(siml_parser *p,
         }
     }
 
-    for (i = comment_start; i < len; ++i) {
-        if (s[i] == '#') {
-            if (i > 0 && s[i - 1] == ' ') {
+    if (p->info.hash_pos >= comment_start) {
+        if (p->info.hash_pos < len) hash_pos = p->info.hash_pos;
+    } else {
+        /* The first " #" lies inside the flow sequence; look past it. */
+        for (i = comment_start; i < len; ++i) {
+            if (s[i] == '#' && s[i - 1] == ' ') {
                 hash_pos = i;
                 break;
             }
@@ -803,17 +2093,13 @@ static int siml_request_container_start(siml_parser *p,
                                         size_t indent,
                                         const char *key,
                                         size_t key_len) {
-    size_t i;
-
     if (!siml_push_container(p, type, indent)) return 0;
     p->pending_container_start = 1;
     p->pending_container_type = type;
     p->pending_seq_style = seq_style;
+    p->pending_container_key = siml_keep_key(p, p->pending_container_key_buf,
+                                             key, key_len);
     p->pending_container_key_len = key_len;
-    for (i = 0; i < key_len && i < SIML_MAX_KEY_LEN; ++i) {
-        p->pending_container_key[i] = key[i];
-    }
-    p->pending_container_key[key_len] = '\0';
     return 1;
 }
 
@@ -874,38 +2160,151 @@ void siml_parser_init(siml_parser *p,
                       siml_read_line_fn read_line,
                       void *userdata) {
     if (!p) return;
+    p->input     = SIML_INPUT_CALLBACK;
+    p->validate_utf8 = SIML_VALIDATE_UTF8;
+    p->sub_paths = 0;
+    p->sub_count = 0;
+    p->sub_mode  = SIML_SKIP_VALIDATE;
+    p->keytab    = 0;
     p->read_line = read_line;
     p->userdata  = userdata;
+    p->resume    = SIML_RESUME_NONE;
+    p->line_base = 0;
+    siml_mem_reader_init(&p->buffer, 0, 0);
+    siml_parser_reset(p);
+}
+
+void siml_parser_init_buffer(siml_parser *p, const char *data, size_t len) {
+    if (!p) return;
+    p->input     = SIML_INPUT_BUFFER;
+    p->validate_utf8 = SIML_VALIDATE_UTF8;
+    p->sub_paths = 0;
+    p->sub_count = 0;
+    p->sub_mode  = SIML_SKIP_VALIDATE;
+    p->keytab    = 0;
+    p->read_line = 0;
+    p->userdata  = 0;
+    p->resume    = SIML_RESUME_NONE;
+    p->line_base = 0;
+    siml_mem_reader_init(&p->buffer, data, len);
+    siml_parser_reset(p);
+}
+
+void siml_parser_init_buffer_resume(siml_parser *p, const char *data,
+                                    size_t len) {
+    if (!p) return;
+    siml_parser_init_buffer(p, data, len);
+    p->resume = SIML_RESUME_SEPARATOR;
+    siml_parser_reset(p);
+}
+
+void siml_parser_init_buffer_entry(siml_parser *p, const char *data,
+                                   size_t len) {
+    if (!p) return;
+    siml_parser_init_buffer(p, data, len);
+    p->resume = SIML_RESUME_ENTRY;
+    siml_parser_reset(p);
+}
+
+void siml_parser_init_buffer_at(siml_parser *p, const char *data, size_t len,
+                                long line) {
+    if (!p) return;
+    siml_parser_init_buffer(p, data, len);
+    if (line > 1) {
+        p->resume = SIML_RESUME_SEPARATOR;
+        p->line_base = line - 1;
+    }
+    siml_parser_reset(p);
+}
+
+void siml_parser_init_push(siml_parser *p) {
+    if (!p) return;
+    p->input     = SIML_INPUT_PUSH;
+    p->validate_utf8 = SIML_VALIDATE_UTF8;
+    p->sub_paths = 0;
+    p->sub_count = 0;
+    p->sub_mode  = SIML_SKIP_VALIDATE;
+    p->keytab    = 0;
+    p->read_line = 0;
+    p->userdata  = 0;
+    p->resume    = SIML_RESUME_NONE;
+    p->line_base = 0;
+    siml_mem_reader_init(&p->buffer, 0, 0);
     siml_parser_reset(p);
 }
 
+int siml_feed(siml_parser *p, const char *data, size_t len) {
+    if (!p || p->input != SIML_INPUT_PUSH || p->feed_done) return 0;
+    if (p->buffer.pos < p->buffer.len) return 0;
+    siml_mem_reader_init(&p->buffer, data, len);
+    return 1;
+}
+
+void siml_feed_end(siml_parser *p) {
+    if (!p || p->input != SIML_INPUT_PUSH) return;
+    p->feed_done = 1;
+}
+
+/* Subscription state at the start of the input. A resumed entry starts
+ * inside the document root.
+ */
+static void siml_sub_reset(siml_parser *p) {
+    p->sub_mask[0] = (p->sub_count == 0) ? 0UL :
+                     (~0UL >> (sizeof(unsigned long) * 8 - (size_t)p->sub_count));
+    p->sub_mask[1] = p->sub_mask[0];
+    p->sub_level = (p->resume == SIML_RESUME_ENTRY) ? 1 : 0;
+    p->sub_match_level = 0;
+    p->sub_skipping = 0;
+}
+
 void siml_parser_reset(siml_parser *p) {
     if (!p) return;
+    if (p->input == SIML_INPUT_PUSH) {
+        siml_mem_reader_init(&p->buffer, 0, 0);
+    } else {
+        siml_mem_reader_init(&p->buffer, p->buffer.data, p->buffer.len);
+    }
+    p->feed_done = 0;
+    p->u.index.base = 0;
+    p->u.index.end = 0;
     p->line      = 0;
     p->line_len  = 0;
-    p->line_no   = 0;
+    p->line_no   = p->line_base;
     p->have_line = 0;
     p->at_eof    = 0;
     p->have_peek = 0;
     p->peek_len = 0;
+    p->cr_held = 0;
+    p->hold_len = 0;
     p->peek_buf[0] = '\0';
     p->line_cr_code = SIML_ERR_NONE;
-    p->started   = 0;
-    p->in_document = 0;
-    p->seen_document = 0;
-    p->awaiting_document = 0;
+    p->started   = (p->resume != SIML_RESUME_NONE);
+    p->in_document = (p->resume == SIML_RESUME_ENTRY);
+    p->seen_document = (p->resume != SIML_RESUME_NONE);
+    p->awaiting_document = (p->resume == SIML_RESUME_SEPARATOR);
     p->mode      = SIML_MODE_NORMAL;
     p->depth     = 0;
+    p->skip_depth = 0;
+    siml_sub_reset(p);
+    if (p->resume == SIML_RESUME_ENTRY) {
+        siml_container_type root = SIML_CONTAINER_MAP;
+        if (p->buffer.len > 0 && p->buffer.data[0] == '-') {
+            root = SIML_CONTAINER_SEQ;
+        }
+        (void)siml_push_container(p, root, 0);
+    }
     p->pending_kind = SIML_PENDING_NONE;
     p->pending_indent = 0;
-    p->pending_key[0] = '\0';
+    p->pending_key_buf[0] = '\0';
+    p->pending_key = p->pending_key_buf;
     p->pending_key_len = 0;
     p->pending_close = 0;
     p->target_depth = 0;
     p->pending_doc_end = 0;
     p->pending_doc_start = 0;
     p->pending_container_start = 0;
-    p->pending_container_key[0] = '\0';
+    p->pending_container_key_buf[0] = '\0';
+    p->pending_container_key = p->pending_container_key_buf;
     p->pending_container_key_len = 0;
     p->pending_stream_end = 0;
     p->flow_depth = 0;
@@ -913,13 +2312,16 @@ void siml_parser_reset(siml_parser *p) {
     p->flow_stack_end[0] = 0;
     p->flow_stack_pos[0] = 0;
     p->flow_stack_started[0] = 0;
-    p->flow_key[0] = '\0';
+    p->flow_next_open = 0;
+    p->flow_key_buf[0] = '\0';
+    p->flow_key = p->flow_key_buf;
     p->flow_key_len = 0;
     p->flow_inline_spaces = 0;
     p->flow_inline_comment = 0;
     p->flow_inline_comment_len = 0;
     p->block_indent = 0;
-    p->block_key[0] = '\0';
+    p->block_key_buf[0] = '\0';
+    p->block_key = p->block_key_buf;
     p->block_key_len = 0;
     p->block_inline_spaces = 0;
     p->block_inline_comment = 0;
@@ -934,16 +2336,66 @@ void siml_parser_reset(siml_parser *p) {
     p->error_line = 0;
 }
 
+void siml_mem_reader_init(siml_mem_reader *r, const char *data, size_t len) {
+    if (!r) return;
+    r->data    = data;
+    r->len     = len;
+    r->pos     = 0;
+    r->scan    = 0;
+    r->lf_mask = 0;
+}
+
+int siml_mem_read_line(void *userdata, const char **out_line, size_t *out_len) {
+    siml_mem_reader *r;
+    const char *start;
+    const char *lf;
+
+    r = (siml_mem_reader *)userdata;
+    if (!r || !out_line || !out_len) {
+        return -1;
+    }
+    if (r->pos >= r->len) {
+        return 0;
+    }
+
+    start = r->data + r->pos;
+    *out_line = start;
+#if defined(SIML_HAVE_SSE2)
+    for (;;) {
+        if (r->lf_mask != 0) {
+            size_t i = r->scan - 32 + siml_ctz(r->lf_mask);
+            r->lf_mask &= r->lf_mask - 1;
+            *out_len = i - r->pos;
+            r->pos = i + 1;
+            return 1;
+        }
+        if (r->len - r->scan < 32) break;
+        r->lf_mask = siml_lf_mask32(r->data + r->scan);
+        r->scan += 32;
+    }
+    lf = siml_find_lf(r->data + (r->scan > r->pos ? r->scan : r->pos),
+                      r->data + r->len);
+#else
+    lf = siml_find_lf(start, r->data + r->len);
+#endif
+    if (!lf) {
+        *out_len = r->len - r->pos;
+        r->pos = r->len;
+        return 2;
+    }
+    *out_len = (size_t)(lf - start);
+    r->pos += *out_len + 1;
+    return 1;
+}
+
 /* Forward declarations of internal state handlers */
 static siml_event_type siml_next_normal(siml_parser *p, siml_event *ev);
 static siml_event_type siml_next_flow(siml_parser *p, siml_event *ev);
 static siml_event_type siml_next_block(siml_parser *p, siml_event *ev);
 
-siml_event_type siml_next(siml_parser *p, siml_event *ev) {
+static siml_event_type siml_next_raw(siml_parser *p, siml_event *ev) {
     siml_event_type t;
 
-    if (!p || !ev) return SIML_EVENT_ERROR;
-
     siml_clear_event(ev);
 
     if (p->error_code != SIML_ERR_NONE) {
@@ -996,6 +2448,370 @@ siml_event_type siml_next(siml_parser *p, siml_event *ev) {
     return t;
 }
 
+/* Whether the current line belongs to a node whose lines are indented by at
+ * least indent. Blank lines belong (they may be part of a block scalar); at
+ * indent 0 only a separator ends the node.
+ */
+static int siml_skip_line_inside(const siml_parser *p, size_t indent) {
+    if (p->line_len == 0) return 1;
+    if (indent == 0) {
+        return !(p->line_len >= 3 && memcmp(p->line, "---", 3) == 0);
+    }
+    return p->info.indent >= indent;
+}
+
+/* Buffer input: step over whole lines that belong to the node, looking at
+ * nothing but their indentation. Stops before any other line, before a
+ * line ending in CR and before a final line without LF, which
+ * siml_fetch_line() then reads as usual.
+ */
+static void siml_skip_buffer_lines(siml_parser *p, size_t indent) {
+    siml_mem_reader *r = &p->buffer;
+    const char *data = r->data;
+    const char *end = data + r->len;
+    const char *s = data + r->pos;
+    long lines = 0;
+
+    while (s < end) {
+        const char *lf = siml_find_lf(s, end);
+        size_t len;
+        size_t i;
+
+        if (!lf) break;
+        len = (size_t)(lf - s);
+        if (len > 0 && s[len - 1] == '\r') break;
+        if (len > 0) {
+            if (indent == 0) {
+                if (len >= 3 && s[0] == '-' && s[1] == '-' && s[2] == '-') break;
+            } else {
+                if (len < indent) break;
+                for (i = 0; i < indent && s[i] == ' '; ++i) {
+                }
+                if (i < indent) break;
+            }
+        }
+        s = lf + 1;
+        lines += 1;
+    }
+    r->pos = (size_t)(s - data);
+    r->scan = r->pos;
+    r->lf_mask = 0;
+    p->line_no += lines;
+}
+
+/* Step over the lines of a node indented by at least indent. Returns 1 with
+ * the first line after it current (or at EOF), 0 on error, 2 if a push
+ * parser needs more input.
+ */
+static int siml_skip_lines(siml_parser *p, size_t indent, siml_skip_mode mode) {
+    int rc;
+
+    for (;;) {
+        if (!p->have_line) {
+            if (p->input == SIML_INPUT_BUFFER && mode == SIML_SKIP_INDENT &&
+                !p->at_eof) {
+                siml_skip_buffer_lines(p, indent);
+            }
+            rc = siml_fetch_line(p);
+            if (rc < 0) return 0;
+            if (rc == 2) return 2;
+            if (rc == 0) return 1;
+        }
+        if (!siml_skip_line_inside(p, indent)) return 1;
+        if (mode == SIML_SKIP_LINES && !siml_check_line_common(p)) return 0;
+        p->have_line = 0;
+    }
+}
+
+static siml_event_type siml_skip_need_more(siml_parser *p, siml_event *ev) {
+    ev->type = SIML_EVENT_NEED_MORE;
+    ev->line = p->line_no;
+    return ev->type;
+}
+
+static siml_event_type siml_skip_error(siml_parser *p, siml_event *ev) {
+    ev->type          = SIML_EVENT_ERROR;
+    ev->error_code    = p->error_code;
+    ev->error_message = p->error_message;
+    ev->line          = p->error_line;
+    return ev->type;
+}
+
+/* Whether siml_skip() has a node to skip: a block scalar, a flow sequence,
+ * or a mapping or sequence whose START was returned.
+ */
+static int siml_skip_open(const siml_parser *p) {
+    if (p->error_code != SIML_ERR_NONE || !p->started) return 0;
+    if (p->skip_depth != 0 || p->mode != SIML_MODE_NORMAL) return 1;
+    return p->depth > 0 && !p->pending_container_start;
+}
+
+static siml_event_type siml_skip_node(siml_parser *p, siml_event *ev,
+                                      siml_skip_mode mode) {
+    siml_event_type t;
+    int rc;
+
+    if (p->skip_depth == 0 && p->mode == SIML_MODE_FLOW) {
+        int depth = p->flow_depth;
+        if (mode != SIML_SKIP_VALIDATE) {
+            /* Jump to the closing ']'; the brackets passed over still
+             * count for the match table.
+             */
+            size_t pos = p->flow_stack_pos[depth - 1];
+            size_t end = p->flow_stack_end[depth - 1];
+            for (; pos < end; ++pos) {
+                if (p->line[pos] == '[') p->flow_next_open += 1;
+            }
+            p->flow_stack_pos[depth - 1] = end;
+        }
+        for (;;) {
+            t = siml_next_raw(p, ev);
+            if (t == SIML_EVENT_ERROR || t == SIML_EVENT_NEED_MORE) return t;
+            if (t == SIML_EVENT_SEQUENCE_END &&
+                (p->mode != SIML_MODE_FLOW || p->flow_depth < depth)) {
+                return t;
+            }
+        }
+    }
+
+    if (p->skip_depth == 0 && p->mode == SIML_MODE_BLOCK) {
+        if (mode == SIML_SKIP_VALIDATE) {
+            do {
+                t = siml_next_raw(p, ev);
+            } while (t != SIML_EVENT_BLOCK_SCALAR_END &&
+                     t != SIML_EVENT_ERROR && t != SIML_EVENT_NEED_MORE);
+            return t;
+        }
+        siml_clear_event(ev);
+        p->block_blank_count = 0;
+        p->block_emit_blanks = 0;
+        rc = siml_skip_lines(p, p->block_indent + 2, mode);
+        if (rc == 0) return siml_skip_error(p, ev);
+        if (rc == 2) return siml_skip_need_more(p, ev);
+        p->mode = SIML_MODE_NORMAL;
+        ev->type = SIML_EVENT_BLOCK_SCALAR_END;
+        ev->key = siml_make_slice(p->block_key, p->block_key_len);
+        ev->line = p->block_start_line;
+        return ev->type;
+    }
+
+    if (p->skip_depth == 0) p->skip_depth = p->depth;
+    if (mode == SIML_SKIP_VALIDATE) {
+        for (;;) {
+            t = siml_next_raw(p, ev);
+            if (t == SIML_EVENT_NEED_MORE) return t;
+            if (t == SIML_EVENT_ERROR ||
+                ((t == SIML_EVENT_MAPPING_END || t == SIML_EVENT_SEQUENCE_END) &&
+                 p->depth < p->skip_depth)) {
+                p->skip_depth = 0;
+                return t;
+            }
+        }
+    }
+    siml_clear_event(ev);
+    p->pending_kind = SIML_PENDING_NONE;
+    p->pending_key_len = 0;
+    rc = siml_skip_lines(p, p->stack[p->depth - 1].indent, mode);
+    if (rc == 2) return siml_skip_need_more(p, ev);
+    p->skip_depth = 0;
+    if (rc == 0) return siml_skip_error(p, ev);
+    p->depth -= 1;
+    ev->type = (p->stack[p->depth].type == SIML_CONTAINER_MAP)
+                   ? SIML_EVENT_MAPPING_END
+                   : SIML_EVENT_SEQUENCE_END;
+    ev->line = p->line_no;
+    return ev->type;
+}
+
+siml_event_type siml_skip(siml_parser *p, siml_event *ev, siml_skip_mode mode) {
+    siml_event_type t;
+
+    if (!p || !ev) return SIML_EVENT_ERROR;
+    if (!siml_skip_open(p)) return siml_next(p, ev);
+    t = siml_skip_node(p, ev, mode);
+    if (p->keytab && ev->key.len > 0) {
+        ev->key_id = siml_keytab_intern(p->keytab, ev->key.ptr, ev->key.len);
+    }
+    if (p->sub_count > 0 &&
+        (t == SIML_EVENT_MAPPING_END || t == SIML_EVENT_SEQUENCE_END ||
+         t == SIML_EVENT_BLOCK_SCALAR_END)) {
+        p->sub_level -= 1;
+        if (p->sub_level < p->sub_match_level) p->sub_match_level = 0;
+    }
+    return t;
+}
+
+/* Segment of a subscription path at s: a key up to the next '.' or '[', or
+ * [key] taken literally. Sets *key and *len and returns where the next
+ * segment starts, past a separating '.', or 0 for a malformed segment; a
+ * digit after '[' would be an item step, which subscriptions lack.
+ */
+static const char *siml_sub_step(const char *s, const char **key,
+                                 size_t *len) {
+    const char *end;
+
+    if (*s == '[') {
+        *key = s + 1;
+        if (**key >= '0' && **key <= '9') return 0;
+        end = *key + strcspn(*key, "[]");
+        if (*end != ']' || end == *key) return 0;
+        s = end + 1;
+        if (*s != '\0' && *s != '.' && *s != '[') return 0;
+    } else {
+        *key = s;
+        end = s + strcspn(s, ".[]");
+        if (end == s || *end == ']') return 0;
+        s = end;
+    }
+    *len = (size_t)(end - *key);
+    if (*s == '.') {
+        s += 1;
+        if (*s == '\0' || *s == '[') return 0;
+    }
+    return s;
+}
+
+int siml_subscribe(siml_parser *p, const char *const *paths, int count,
+                   siml_skip_mode mode) {
+    int n = 0;
+    int i;
+
+    if (!p || count < 0 || count > SIML_MAX_SUBSCRIPTIONS ||
+        (count > 0 && !paths)) {
+        return 0;
+    }
+    /* Check every path before replacing the compiled ones. */
+    for (i = 0; i < count; ++i) {
+        const char *s = paths[i];
+        const char *key;
+        size_t len;
+
+        if (!s || *s == '\0') return 0;
+        while (*s != '\0') {
+            s = siml_sub_step(s, &key, &len);
+            if (!s || ++n > SIML_MAX_SUB_SEGMENTS ||
+                (size_t)(key - paths[i]) + len > 0xFFFFu) {
+                return 0;
+            }
+        }
+    }
+    n = 0;
+    for (i = 0; i < count; ++i) {
+        const char *s = paths[i];
+        const char *key;
+        size_t len;
+
+        p->sub_first[i] = (unsigned char)n;
+        while (*s != '\0') {
+            int any = (*s == '*' && (s[1] == '\0' || s[1] == '.' ||
+                                     s[1] == '['));
+            s = siml_sub_step(s, &key, &len);
+            p->sub_segs[n].off = (unsigned short)(key - paths[i]);
+            p->sub_segs[n].len = (unsigned short)(any ? 0 : len);
+            n += 1;
+        }
+    }
+    p->sub_first[count] = (unsigned char)n;
+    p->sub_paths = paths;
+    p->sub_count = count;
+    p->sub_mode  = mode;
+    siml_sub_reset(p);
+    return 1;
+}
+
+/* Match a node opening at p->sub_level + 1 below the document root against
+ * the subscriptions live at its parent. Returns 2 if some path ends at the
+ * node, 1 if some path continues below it (and records them), 0 otherwise.
+ */
+static int siml_sub_match(siml_parser *p, const siml_slice *key) {
+    int level = p->sub_level + 1;
+    unsigned long live = p->sub_mask[level - 1];
+    unsigned long below = 0;
+    int i;
+
+    for (i = 0; i < p->sub_count; ++i) {
+        int k = p->sub_first[i] + level - 2;
+        const siml_sub_seg *seg;
+
+        if (!(live & (1UL << i)) || k >= p->sub_first[i + 1]) continue;
+        seg = &p->sub_segs[k];
+        if (seg->len != 0 &&
+            !(key->len == seg->len &&
+              memcmp(key->ptr, p->sub_paths[i] + seg->off, seg->len) == 0)) {
+            continue;
+        }
+        if (k + 1 == p->sub_first[i + 1]) return 2;
+        below |= 1UL << i;
+    }
+    if (below == 0 || level > SIML_MAX_NESTING) return 0;
+    p->sub_mask[level] = below;
+    return 1;
+}
+
+static siml_event_type siml_next_filtered(siml_parser *p, siml_event *ev) {
+    siml_event_type t;
+    int match;
+
+    for (;;) {
+        if (p->sub_skipping) {
+            t = siml_skip_node(p, ev, p->sub_mode);
+            if (t == SIML_EVENT_ERROR || t == SIML_EVENT_NEED_MORE) return t;
+            p->sub_skipping = 0;
+            continue;
+        }
+        t = siml_next_raw(p, ev);
+        switch (t) {
+        case SIML_EVENT_DOCUMENT_START:
+            p->sub_level = 0;
+            p->sub_match_level = 0;
+            return t;
+        case SIML_EVENT_MAPPING_START:
+        case SIML_EVENT_SEQUENCE_START:
+        case SIML_EVENT_BLOCK_SCALAR_START:
+            if (p->sub_match_level == 0 && p->sub_level > 0) {
+                match = siml_sub_match(p, &ev->key);
+                if (match == 0 ||
+                    (match == 1 && t == SIML_EVENT_BLOCK_SCALAR_START)) {
+                    p->sub_skipping = 1;
+                    continue;
+                }
+                if (match == 2) p->sub_match_level = p->sub_level + 1;
+            }
+            p->sub_level += 1;
+            return t;
+        case SIML_EVENT_MAPPING_END:
+        case SIML_EVENT_SEQUENCE_END:
+        case SIML_EVENT_BLOCK_SCALAR_END:
+            p->sub_level -= 1;
+            if (p->sub_level < p->sub_match_level) p->sub_match_level = 0;
+            return t;
+        case SIML_EVENT_SCALAR:
+            if (p->sub_match_level == 0 && p->sub_level > 0 &&
+                siml_sub_match(p, &ev->key) != 2) {
+                continue;
+            }
+            return t;
+        case SIML_EVENT_BLOCK_SCALAR_LINE:
+        case SIML_EVENT_COMMENT:
+            if (p->sub_match_level == 0) continue;
+            return t;
+        default:
+            return t;
+        }
+    }
+}
+
+siml_event_type siml_next(siml_parser *p, siml_event *ev) {
+    siml_event_type t;
+
+    if (!p || !ev) return SIML_EVENT_ERROR;
+    t = (p->sub_count == 0) ? siml_next_raw(p, ev) : siml_next_filtered(p, ev);
+    if (p->keytab && ev->key.len > 0) {
+        ev->key_id = siml_keytab_intern(p->keytab, ev->key.ptr, ev->key.len);
+    }
+    return t;
+}
+
 static int siml_parse_mapping_entry(siml_parser *p,
                                     const char *s,
                                     size_t len,
@@ -1008,19 +2824,12 @@ static int siml_parse_mapping_entry(siml_parser *p,
                                     size_t *out_comment_len,
                                     int *out_has_inline_value) {
     size_t i;
-    int has_colon = 0;
 
     if (indent >= len) {
         siml_set_error(p, SIML_ERR_UNKNOWN_LINE_FORM, "unknown line form");
         return 0;
     }
-    for (i = indent; i < len; ++i) {
-        if (s[i] == ':') {
-            has_colon = 1;
-            break;
-        }
-    }
-    if (!has_colon) {
+    if (p->info.colon_pos >= len) {
         siml_set_error(p, SIML_ERR_UNKNOWN_LINE_FORM, "unknown line form");
         return 0;
     }
@@ -1110,11 +2919,19 @@ static int siml_parse_sequence_item(siml_parser *p,
     return 1;
 }
 
+/* Validate a flow value and build its delimiter bitmap and bracket-match
+ * table in one pass. Errors are reported for the first offending byte, as
+ * if the value were checked byte by byte.
+ */
 static int siml_prepare_flow_sequence(siml_parser *p,
                                       size_t value_start,
                                       size_t value_len) {
-    size_t i;
-    size_t end_index;
+    const char *s = p->line + value_start;
+    size_t end;
+    size_t ws = value_len;
+    size_t base;
+    size_t nopen = 0;
+    size_t cur = (size_t)(-1);
     int depth = 0;
     int saw_close = 0;
 
@@ -1123,38 +2940,115 @@ static int siml_prepare_flow_sequence(siml_parser *p,
                        "unterminated flow sequence on the same line");
         return 0;
     }
-    end_index = value_start + value_len - 1;
-
-    for (i = value_start; i <= end_index; ++i) {
-        char c = p->line[i];
-        if (c == ' ' || c == '\t') {
-            siml_set_error(p, SIML_ERR_FLOW_WHITESPACE,
-                           "flow sequence contains whitespace (forbidden)");
-            return 0;
-        }
-        if (c == '[') {
-            if (depth == 0 && i != value_start) {
-                siml_set_error(p, SIML_ERR_FLOW_EXCESS_TERM,
-                               "excess non-comment characters after flow sequence termination");
-                return 0;
+    end = value_len - 1;
+
+#if defined(SIML_HAVE_SSE2)
+    if (p->input == SIML_INPUT_BUFFER &&
+        s >= p->buffer.data + p->u.index.base &&
+        s + value_len <= p->buffer.data + p->u.index.end) {
+        /* The line is still in the index window; shift its bits over. */
+        const siml_index *x = &p->u.index;
+        size_t off = (size_t)(s - p->buffer.data) - x->base;
+        size_t vend = off + value_len;
+        size_t sp = siml_bits_first(x->space, off, vend);
+        size_t tb = siml_bits_first(x->tab, off, vend);
+        ws = (sp < tb ? sp : tb) - off;
+        for (base = 0; base < value_len; base += 32) {
+            size_t o = off + base;
+            size_t w = o / 32;
+            unsigned int sh = (unsigned int)(o % 32);
+            unsigned int d = x->delim[w] >> sh;
+            if (sh != 0 && w + 1 < SIML_INDEX_BLOCKS) {
+                d |= x->delim[w + 1] << (32 - sh);
             }
-            depth += 1;
-        } else if (c == ']') {
-            saw_close = 1;
-            depth -= 1;
-            if (depth < 0) {
-                siml_set_error(p, SIML_ERR_FLOW_EXCESS_TERM,
-                               "excess non-comment characters after flow sequence termination");
-                return 0;
+            if (value_len - base < 32) {
+                d &= (1u << (value_len - base)) - 1u;
             }
-            if (depth == 0 && i != end_index) {
-                siml_set_error(p, SIML_ERR_FLOW_EXCESS_TERM,
-                               "excess non-comment characters after flow sequence termination");
-                return 0;
+            p->flow_delims[base / 32] = d;
+        }
+    } else
+#endif
+    for (base = 0; base < value_len; base += 32) {
+        unsigned int ws_bits = 0;
+        unsigned int delim = 0;
+#if defined(SIML_HAVE_SSE2)
+        if (value_len - base < 32) {
+            char tail[32];
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, s + base, value_len - base);
+            siml_flow_classify32(tail, &ws_bits, &delim);
+        } else {
+            siml_flow_classify32(s + base, &ws_bits, &delim);
+        }
+#else
+        size_t i;
+        size_t n = value_len - base < 32 ? value_len - base : 32;
+        for (i = 0; i < n; ++i) {
+            char c = s[base + i];
+            if (c == ' ' || c == '\t') {
+                ws_bits |= 1u << i;
+            } else if (c == '[' || c == ']' || c == ',') {
+                delim |= 1u << i;
+            }
+        }
+#endif
+        p->flow_delims[base / 32] = delim;
+        if (ws == value_len && ws_bits != 0) {
+            ws = base + siml_ctz(ws_bits);
+        }
+    }
+
+    /* Match brackets before the first whitespace. While a '[' is open its
+     * table slot links to the enclosing '['. Past the table's end the value
+     * cannot balance; only the depth is followed, for the error.
+     */
+    for (base = 0; base < ws; base += 32) {
+        unsigned int bits = p->flow_delims[base / 32];
+        while (bits != 0) {
+            size_t i = base + siml_ctz(bits);
+            bits &= bits - 1;
+            if (i >= ws) break;
+            if (s[i] == '[') {
+                if (depth == 0 && i != 0) {
+                    siml_set_error(p, SIML_ERR_FLOW_EXCESS_TERM,
+                                   "excess non-comment characters after flow sequence termination");
+                    return 0;
+                }
+                depth += 1;
+                if (nopen < SIML_MAX_INLINE_VALUE_LEN / 2) {
+                    p->flow_match[nopen] = (unsigned short)cur;
+                }
+                cur = nopen++;
+            } else if (s[i] == ']') {
+                size_t parent;
+                saw_close = 1;
+                depth -= 1;
+                if (depth < 0) {
+                    siml_set_error(p, SIML_ERR_FLOW_EXCESS_TERM,
+                                   "excess non-comment characters after flow sequence termination");
+                    return 0;
+                }
+                if (depth == 0 && i != end) {
+                    siml_set_error(p, SIML_ERR_FLOW_EXCESS_TERM,
+                                   "excess non-comment characters after flow sequence termination");
+                    return 0;
+                }
+                if (cur >= SIML_MAX_INLINE_VALUE_LEN / 2) {
+                    parent = (size_t)(-1);
+                } else {
+                    parent = depth > 0 ? p->flow_match[cur] : (size_t)(-1);
+                    p->flow_match[cur] = (unsigned short)i;
+                }
+                cur = parent;
             }
         }
     }
 
+    if (ws < value_len) {
+        siml_set_error(p, SIML_ERR_FLOW_WHITESPACE,
+                       "flow sequence contains whitespace (forbidden)");
+        return 0;
+    }
     if (!saw_close) {
         siml_set_error(p, SIML_ERR_FLOW_UNTERMINATED_SAME_LINE,
                        "unterminated flow sequence on the same line");
@@ -1168,12 +3062,25 @@ static int siml_prepare_flow_sequence(siml_parser *p,
 
     p->flow_depth = 1;
     p->flow_stack_start[0] = value_start;
-    p->flow_stack_end[0] = end_index;
+    p->flow_stack_end[0] = value_start + end;
     p->flow_stack_pos[0] = value_start + 1;
     p->flow_stack_started[0] = 0;
+    p->flow_next_open = 1;
     return 1;
 }
 
+/* Offset of the first '[', ']' or ',' at or after off in the flow value.
+ * The closing ']' guarantees one exists.
+ */
+static size_t siml_flow_next_delim(const siml_parser *p, size_t off) {
+    size_t w = off / 32;
+    unsigned int bits = p->flow_delims[w] & (0xFFFFFFFFu << (off % 32));
+    while (bits == 0) {
+        bits = p->flow_delims[++w];
+    }
+    return w * 32 + siml_ctz(bits);
+}
+
 static siml_event_type siml_start_block(siml_parser *p, siml_event *ev,
                                         const char *key, size_t key_len,
                                         size_t indent,
@@ -1181,10 +3088,7 @@ static siml_event_type siml_start_block(siml_parser *p, siml_event *ev,
                                         const char *ic_ptr, size_t ic_len) {
     p->mode = SIML_MODE_BLOCK;
     p->block_indent = indent;
-    if (key_len > 0) {
-        memcpy(p->block_key, key, key_len);
-    }
-    p->block_key[key_len] = '\0';
+    p->block_key = siml_keep_key(p, p->block_key_buf, key, key_len);
     p->block_key_len = key_len;
     p->block_inline_spaces = ic_spaces;
     p->block_inline_comment = ic_ptr;
@@ -1216,10 +3120,7 @@ static siml_event_type siml_start_flow(siml_parser *p, siml_event *ev,
         return SIML_EVENT_ERROR;
     }
     p->mode = SIML_MODE_FLOW;
-    if (key_len > 0) {
-        memcpy(p->flow_key, key, key_len);
-    }
-    p->flow_key[key_len] = '\0';
+    p->flow_key = siml_keep_key(p, p->flow_key_buf, key, key_len);
     p->flow_key_len = key_len;
     p->flow_inline_spaces = ic_spaces;
     p->flow_inline_comment = ic_ptr;
@@ -1328,25 +3229,8 @@ static siml_event_type siml_next_flow(siml_parser *p, siml_event *ev) {
         }
 
         if (s[pos] == '[') {
-            size_t i = pos;
-            int nest = 0;
-            size_t match = (size_t)(-1);
-            while (i <= end) {
-                if (s[i] == '[') nest += 1;
-                else if (s[i] == ']') {
-                    nest -= 1;
-                    if (nest == 0) {
-                        match = i;
-                        break;
-                    }
-                }
-                ++i;
-            }
-            if (match == (size_t)(-1) || match > end) {
-                siml_set_error(p, SIML_ERR_FLOW_UNTERMINATED,
-                               "unterminated flow sequence");
-                return SIML_EVENT_ERROR;
-            }
+            size_t match = p->flow_stack_start[0] +
+                           p->flow_match[p->flow_next_open++];
 
             p->flow_stack_pos[depth] = match + 1;
             if (p->flow_stack_pos[depth] < end) {
@@ -1385,12 +3269,9 @@ static siml_event_type siml_next_flow(siml_parser *p, siml_event *ev) {
         }
 
         {
-            size_t i = pos;
+            size_t base = p->flow_stack_start[0];
+            size_t i = base + siml_flow_next_delim(p, pos - base);
             size_t item_len;
-            while (i < end && s[i] != ',') {
-                if (s[i] == '[' || s[i] == ']') break;
-                ++i;
-            }
             if (i <= pos) {
                 siml_set_error(p, SIML_ERR_FLOW_EMPTY_ELEM,
                                "empty flow sequence element");
@@ -1456,6 +3337,11 @@ static siml_event_type siml_next_block(siml_parser *p, siml_event *ev) {
         if (!p->have_line) {
             rc = siml_fetch_line(p);
             if (rc < 0) return SIML_EVENT_ERROR;
+            if (rc == 2) {
+                ev->type = SIML_EVENT_NEED_MORE;
+                ev->line = p->line_no;
+                return ev->type;
+            }
             if (rc == 0) {
                 if (!p->block_seen_content) {
                     siml_set_error(p, SIML_ERR_BLOCK_EMPTY,
@@ -1491,7 +3377,9 @@ static siml_event_type siml_next_block(siml_parser *p, siml_event *ev) {
             continue;
         }
 
-        if (siml_is_space_or_tab_only(p->line, p->line_len)) {
+        if (p->info.indent == p->line_len ||
+            (p->info.tab_pos < p->line_len &&
+             siml_is_space_or_tab_only(p->line, p->line_len))) {
             siml_set_error(p, SIML_ERR_BLOCK_WHITESPACE_ONLY,
                            "whitespace-only lines are forbidden in block literal content");
             return SIML_EVENT_ERROR;
@@ -1504,15 +3392,10 @@ static siml_event_type siml_next_block(siml_parser *p, siml_event *ev) {
         }
 
         {
-            size_t indent = 0;
-            size_t i;
+            size_t indent = p->info.indent;
             const char *s = p->line;
             size_t len = p->line_len;
 
-            for (i = 0; i < len && s[i] == ' '; ++i) {
-                indent += 1;
-            }
-
             if (indent < p->block_indent + 2) {
                 if (!p->block_seen_content) {
                     siml_set_error(p, SIML_ERR_BLOCK_EMPTY,
@@ -1588,6 +3471,11 @@ static siml_event_type siml_next_normal(siml_parser *p, siml_event *ev) {
         if (!p->have_line) {
             rc = siml_fetch_line(p);
             if (rc < 0) return SIML_EVENT_ERROR;
+            if (rc == 2) {
+                ev->type = SIML_EVENT_NEED_MORE;
+                ev->line = p->line_no;
+                return ev->type;
+            }
             if (rc == 0) {
                 if (p->pending_kind == SIML_PENDING_MAP) {
                     siml_set_error(p, SIML_ERR_HEADER_MAP_NO_NESTED,
@@ -1624,14 +3512,10 @@ static siml_event_type siml_next_normal(siml_parser *p, siml_event *ev) {
 
         {
             const char *s = p->line;
-            size_t trimmed_len = p->line_len;
-            int has_trailing_spaces = 0;
+            size_t trimmed_len = p->info.trimmed_len;
+            int has_trailing_spaces = (trimmed_len != p->line_len);
             size_t indent = 0;
             int comment_rc;
-            while (trimmed_len > 0 && s[trimmed_len - 1] == ' ') {
-                trimmed_len -= 1;
-            }
-            has_trailing_spaces = (trimmed_len != p->line_len);
 
             comment_rc = siml_parse_comment_line(p, s, trimmed_len, &indent);
             if (comment_rc < 0) return SIML_EVENT_ERROR;
@@ -1680,7 +3564,7 @@ static siml_event_type siml_next_normal(siml_parser *p, siml_event *ev) {
             int is_sequence = 0;
             siml_container *cur = 0;
 
-            if (!siml_count_indent(p, s, len, &indent)) return SIML_EVENT_ERROR;
+            if (!siml_count_indent(p, &indent)) return SIML_EVENT_ERROR;
 
             if (indent == 0 && len >= 3 && s[0] == '-' && s[1] == '-' && s[2] == '-') {
                 if (has_trailing_spaces && len == 3) {
@@ -1712,15 +3596,8 @@ static siml_event_type siml_next_normal(siml_parser *p, siml_event *ev) {
                     return siml_emit_pending_end(p, ev);
                 }
                 {
-                    size_t i;
-                    int found_hash = 0;
-                    for (i = 3; i < len; ++i) {
-                        if (s[i] == '#' && s[i - 1] == ' ') {
-                            found_hash = 1;
-                            break;
-                        }
-                    }
-                    if (found_hash) {
+                    size_t i = p->info.hash_pos;
+                    if (i < len) {
                         if (i + 1 >= len) {
                             siml_set_error(p, SIML_ERR_EMPTY_COMMENT,
                                            "empty comment is forbidden");
@@ -1794,7 +3671,6 @@ static siml_event_type siml_next_normal(siml_parser *p, siml_event *ev) {
                     }
                 }
                 p->pending_kind = SIML_PENDING_NONE;
-                p->pending_key[0] = '\0';
                 p->pending_key_len = 0;
                 return siml_emit_pending_start(p, ev);
             }
@@ -1880,8 +3756,8 @@ static siml_event_type siml_next_normal(siml_parser *p, siml_event *ev) {
                 if (!has_inline_value) {
                     p->pending_kind = SIML_PENDING_MAP;
                     p->pending_indent = indent + 2;
-                    memcpy(p->pending_key, s + indent, key_len);
-                    p->pending_key[key_len] = '\0';
+                    p->pending_key = siml_keep_key(p, p->pending_key_buf,
+                                                   s + indent, key_len);
                     p->pending_key_len = key_len;
                     p->have_line = 0;
                     continue;
@@ -1910,7 +3786,6 @@ static siml_event_type siml_next_normal(siml_parser *p, siml_event *ev) {
             if (!has_inline_value) {
                 p->pending_kind = SIML_PENDING_SEQ;
                 p->pending_indent = indent + 2;
-                p->pending_key[0] = '\0';
                 p->pending_key_len = 0;
                 p->have_line = 0;
                 continue;
@@ -1926,6 +3801,830 @@ static siml_event_type siml_next_normal(siml_parser *p, siml_event *ev) {
     }
 }
 
+/* Content hash ------------------------------------------------------------
+ *
+ * 128 bits over a buffer, read once in 32-byte stripes: each 64-bit lane
+ * adds the product of its two halves, mixed with a secret that differs from
+ * stripe to stripe, to an accumulator, and the accumulators are scrambled
+ * every 16 stripes (the scheme of XXH3). With SSE2 that is a few
+ * instructions per 16 bytes, close to memory bandwidth; the portable code
+ * gives the same hash. It is not a cryptographic hash. Tapes and the
+ * companion headers' caches and indexes tie themselves to a source with it.
+ */
+
+/* xxHash32 primes */
+#define SIML_HASH_P1 2654435761u
+#define SIML_HASH_P2 2246822519u
+#define SIML_HASH_P3 3266489917u
+#define SIML_HASH_P4 668265263u
+
+#define SIML_HASH_ROTL(x, r) (((x) << (r)) | ((x) >> (32 - (r))))
+
+/* The hash takes the input in 32-byte stripes and scrambles its
+ * accumulators after every block of 16 stripes.
+ */
+#define SIML_HASH_STRIPE 32
+#define SIML_HASH_BLOCK  16
+
+/* Stripe i of a block is mixed with words 2i to 2i + 7, so stripes do not
+ * commute; words 32 to 39 seed the accumulators and 40 to 47 scramble them.
+ */
+static const unsigned int siml_hash_secret[48] = {
+    0x02CC5D05u, 0x36B78AE7u, 0x08CEBFB5u, 0x0B1ECB12u,
+    0xBAD920C6u, 0xB84848ECu, 0xBAE256A4u, 0x22688433u,
+    0xCF04453Eu, 0x2C8033BDu, 0x05469C1Bu, 0x9032317Du,
+    0x6AD03357u, 0x3CFC0DE0u, 0x82A88C11u, 0x07F352ACu,
+    0x606B5C60u, 0xB3A55030u, 0x13CEA67Eu, 0xDC49989Eu,
+    0x0DD2496Du, 0xED6C08E3u, 0x005C9756u, 0xAF9E7090u,
+    0x2B4DE8DCu, 0x8899C160u, 0x64E230B6u, 0xE8CB6106u,
+    0xABBCE26Du, 0x0121F28Fu, 0x60C72320u, 0x2018601Eu,
+    0x6FE07D4Cu, 0x1DA518DAu, 0x43461B07u, 0xCDF84E1Bu,
+    0x276342D4u, 0xA0F5320Bu, 0xCA41BC5Bu, 0x6FCC1E11u,
+    0x04E1F01Eu, 0x8557DE6Au, 0x5C088AEEu, 0xAFA09053u,
+    0xE46F8897u, 0xF4F9091Eu, 0xA991ADF2u, 0x6EED51A2u
+};
+
+/* The hash works on 32-bit unsigned int, as the bitmasks do. Its
+ * four 64-bit accumulators are kept as eight words, low word first, which
+ * is also their layout in SSE2 registers.
+ */
+#if defined(SIML_HAVE_SSE2)
+/* Add, for each 64-bit lane of n stripes at p, the product of its two
+ * words mixed with the secret, and add the lane itself to its neighbour.
+ */
+static void siml_hash_accumulate(unsigned int acc[8], const unsigned char *p,
+                                  size_t n, const unsigned int *key) {
+    __m128i a0 = _mm_loadu_si128((const __m128i *)acc);
+    __m128i a1 = _mm_loadu_si128((const __m128i *)(acc + 4));
+    size_t i;
+
+    for (i = 0; i < n; ++i, p += SIML_HASH_STRIPE, key += 2) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)p);
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(p + 16));
+        __m128i k0 = _mm_xor_si128(v0, _mm_loadu_si128((const __m128i *)key));
+        __m128i k1 = _mm_xor_si128(v1,
+                                   _mm_loadu_si128((const __m128i *)(key + 4)));
+
+        a0 = _mm_add_epi64(a0, _mm_mul_epu32(k0, _mm_shuffle_epi32(k0, 0x31)));
+        a1 = _mm_add_epi64(a1, _mm_mul_epu32(k1, _mm_shuffle_epi32(k1, 0x31)));
+        a0 = _mm_add_epi64(a0, _mm_shuffle_epi32(v0, 0x4E));
+        a1 = _mm_add_epi64(a1, _mm_shuffle_epi32(v1, 0x4E));
+    }
+    _mm_storeu_si128((__m128i *)acc, a0);
+    _mm_storeu_si128((__m128i *)(acc + 4), a1);
+}
+
+/* acc = (acc ^ (acc >> 47) ^ secret) * P1, per 64-bit lane. */
+static void siml_hash_scramble(unsigned int acc[8]) {
+    const __m128i prime = _mm_set1_epi32((int)SIML_HASH_P1);
+    int k;
+
+    for (k = 0; k < 8; k += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(acc + k));
+        __m128i hi;
+
+        a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+        a = _mm_xor_si128(
+            a, _mm_loadu_si128((const __m128i *)(siml_hash_secret + 40 + k)));
+        hi = _mm_mul_epu32(_mm_shuffle_epi32(a, 0x31), prime);
+        a = _mm_add_epi64(_mm_mul_epu32(a, prime), _mm_slli_epi64(hi, 32));
+        _mm_storeu_si128((__m128i *)(acc + k), a);
+    }
+}
+#else
+/* (*hi, *lo) = a * b */
+static void siml_hash_mul(unsigned int a, unsigned int b, unsigned int *lo,
+                           unsigned int *hi) {
+    unsigned int p00 = (a & 0xFFFFu) * (b & 0xFFFFu);
+    unsigned int p01 = (a & 0xFFFFu) * (b >> 16);
+    unsigned int p10 = (a >> 16) * (b & 0xFFFFu);
+    unsigned int mid = (p00 >> 16) + (p01 & 0xFFFFu) + (p10 & 0xFFFFu);
+
+    *lo = (mid << 16) | (p00 & 0xFFFFu);
+    *hi = (a >> 16) * (b >> 16) + (p01 >> 16) + (p10 >> 16) + (mid >> 16);
+}
+
+/* (a[1], a[0]) += (hi, lo) */
+static void siml_hash_add(unsigned int *a, unsigned int lo, unsigned int hi) {
+    a[0] += lo;
+    a[1] += hi + (a[0] < lo);
+}
+
+static void siml_hash_accumulate(unsigned int acc[8], const unsigned char *p,
+                                  size_t n, const unsigned int *key) {
+    size_t i;
+    int j;
+
+    for (i = 0; i < n; ++i, p += SIML_HASH_STRIPE, key += 2) {
+        for (j = 0; j < 4; ++j) {
+            unsigned int lo = (unsigned int)siml_get32(p + 8 * j);
+            unsigned int hi = (unsigned int)siml_get32(p + 8 * j + 4);
+            unsigned int plo;
+            unsigned int phi;
+
+            siml_hash_mul(lo ^ key[2 * j], hi ^ key[2 * j + 1], &plo, &phi);
+            siml_hash_add(acc + 2 * j, plo, phi);
+            siml_hash_add(acc + 2 * (j ^ 1), lo, hi);
+        }
+    }
+}
+
+static void siml_hash_scramble(unsigned int acc[8]) {
+    int j;
+
+    for (j = 0; j < 8; j += 2) {
+        unsigned int lo = acc[j] ^ (acc[j + 1] >> 15) ^ siml_hash_secret[40 + j];
+        unsigned int hi = acc[j + 1] ^ siml_hash_secret[41 + j];
+
+        siml_hash_mul(lo, SIML_HASH_P1, &acc[j], &acc[j + 1]);
+        acc[j + 1] += hi * SIML_HASH_P1;
+    }
+}
+#endif
+
+static unsigned int siml_hash_avalanche(unsigned int h) {
+    h ^= h >> 15;
+    h *= SIML_HASH_P2;
+    h ^= h >> 13;
+    h *= SIML_HASH_P3;
+    return h ^ (h >> 16);
+}
+
+static void siml_hash128(const char *data, size_t len,
+                         unsigned char key[16]) {
+    const unsigned char *s = (const unsigned char *)data;
+    const size_t block = SIML_HASH_STRIPE * SIML_HASH_BLOCK;
+    unsigned char last[SIML_HASH_STRIPE];
+    unsigned int acc[8];
+    unsigned int lane[4];
+    unsigned int t[4];
+    size_t i = 0;
+    size_t n;
+    int k;
+    int pass;
+
+    memcpy(acc, siml_hash_secret + 32, sizeof(acc));
+    for (; len - i >= block; i += block) {
+        siml_hash_accumulate(acc, s + i, SIML_HASH_BLOCK, siml_hash_secret);
+        siml_hash_scramble(acc);
+    }
+    n = (len - i) / SIML_HASH_STRIPE;
+    siml_hash_accumulate(acc, s + i, n, siml_hash_secret);
+    i += n * SIML_HASH_STRIPE;
+    if (i < len) {
+        /* The last partial stripe, padded with zeros */
+        memset(last, 0, sizeof(last));
+        memcpy(last, s + i, len - i);
+        siml_hash_accumulate(acc, last, 1, siml_hash_secret + 2 * n);
+    }
+
+    /* Fold the accumulators into four words with the length, then mix each
+     * word with its neighbours, so that every output word depends on every
+     * accumulator.
+     */
+    for (k = 0; k < 4; ++k) {
+        lane[k] = acc[k] + SIML_HASH_ROTL(acc[k + 4], 7);
+        lane[k] += (unsigned int)len + (unsigned int)k * SIML_HASH_P4;
+        lane[k] ^= (unsigned int)((len >> 16) >> 16);
+        lane[k] = siml_hash_avalanche(lane[k]);
+    }
+    for (pass = 1; pass <= 2; ++pass) {
+        for (k = 0; k < 4; ++k) {
+            t[k] = lane[k] + SIML_HASH_ROTL(lane[(k + pass) & 3], 17);
+        }
+        for (k = 0; k < 4; ++k) lane[k] = siml_hash_avalanche(t[k]);
+    }
+    for (k = 0; k < 4; ++k) {
+        siml_put32(key + 4 * k, (unsigned long)lane[k]);
+    }
+}
+
+/* Event tape ------------------------------------------------------------ */
+
+/* Type byte: the event type in the low bits and what follows in the high. */
+#define SIML_TAPE_TYPE_MASK 0x0Fu
+#define SIML_TAPE_KEY       0x10u
+#define SIML_TAPE_VALUE     0x20u
+#define SIML_TAPE_COMMENT   0x40u
+#define SIML_TAPE_FLOW      0x80u
+
+static const char siml_tape_magic[8] = { 'S', 'I', 'M', 'L', 'T', 'A', 'P', '2' };
+
+/* What besides the source decides the events of a parse. The header is
+ * the magic, the source length, these, and the content hash of the source.
+ */
+#define SIML_TAPE_SETUP 11
+
+static void siml_tape_setup(size_t words[SIML_TAPE_SETUP], int validate_utf8) {
+    words[0] = SIML_PARSER_REVISION;
+    words[1] = validate_utf8 ? 1u : 0u;
+    words[2] = SIML_MAX_KEY_LEN;
+    words[3] = SIML_MAX_NESTING;
+    words[4] = SIML_MAX_LINE_LEN;
+    words[5] = SIML_MAX_INLINE_VALUE_LEN;
+    words[6] = SIML_MAX_FLOW_ELEMENT_LEN;
+    words[7] = SIML_MAX_COMMENT_TEXT_LEN;
+    words[8] = SIML_MAX_INLINE_COMMENT_TEXT_LEN;
+    words[9] = SIML_MAX_INLINE_COMMENT_SPACES;
+    words[10] = SIML_MAX_BLOCK_LINE_LEN;
+}
+
+static size_t siml_tape_put_varint(char *out, size_t n, size_t v) {
+    while (v >= 0x80u) {
+        out[n++] = (char)(unsigned char)(v | 0x80u);
+        v >>= 7;
+    }
+    out[n++] = (char)(unsigned char)v;
+    return n;
+}
+
+/* Signed difference b - a, zigzag-encoded. */
+static size_t siml_tape_put_delta(char *out, size_t n, size_t a, size_t b) {
+    return siml_tape_put_varint(out, n, b >= a ? (b - a) * 2
+                                               : (a - b) * 2 - 1);
+}
+
+/* Empty slices may point into the parser; they replay at the current
+ * position.
+ */
+static size_t siml_tape_put_slice(siml_tape_writer *w, char *out, size_t n,
+                                  const siml_slice *s) {
+    size_t off = s->len > 0 ? (size_t)(s->ptr - w->base) : w->pos;
+
+    n = siml_tape_put_delta(out, n, w->pos, off);
+    n = siml_tape_put_varint(out, n, s->len);
+    w->pos = off + s->len;
+    return n;
+}
+
+static int siml_tape_in_source(const siml_tape_writer *w, const siml_slice *s) {
+    return !s->ptr || s->len == 0 ||
+           (s->ptr >= w->base && s->len <= w->len &&
+            (size_t)(s->ptr - w->base) <= w->len - s->len);
+}
+
+void siml_tape_writer_init(siml_tape_writer *w, const char *data, size_t len) {
+    if (!w) return;
+    w->validate_utf8 = SIML_VALIDATE_UTF8;
+    w->base = data;
+    w->len = len;
+    w->pos = 0;
+    w->line = 0;
+}
+
+size_t siml_tape_write_header(siml_tape_writer *w, char *out) {
+    size_t words[SIML_TAPE_SETUP];
+    size_t n;
+    int k;
+
+    if (!w || !out) return 0;
+    memcpy(out, siml_tape_magic, sizeof(siml_tape_magic));
+    n = siml_tape_put_varint(out, sizeof(siml_tape_magic), w->len);
+    siml_tape_setup(words, w->validate_utf8);
+    for (k = 0; k < SIML_TAPE_SETUP; ++k) {
+        n = siml_tape_put_varint(out, n, words[k]);
+    }
+    siml_hash128(w->base, w->len, (unsigned char *)out + n);
+    return n + 16;
+}
+
+size_t siml_tape_write(siml_tape_writer *w, siml_event_type t,
+                       const siml_event *ev, char *out) {
+    unsigned int type = (unsigned int)t;
+    size_t n = 1;
+    long line;
+
+    if (!w || !ev || !out) return 0;
+    if (t == SIML_EVENT_NONE || t == SIML_EVENT_NEED_MORE) return 0;
+    if (!siml_tape_in_source(w, &ev->key) ||
+        !siml_tape_in_source(w, &ev->value) ||
+        !siml_tape_in_source(w, &ev->inline_comment) ||
+        (ev->inline_comment_spaces != 0 && !ev->inline_comment.ptr)) {
+        return 0;
+    }
+    if (ev->key.ptr) type |= SIML_TAPE_KEY;
+    if (ev->value.ptr) type |= SIML_TAPE_VALUE;
+    if (ev->inline_comment.ptr) type |= SIML_TAPE_COMMENT;
+    if (ev->seq_style == SIML_SEQ_STYLE_FLOW) type |= SIML_TAPE_FLOW;
+    out[0] = (char)(unsigned char)type;
+
+    line = ev->line < 0 ? 0 : ev->line;
+    n = siml_tape_put_delta(out, n, (size_t)w->line, (size_t)line);
+    w->line = line;
+    if (ev->key.ptr) n = siml_tape_put_slice(w, out, n, &ev->key);
+    if (ev->value.ptr) n = siml_tape_put_slice(w, out, n, &ev->value);
+    if (ev->inline_comment.ptr) {
+        n = siml_tape_put_varint(out, n, ev->inline_comment_spaces);
+        n = siml_tape_put_slice(w, out, n, &ev->inline_comment);
+    }
+    if (t == SIML_EVENT_ERROR) {
+        const char *msg = ev->error_message ? ev->error_message : "parse error";
+        size_t len = strlen(msg);
+
+        if (len > SIML_TAPE_MAX_RECORD - 160) len = SIML_TAPE_MAX_RECORD - 160;
+        n = siml_tape_put_varint(out, n, (size_t)ev->error_code);
+        n = siml_tape_put_varint(out, n, len);
+        memcpy(out + n, msg, len);
+        n += len;
+        out[n++] = '\0';
+    }
+    return n;
+}
+
+/* Read a varint; 0 past the end of the tape or on overflow. */
+static int siml_tape_get_varint(siml_tape_reader *r, size_t *out) {
+    size_t v = 0;
+    unsigned int shift = 0;
+
+    while (r->cur < r->end) {
+        unsigned int b = *r->cur++;
+        if (shift >= sizeof(size_t) * 8) return 0;
+        v |= (size_t)(b & 0x7Fu) << shift;
+        if (b < 0x80u) {
+            *out = v;
+            return 1;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+static int siml_tape_get_delta(siml_tape_reader *r, size_t base,
+                               size_t *out) {
+    size_t z;
+
+    if (!siml_tape_get_varint(r, &z)) return 0;
+    if (z & 1u) {
+        z = (z >> 1) + 1;
+        if (z > base) return 0;
+        *out = base - z;
+    } else {
+        *out = base + (z >> 1);
+        if (*out < base) return 0;
+    }
+    return 1;
+}
+
+static int siml_tape_get_slice(siml_tape_reader *r, siml_slice *s) {
+    size_t off;
+    size_t len;
+
+    if (!siml_tape_get_delta(r, r->pos, &off) ||
+        !siml_tape_get_varint(r, &len) ||
+        off > r->len || len > r->len - off) {
+        return 0;
+    }
+    s->ptr = r->base + off;
+    s->len = len;
+    r->pos = off + len;
+    return 1;
+}
+
+int siml_tape_reader_init(siml_tape_reader *r, const char *tape,
+                          size_t tape_len, const char *data, size_t len,
+                          int validate_utf8) {
+    size_t words[SIML_TAPE_SETUP];
+    unsigned char h[16];
+    size_t src_len;
+    size_t v;
+    int k;
+
+    if (!r || !tape) return 0;
+    r->base = data;
+    r->len = len;
+    r->cur = (const unsigned char *)tape;
+    r->end = r->cur + tape_len;
+    r->pos = 0;
+    r->line = 0;
+    r->done = 0;
+    if (tape_len < sizeof(siml_tape_magic) ||
+        memcmp(tape, siml_tape_magic, sizeof(siml_tape_magic)) != 0) {
+        return 0;
+    }
+    r->cur += sizeof(siml_tape_magic);
+    if (!siml_tape_get_varint(r, &src_len) || src_len != len) return 0;
+    siml_tape_setup(words, validate_utf8);
+    for (k = 0; k < SIML_TAPE_SETUP; ++k) {
+        if (!siml_tape_get_varint(r, &v) || v != words[k]) return 0;
+    }
+    if (r->end - r->cur < 16) return 0;
+    siml_hash128(data, len, h);
+    if (memcmp(h, r->cur, 16) != 0) return 0;
+    r->cur += 16;
+    return 1;
+}
+
+siml_event_type siml_tape_next(siml_tape_reader *r, siml_event *ev) {
+    unsigned int type;
+    size_t line;
+
+    if (!r || !ev) return SIML_EVENT_ERROR;
+    if (r->done) {
+        *ev = r->final;
+        return ev->type;
+    }
+    siml_clear_event(ev);
+    if (r->cur >= r->end) goto damaged;
+
+    type = *r->cur++;
+    if ((type & SIML_TAPE_TYPE_MASK) == SIML_EVENT_NONE ||
+        (type & SIML_TAPE_TYPE_MASK) >= SIML_EVENT_NEED_MORE ||
+        !siml_tape_get_delta(r, (size_t)r->line, &line)) {
+        goto damaged;
+    }
+    r->line = (long)line;
+    ev->line = r->line;
+    if ((type & SIML_TAPE_KEY) && !siml_tape_get_slice(r, &ev->key)) {
+        goto damaged;
+    }
+    if ((type & SIML_TAPE_VALUE) && !siml_tape_get_slice(r, &ev->value)) {
+        goto damaged;
+    }
+    if (type & SIML_TAPE_COMMENT) {
+        size_t spaces;
+        if (!siml_tape_get_varint(r, &spaces) ||
+            !siml_tape_get_slice(r, &ev->inline_comment)) {
+            goto damaged;
+        }
+        ev->inline_comment_spaces = (unsigned int)spaces;
+    }
+    if (type & SIML_TAPE_FLOW) ev->seq_style = SIML_SEQ_STYLE_FLOW;
+    ev->type = (siml_event_type)(type & SIML_TAPE_TYPE_MASK);
+    if (ev->type == SIML_EVENT_ERROR) {
+        size_t code;
+        size_t len;
+        if (!siml_tape_get_varint(r, &code) ||
+            !siml_tape_get_varint(r, &len) ||
+            (size_t)(r->end - r->cur) <= len || r->cur[len] != '\0') {
+            goto damaged;
+        }
+        ev->error_code = (siml_error_code)code;
+        ev->error_message = (const char *)r->cur;
+        r->cur += len + 1;
+    }
+    if (ev->type == SIML_EVENT_STREAM_END || ev->type == SIML_EVENT_ERROR) {
+        /* Like a parser, keep reporting the end or the error. */
+        r->final = *ev;
+        r->done = 1;
+    }
+    return ev->type;
+
+damaged:
+    siml_clear_event(ev);
+    ev->type = SIML_EVENT_ERROR;
+    ev->error_code = SIML_ERR_IO;
+    ev->error_message = "damaged event tape";
+    ev->line = r->line;
+    r->final = *ev;
+    r->done = 1;
+    return ev->type;
+}
+
+/* Emitter --------------------------------------------------------------- */
+
+void siml_emitter_init(siml_emitter *e, char *buf, size_t cap,
+                       siml_write_fn write, void *userdata) {
+    if (!e) return;
+    memset(e, 0, sizeof(*e));
+    e->buf = buf;
+    e->cap = buf ? cap : 0;
+    e->write = write;
+    e->userdata = userdata;
+}
+
+static int siml_emit_fail(siml_emitter *e) {
+    e->failed = 1;
+    return 0;
+}
+
+static int siml_emit_write(siml_emitter *e, const siml_slice *pieces,
+                           int count) {
+    if (!e->write || !e->write(e->userdata, pieces, count)) {
+        return siml_emit_fail(e);
+    }
+    return 1;
+}
+
+int siml_emit_flush(siml_emitter *e) {
+    siml_slice piece;
+
+    if (!e || e->failed) return 0;
+    if (e->len == 0) return 1;
+    piece.ptr = e->buf;
+    piece.len = e->len;
+    e->len = 0;
+    return siml_emit_write(e, &piece, 1);
+}
+
+/* Append n bytes that do not fit: fill the buffer and flush it, or hand
+ * them over after the buffered text when they would not fit an empty one.
+ */
+static int siml_emit_put_slow(siml_emitter *e, const char *s, size_t n) {
+    siml_slice pieces[2];
+    size_t room;
+
+    if (e->failed) return 0;
+    if (n >= e->cap) {
+        pieces[0].ptr = e->buf;
+        pieces[0].len = e->len;
+        pieces[1].ptr = s;
+        pieces[1].len = n;
+        e->len = 0;
+        if (pieces[0].len == 0) return siml_emit_write(e, pieces + 1, 1);
+        return siml_emit_write(e, pieces, 2);
+    }
+    room = e->cap - e->len;
+    memcpy(e->buf + e->len, s, room);
+    e->len = e->cap;
+    if (!siml_emit_flush(e)) return 0;
+    memcpy(e->buf, s + room, n - room);
+    e->len = n - room;
+    return 1;
+}
+
+static int siml_emit_put(siml_emitter *e, const char *s, size_t n) {
+    if (n > e->cap - e->len) return siml_emit_put_slow(e, s, n);
+    if (n > 0) {
+        memcpy(e->buf + e->len, s, n);
+        e->len += n;
+    }
+    return 1;
+}
+
+static int siml_emit_spaces(siml_emitter *e, size_t n) {
+    static const char spaces[] = "                                ";
+
+    while (n > sizeof(spaces) - 1) {
+        if (!siml_emit_put(e, spaces, sizeof(spaces) - 1)) return 0;
+        n -= sizeof(spaces) - 1;
+    }
+    return siml_emit_put(e, spaces, n);
+}
+
+static int siml_emit_in_sequence(const siml_emitter *e) {
+    return e->depth > 0 && e->stack[e->depth - 1] == SIML_CONTAINER_SEQ;
+}
+
+/* Start the line of a node: "key:" or "-", then a space if a value
+ * follows on the same line. The root container does not indent. Written
+ * in place when it fits, which is the common case.
+ */
+static int siml_emit_prefix(siml_emitter *e, const char *key, size_t key_len,
+                            int inline_value) {
+    size_t indent = e->depth > 1 ? (size_t)(e->depth - 1) * 2 : 0;
+    int in_sequence = siml_emit_in_sequence(e);
+
+    if (indent + (in_sequence ? 0 : key_len) + 2 <= e->cap - e->len) {
+        char *out = e->buf + e->len;
+
+        memset(out, ' ', indent);
+        out += indent;
+        if (in_sequence) {
+            *out++ = '-';
+        } else {
+            if (key_len > 0) memcpy(out, key, key_len);
+            out += key_len;
+            *out++ = ':';
+        }
+        if (inline_value) *out++ = ' ';
+        e->len = (size_t)(out - e->buf);
+        return 1;
+    }
+    if (!siml_emit_spaces(e, indent)) return 0;
+    if (in_sequence) return siml_emit_put(e, "- ", inline_value ? 2 : 1);
+    return siml_emit_put(e, key, key_len) &&
+           siml_emit_put(e, ": ", inline_value ? 2 : 1);
+}
+
+/* End a line, with inline comment text if there is any. */
+static int siml_emit_line_end(siml_emitter *e, unsigned int spaces,
+                              const char *text, size_t len) {
+    if (len == 0 && e->len < e->cap) {
+        e->buf[e->len++] = '\n';
+        return 1;
+    }
+    if (len > 0 && (!siml_emit_spaces(e, spaces) ||
+                    !siml_emit_put(e, "# ", 2) ||
+                    !siml_emit_put(e, text, len))) {
+        return 0;
+    }
+    return siml_emit_put(e, "\n", 1);
+}
+
+/* End a line with the pending inline comment, which is used up. */
+static int siml_emit_comment_end(siml_emitter *e) {
+    size_t len = e->comment_len;
+
+    e->comment_len = 0;
+    return siml_emit_line_end(e, e->comment_spaces, e->comment, len);
+}
+
+static int siml_emit_separator(siml_emitter *e) {
+    if (!e->document_end) return 1;
+    e->document_end = 0;
+    return siml_emit_put(e, "---\n", 4);
+}
+
+int siml_emit_document_start(siml_emitter *e) {
+    if (!e || e->failed) return 0;
+    return siml_emit_separator(e);
+}
+
+int siml_emit_document_end(siml_emitter *e) {
+    if (!e || e->failed) return 0;
+    e->document_end = 1;
+    return 1;
+}
+
+static int siml_emit_open(siml_emitter *e, siml_container_type type,
+                          const char *key, size_t key_len) {
+    if (e->flow > 0 || e->depth >= SIML_MAX_NESTING) return siml_emit_fail(e);
+    if ((key_len > 0 || siml_emit_in_sequence(e)) &&
+        (!siml_emit_prefix(e, key, key_len, 0) ||
+         !siml_emit_put(e, "\n", 1))) {
+        return 0;
+    }
+    e->stack[e->depth++] = (unsigned char)type;
+    return 1;
+}
+
+int siml_emit_mapping_start(siml_emitter *e, const char *key, size_t key_len) {
+    if (!e || e->failed) return 0;
+    return siml_emit_open(e, SIML_CONTAINER_MAP, key, key_len);
+}
+
+int siml_emit_sequence_start(siml_emitter *e, const char *key, size_t key_len,
+                             siml_seq_style style) {
+    if (!e || e->failed) return 0;
+    if (style != SIML_SEQ_STYLE_FLOW) {
+        return siml_emit_open(e, SIML_CONTAINER_SEQ, key, key_len);
+    }
+    if (e->flow == 0) {
+        if (!siml_emit_prefix(e, key, key_len, 1)) return 0;
+    } else if (!e->flow_first && !siml_emit_put(e, ",", 1)) {
+        return 0;
+    }
+    e->flow += 1;
+    e->flow_first = 1;
+    return siml_emit_put(e, "[", 1);
+}
+
+/* Close the innermost node, which must be of the given type. A flow
+ * sequence ends its line once the outermost one is closed.
+ */
+static int siml_emit_close(siml_emitter *e, siml_container_type type) {
+    if (e->flow > 0) {
+        if (type != SIML_CONTAINER_SEQ) return siml_emit_fail(e);
+        e->flow -= 1;
+        e->flow_first = 0;
+        if (!siml_emit_put(e, "]", 1)) return 0;
+        return e->flow > 0 || siml_emit_comment_end(e);
+    }
+    if (e->depth == 0 || e->stack[e->depth - 1] != type) {
+        return siml_emit_fail(e);
+    }
+    e->depth -= 1;
+    return 1;
+}
+
+int siml_emit_end(siml_emitter *e) {
+    if (!e || e->failed) return 0;
+    if (e->flow == 0 && e->depth == 0) return siml_emit_fail(e);
+    return siml_emit_close(e, e->flow > 0 ? SIML_CONTAINER_SEQ
+                                          : (siml_container_type)
+                                                e->stack[e->depth - 1]);
+}
+
+static int siml_emit_scalar_line(siml_emitter *e, const char *key,
+                                 size_t key_len, const char *value,
+                                 size_t value_len, unsigned int spaces,
+                                 const char *text, size_t len) {
+    if (e->flow > 0) {
+        if (!e->flow_first && !siml_emit_put(e, ",", 1)) return 0;
+        e->flow_first = 0;
+        return siml_emit_put(e, value, value_len);
+    }
+    return siml_emit_prefix(e, key, key_len, 1) &&
+           siml_emit_put(e, value, value_len) &&
+           siml_emit_line_end(e, spaces, text, len);
+}
+
+int siml_emit_scalar(siml_emitter *e, const char *key, size_t key_len,
+                     const char *value, size_t value_len) {
+    size_t len = 0;
+
+    if (!e || e->failed) return 0;
+    if (e->flow == 0) {
+        len = e->comment_len;
+        e->comment_len = 0;
+    }
+    return siml_emit_scalar_line(e, key, key_len, value, value_len,
+                                 e->comment_spaces, e->comment, len);
+}
+
+static int siml_emit_block_line_start(siml_emitter *e, const char *key,
+                                      size_t key_len, unsigned int spaces,
+                                      const char *text, size_t len) {
+    if (e->flow > 0) return siml_emit_fail(e);
+    return siml_emit_prefix(e, key, key_len, 1) &&
+           siml_emit_put(e, "|", 1) &&
+           siml_emit_line_end(e, spaces, text, len);
+}
+
+int siml_emit_block_scalar_start(siml_emitter *e, const char *key,
+                                 size_t key_len) {
+    size_t len;
+
+    if (!e || e->failed) return 0;
+    len = e->comment_len;
+    e->comment_len = 0;
+    return siml_emit_block_line_start(e, key, key_len, e->comment_spaces,
+                                      e->comment, len);
+}
+
+/* Lines are indented one step past the block scalar's own line; empty
+ * lines stay empty.
+ */
+int siml_emit_block_scalar_line(siml_emitter *e, const char *text,
+                                size_t len) {
+    size_t indent = e && e->depth > 1 ? (size_t)(e->depth - 1) * 2 : 0;
+
+    if (!e || e->failed) return 0;
+    if (e->flow > 0) return siml_emit_fail(e);
+    if (len > 0 && (!siml_emit_spaces(e, indent + 2) ||
+                    !siml_emit_put(e, text, len))) {
+        return 0;
+    }
+    return siml_emit_put(e, "\n", 1);
+}
+
+int siml_emit_comment(siml_emitter *e, const char *text, size_t len) {
+    if (!e || e->failed) return 0;
+    if (e->flow > 0) return siml_emit_fail(e);
+    return siml_emit_separator(e) &&
+           siml_emit_put(e, text, len) &&
+           siml_emit_put(e, "\n", 1);
+}
+
+int siml_emit_inline_comment(siml_emitter *e, unsigned int spaces,
+                             const char *text, size_t len) {
+    if (!e || e->failed) return 0;
+    if (len > SIML_MAX_INLINE_COMMENT_TEXT_LEN) {
+        len = SIML_MAX_INLINE_COMMENT_TEXT_LEN;
+    }
+    if (len > 0) memcpy(e->comment, text, len);
+    e->comment_spaces = spaces;
+    e->comment_len = len;
+    return 1;
+}
+
+int siml_emit(siml_emitter *e, const siml_event *ev) {
+    if (!e || !ev || e->failed) return 0;
+    switch (ev->type) {
+    case SIML_EVENT_STREAM_END:
+        return siml_emit_flush(e);
+    case SIML_EVENT_DOCUMENT_START:
+        return siml_emit_separator(e);
+    case SIML_EVENT_DOCUMENT_END:
+        e->document_end = 1;
+        return 1;
+    case SIML_EVENT_MAPPING_START:
+        return siml_emit_open(e, SIML_CONTAINER_MAP, ev->key.ptr, ev->key.len);
+    case SIML_EVENT_SEQUENCE_START:
+        /* The comment ends the line, after the outermost "]". */
+        if (ev->seq_style == SIML_SEQ_STYLE_FLOW && e->flow == 0) {
+            (void)siml_emit_inline_comment(e, ev->inline_comment_spaces,
+                                           ev->inline_comment.ptr,
+                                           ev->inline_comment.len);
+        }
+        return siml_emit_sequence_start(e, ev->key.ptr, ev->key.len,
+                                        ev->seq_style);
+    case SIML_EVENT_SCALAR:
+        return siml_emit_scalar_line(e, ev->key.ptr, ev->key.len,
+                                     ev->value.ptr, ev->value.len,
+                                     ev->inline_comment_spaces,
+                                     ev->inline_comment.ptr,
+                                     ev->inline_comment.len);
+    case SIML_EVENT_BLOCK_SCALAR_START:
+        return siml_emit_block_line_start(e, ev->key.ptr, ev->key.len,
+                                          ev->inline_comment_spaces,
+                                          ev->inline_comment.ptr,
+                                          ev->inline_comment.len);
+    case SIML_EVENT_BLOCK_SCALAR_LINE:
+        return siml_emit_block_scalar_line(e, ev->value.ptr, ev->value.len);
+    case SIML_EVENT_SEQUENCE_END:
+        return siml_emit_close(e, SIML_CONTAINER_SEQ);
+    case SIML_EVENT_MAPPING_END:
+        return siml_emit_close(e, SIML_CONTAINER_MAP);
+    case SIML_EVENT_COMMENT:
+        return siml_emit_comment(e, ev->value.ptr, ev->value.len);
+    case SIML_EVENT_ERROR:
+        return 0;
+    default:
+        return 1;
+    }
+}
+
 #endif /* SIML_IMPLEMENTATION */
 
 #endif /* SIML_H_INCLUDED */
@@ -5,6 +5,12 @@ ROOT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
 BUILD_DIR="${BUILD_DIR:-"$ROOT_DIR/build"}"
 BIN="${BIN:-"$BUILD_DIR/siml-dump"}"
 BIN_ROUNDTRIP="${BIN_ROUNDTRIP:-"$BUILD_DIR/siml-roundtrip"}"
+BIN_LINT="${BIN_LINT:-"$BUILD_DIR/siml-lint"}"
+BIN_COLUMNS="${BIN_COLUMNS:-"$BUILD_DIR/siml-columns"}"
+BIN_COMPILE="${BIN_COMPILE:-"$BUILD_DIR/siml-compile"}"
+BIN_INDEX="${BIN_INDEX:-"$BUILD_DIR/siml-index"}"
+# siml-dump with the SIML_TEST_* hooks: read errors, push chunks, -j units
+BIN_TEST="${BIN_TEST:-"$BUILD_DIR/siml-dump-test"}"
 TEST_DIR="$ROOT_DIR/tests"
 
 if [[ "${DEBUG:-}" != "" ]]; then
@@ -17,6 +23,9 @@ fi
 "$ROOT_DIR/build.sh"
 
 rc=0
+cache_dir="$TEST_DIR/cache.tmp"
+rm -rf "$cache_dir"
+mkdir "$cache_dir"
 
 for siml in "$TEST_DIR"/*.siml; do
     [ -e "$siml" ] || continue
@@ -48,6 +57,62 @@ for siml in "$TEST_DIR"/*.siml; do
             rc=1
             continue
         fi
+        if [[ "$(basename "$siml")" != "xfail_io_error.siml" ]]; then
+            if "$BIN" - <"$siml" >"$out" 2>"$err" ||
+               ! grep -F -q "$expected_err" "$err"; then
+                echo "[test] FAILED (stdin error mismatch): $siml" >&2
+                cat "$err" >&2
+                rc=1
+                continue
+            fi
+            if "$BIN" -r prefetch "$siml" >"$out" 2>"$err" ||
+               ! grep -F -q "$expected_err" "$err"; then
+                echo "[test] FAILED (prefetch error mismatch): $siml" >&2
+                cat "$err" >&2
+                rc=1
+                continue
+            fi
+            if SIML_TEST_PUSH_CHUNK=7 "$BIN_TEST" -r push "$siml" >"$out" 2>"$err" ||
+               ! grep -F -q "$expected_err" "$err"; then
+                echo "[test] FAILED (push error mismatch): $siml" >&2
+                cat "$err" >&2
+                rc=1
+                continue
+            fi
+            if SIML_TEST_PARALLEL_UNIT=1 "$BIN_TEST" -j 3 "$siml" >"$out" 2>"$err" ||
+               ! grep -F -q "$expected_err" "$err"; then
+                echo "[test] FAILED (parallel error mismatch): $siml" >&2
+                cat "$err" >&2
+                rc=1
+                continue
+            fi
+            if "$BIN" -d "$siml" >"$out" 2>"$err" ||
+               ! grep -F -q "$expected_err" "$err"; then
+                echo "[test] FAILED (dom error mismatch): $siml" >&2
+                cat "$err" >&2
+                rc=1
+                continue
+            fi
+            # The first run records the tape, the second replays it.
+            for pass in record replay; do
+                if "$BIN" -r tape "$siml" >"$out" 2>"$err" ||
+                   ! grep -F -q "$expected_err" "$err"; then
+                    echo "[test] FAILED (tape $pass error mismatch): $siml" >&2
+                    cat "$err" >&2
+                    rc=1
+                fi
+            done
+            rm -f "$siml.tape"
+            # The first run stores the cache entry, the second reads it.
+            for pass in store hit; do
+                if "$BIN" -c "$cache_dir" "$siml" >"$out" 2>"$err" ||
+                   ! grep -F -q "$expected_err" "$err"; then
+                    echo "[test] FAILED (cache $pass error mismatch): $siml" >&2
+                    cat "$err" >&2
+                    rc=1
+                fi
+            done
+        fi
         rm -f "$out" "$err"
         continue
     fi
@@ -65,12 +130,517 @@ for siml in "$TEST_DIR"/*.siml; do
         else
             rm -f "$out"
         fi
+        if ! "$BIN" - <"$siml" | diff -u "$gold" -; then
+            echo "[test] FAILED (stdin output mismatch): $siml" >&2
+            rc=1
+        fi
+        if ! "$BIN" -r prefetch "$siml" | diff -u "$gold" -; then
+            echo "[test] FAILED (prefetch output mismatch): $siml" >&2
+            rc=1
+        fi
+        if ! SIML_TEST_PUSH_CHUNK=7 "$BIN_TEST" -r push "$siml" | diff -u "$gold" -; then
+            echo "[test] FAILED (push output mismatch): $siml" >&2
+            rc=1
+        fi
+        if ! SIML_TEST_PARALLEL_UNIT=1 "$BIN_TEST" -j 3 "$siml" | diff -u "$gold" -; then
+            echo "[test] FAILED (parallel output mismatch): $siml" >&2
+            rc=1
+        fi
+        if ! "$BIN" -d "$siml" | diff -u "$gold" -; then
+            echo "[test] FAILED (dom output mismatch): $siml" >&2
+            rc=1
+        fi
+        if ! SIML_TEST_PUSH_CHUNK=7 "$BIN_TEST" -r push -d "$siml" | diff -u "$gold" -; then
+            echo "[test] FAILED (dom push output mismatch): $siml" >&2
+            rc=1
+        fi
+        for pass in record replay; do
+            if ! "$BIN" -r tape "$siml" | diff -u "$gold" -; then
+                echo "[test] FAILED (tape $pass output mismatch): $siml" >&2
+                rc=1
+            fi
+        done
+        rm -f "$siml.tape"
+        for pass in store hit; do
+            if ! "$BIN" -c "$cache_dir" "$siml" | diff -u "$gold" -; then
+                echo "[test] FAILED (cache $pass output mismatch): $siml" >&2
+                rc=1
+            fi
+        done
     fi
 
     if ! "$BIN_ROUNDTRIP" "$siml"; then
         echo "[test] FAILED (roundtrip mismatch): $siml" >&2
         rc=1
     fi
+    # Written out, the text is the source with its final newline.
+    if ! "$BIN_ROUNDTRIP" -o - "$siml" | cmp -s <(sed -e '$a\' "$siml") -; then
+        echo "[test] FAILED (emitter output mismatch): $siml" >&2
+        rc=1
+    fi
+
+    # The compiled image must give back the source and the same tree.
+    if ! "$BIN_COMPILE" "$siml" "$siml.simlb" ||
+       ! "$BIN_COMPILE" -d "$siml.simlb" - | cmp -s "$siml" -; then
+        echo "[test] FAILED (simlb roundtrip mismatch): $siml" >&2
+        rc=1
+    elif [ -f "$gold" ] &&
+         ! "$BIN" -r simlb "$siml.simlb" | diff -u "$gold" -; then
+        echo "[test] FAILED (simlb dom output mismatch): $siml" >&2
+        rc=1
+    fi
+    rm -f "$siml.simlb"
+done
+
+# A damaged image is rejected when it loads.
+echo "[test] siml-dump -r simlb damaged image"
+simlb="$TEST_DIR/basic.simlb"
+"$BIN_COMPILE" "$TEST_DIR/basic.siml" "$simlb"
+head -c 200 "$simlb" >"$simlb.cut"
+if "$BIN" -r simlb "$simlb.cut" >/dev/null 2>"$simlb.err" ||
+   ! grep -F -q "invalid compiled image" "$simlb.err"; then
+    echo "[test] FAILED (truncated simlb accepted)" >&2
+    rc=1
+fi
+rm -f "$simlb" "$simlb.cut" "$simlb.err"
+
+# A document tree over its memory limit fails instead of growing.
+echo "[test] siml-dump -d memory limit"
+if "$BIN" -b 600 -d "$TEST_DIR/multi_docs.siml" \
+       >/dev/null 2>"$TEST_DIR/dom.err" ||
+   ! grep -F -q "DOM memory limit exceeded" "$TEST_DIR/dom.err"; then
+    echo "[test] FAILED (dom memory limit not enforced)" >&2
+    rc=1
+fi
+rm -f "$TEST_DIR/dom.err"
+
+# Path queries over the document tree print the first line of the node.
+check_query() {
+    local file="$TEST_DIR/$1" got
+    got="$("$BIN" "${@:4}" -q "$2" "$file" 2>&1 | head -n 1 || true)"
+    if [[ "$got" != "$3" ]]; then
+        echo "[test] FAILED (query $2 in $1): got: $got" >&2
+        rc=1
+    fi
+}
+echo "[test] siml-dump -q"
+check_query basic.siml "[1].min" "SCALAR key=min value='0.1'"
+check_query basic.siml "flags[1]" "SCALAR value='CVAR_TEMP'"
+check_query basic.siml "[2]" "$TEST_DIR/basic.siml: no node at [2]"
+check_query mapping_duplicate_keys.siml foo "SCALAR key=foo value='baz'"
+check_query mapping_duplicate_keys.siml foo "SCALAR key=foo value='bar'" -l
+check_query keys_with_punctuation.siml "list-key.with-dash[0]" "SCALAR value='one-two'"
+check_query mapping_many_keys.siml key_05 "SCALAR key=key_05 value='value 5'"
+check_query mapping_many_keys.siml key_05 "SCALAR key=key_05 value='last'" -l
+check_query mapping_many_keys.siml key_19 "SCALAR key=key_19 value='value 19'"
+check_query mapping_many_keys.siml range.max "SCALAR key=max value='9'"
+check_query mapping_many_keys.siml "[range.min]" "SCALAR key=range.min value='dotted'"
+check_query mapping_many_keys.siml "items[17]" "SCALAR value='item 17'"
+check_query mapping_many_keys.siml "items[18]" "$TEST_DIR/mapping_many_keys.siml: no node at items[18]"
+check_query mapping_many_keys.siml "items..x" "$TEST_DIR/mapping_many_keys.siml: no node at items..x"
+
+# Skipping the nodes opened at a nesting level must leave exactly the events
+# outside them, whatever the skip mode.
+skip_gold() {
+    awk -v L="$1" '
+        /^(MAPPING|SEQUENCE|BLOCK_SCALAR)_START/ { if (++lvl <= L) print; next }
+        /^(MAPPING|SEQUENCE|BLOCK_SCALAR)_END/ { if (lvl-- <= L) print; next }
+        { if (lvl < L) print }' "$2"
+}
+echo "[test] siml-dump -s"
+for gold in "$TEST_DIR"/*.gold; do
+    siml="${gold%.gold}.siml"
+    for level in 1 2; do
+        for mode in validate lines indent; do
+            if ! "$BIN" -m $mode -s $level "$siml" |
+                    diff -u <(skip_gold $level "$gold") -; then
+                echo "[test] FAILED (skip $mode level $level): $siml" >&2
+                rc=1
+            fi
+        done
+        if ! SIML_TEST_PUSH_CHUNK=7 "$BIN_TEST" -r push -s $level "$siml" |
+                diff -u <(skip_gold $level "$gold") -; then
+            echo "[test] FAILED (skip push level $level): $siml" >&2
+            rc=1
+        fi
+    done
 done
 
+# Subscriptions report the same events in every skip mode and reader.
+check_filter() {
+    local file="$TEST_DIR/$1" expected="$2" mode
+    shift 2
+    for mode in validate lines indent; do
+        if ! "$BIN" -m $mode "$@" "$file" |
+                diff -u <(printf '%s\n' "$expected") -; then
+            echo "[test] FAILED (filter $mode $*): $file" >&2
+            rc=1
+        fi
+    done
+    if ! SIML_TEST_PUSH_CHUNK=7 "$BIN_TEST" -r push -d "$@" "$file" |
+            diff -u <(printf '%s\n' "$expected") -; then
+        echo "[test] FAILED (filter dom push $*): $file" >&2
+        rc=1
+    fi
+}
+echo "[test] siml-dump -f"
+check_filter basic.siml "STREAM_START
+DOCUMENT_START
+MAPPING_START
+SCALAR key=id value='r_fullscreen'
+SEQUENCE_START style=flow key=flags  # (spaces=3) !important!
+SCALAR value='CVAR_ARCHIVE'
+SCALAR value='CVAR_TEMP'
+SEQUENCE_END
+MAPPING_END
+DOCUMENT_END
+DOCUMENT_START
+MAPPING_START
+SCALAR key=id value='cl_sensitivity'
+SEQUENCE_START style=flow key=flags
+SEQUENCE_END
+MAPPING_END
+DOCUMENT_END
+STREAM_END" -f id -f flags
+check_filter mapping_many_keys.siml "STREAM_START
+DOCUMENT_START
+MAPPING_START
+SCALAR key=key_19 value='value 19'
+MAPPING_START key=range
+SCALAR key=max value='9'
+MAPPING_END
+MAPPING_END
+DOCUMENT_END
+STREAM_END" -f range.max -f key_19
+check_filter mapping_many_keys.siml "STREAM_START
+DOCUMENT_START
+MAPPING_START
+SCALAR key=range.min value='dotted'
+MAPPING_END
+DOCUMENT_END
+STREAM_END" -f "[range.min]"
+check_filter mapping_many_keys.siml "STREAM_START
+DOCUMENT_START
+MAPPING_START
+MAPPING_START key=range
+SCALAR key=min value='0'
+MAPPING_END
+MAPPING_END
+DOCUMENT_END
+STREAM_END" -f range.min
+# Subscriptions have no item steps; [n] is rejected rather than never met.
+if "$BIN" -f "flags[1]" "$TEST_DIR/basic.siml" >/dev/null 2>&1 ||
+   "$BIN_COLUMNS" -c "flags[1]" "$TEST_DIR/basic.siml" >/dev/null 2>&1; then
+    echo "[test] FAILED (item step accepted in a subscription path)" >&2
+    rc=1
+fi
+check_filter record_list.siml "STREAM_START
+DOCUMENT_START
+SEQUENCE_START style=block
+MAPPING_START
+SCALAR key=id value='1'
+MAPPING_START key=payload
+SEQUENCE_START style=flow key=tags
+SCALAR value='a'
+SCALAR value='b'
+SEQUENCE_END
+MAPPING_END
+MAPPING_END
+MAPPING_START
+SCALAR key=id value='2'
+MAPPING_START key=payload
+SEQUENCE_START style=flow key=tags
+SEQUENCE_END
+MAPPING_END
+MAPPING_END
+SEQUENCE_END
+DOCUMENT_END
+STREAM_END" -f "*.id" -f "*.payload.tags"
+
+# Interned keys: each distinct key gets one id, numbered from 1 in order of
+# first appearance, whatever the reader.
+echo "[test] siml-dump -k"
+for gold in "$TEST_DIR"/*.gold; do
+    siml="${gold%.gold}.siml"
+    for reader in mmap push; do
+        out="$(SIML_TEST_PUSH_CHUNK=7 "$BIN_TEST" -r $reader -k "$siml")"
+        if ! diff -u "$gold" <(printf '%s\n' "$out" | sed 's/ id=[0-9]*//'); then
+            echo "[test] FAILED (key ids $reader output mismatch): $siml" >&2
+            rc=1
+        fi
+        if ! printf '%s\n' "$out" |
+                sed -n 's/.* key=\([^ ]*\) id=\([0-9]*\).*/\1 \2/p' |
+                awk '!($1 in id) { id[$1] = $2; if ($2 != ++n) bad = 1 }
+                     id[$1] != $2 { bad = 1 }
+                     END { exit bad }'; then
+            echo "[test] FAILED (key ids $reader not dense and stable): $siml" >&2
+            rc=1
+        fi
+    done
+done
+
+# siml-columns must give the same table from a mapped file, from stdin and
+# with one row per batch.
+check_columns() {
+    local file="$TEST_DIR/$1" expected="$2"
+    shift 2
+    if ! "$BIN_COLUMNS" "$@" "$file" |
+            diff -u <(printf '%s\n' "$expected") -; then
+        echo "[test] FAILED (columns $*): $file" >&2
+        rc=1
+    fi
+    if ! "$BIN_COLUMNS" -b 1 "$@" - <"$file" |
+            diff -u <(printf '%s\n' "$expected") -; then
+        echo "[test] FAILED (columns stdin -b 1 $*): $file" >&2
+        rc=1
+    fi
+}
+echo "[test] siml-columns"
+check_columns basic.siml "$(printf '%s\t%s\t%s\n' \
+    id default flags \
+    r_fullscreen 1 '' \
+    cl_sensitivity 3 '')" -c id -n default -c flags
+check_columns mapping_many_keys.siml "$(printf '%s\t%s\t%s\n' \
+    key_19 range.max range \
+    'value 19' 9 '')" -c key_19 -n range.max -c range
+check_columns mapping_many_keys.siml "$(printf '%s\t%s\n' \
+    range.min '[range.min]' \
+    0 dotted)" -c range.min -c "[range.min]"
+check_columns record_list.siml "$(printf '%s\t%s\t%s\t%s\n' \
+    id payload.size payload.nested.deep description \
+    1 3 value 'first record\n\nspans lines' \
+    2 0 '' 'second record')" \
+    -i -c id -n payload.size -c payload.nested.deep -c description
+# Only decimal numbers are numbers, whatever strtod() would take.
+for v in 12 -0.5 +1.5e2 inf nan 0x10 .5 1.; do
+    printf 'n: %s\ns: %s\n---\n' "$v" "$v"
+done | sed '$d' >"$TEST_DIR/numbers.tmp"
+check_columns numbers.tmp "$(printf '%s\t%s\n' n s 12 12 -0.5 -0.5 \
+    150 +1.5e2 '' inf '' nan '' 0x10 '' .5 '' 1.)" -n n -c s
+rm -f "$TEST_DIR/numbers.tmp"
+# Binary columns: rows + 1 offsets from 0, however the rows are batched.
+cols_dir="$(mktemp -d)"
+"$BIN_COLUMNS" -o "$cols_dir" -b 1 -c id "$TEST_DIR/basic.siml"
+if [[ "$(od -A n -t u8 -v "$cols_dir/0.off" | xargs)" != "0 12 26" ]] ||
+   [[ "$(cat "$cols_dir/0.bytes")" != "r_fullscreencl_sensitivity" ]]; then
+    echo "[test] FAILED (columns -o offsets)" >&2
+    rc=1
+fi
+rm -rf "$cols_dir"
+
+# Documents read through the index match the text between separators, and
+# errors in them keep the line numbers of the whole stream.
+echo "[test] siml-index"
+for name in multi_docs doc_separators basic; do
+    siml="$TEST_DIR/$name.siml"
+    if ! "$BIN_INDEX" -k id "$siml"; then
+        echo "[test] FAILED (index build): $siml" >&2
+        rc=1
+        continue
+    fi
+    docs="$(grep -c -x -e '---' "$siml" || true)"
+    for ((n = 0; n <= docs; n++)); do
+        if ! "$BIN_INDEX" -n "$n" "$siml" |
+                diff -u <(awk -v n="$n" '/^---$/ { d++; next } d == n' \
+                              "$siml") -; then
+            echo "[test] FAILED (index document $n): $siml" >&2
+            rc=1
+        fi
+    done
+    if "$BIN_INDEX" -n "$((docs + 1))" "$siml" 2>/dev/null; then
+        echo "[test] FAILED (index document past the end): $siml" >&2
+        rc=1
+    fi
+done
+if ! "$BIN_INDEX" -f id=cl_sensitivity "$TEST_DIR/basic.siml" |
+        grep -F -x -q "id: cl_sensitivity"; then
+    echo "[test] FAILED (index lookup by key)" >&2
+    rc=1
+fi
+rm -f "$TEST_DIR"/*.idx
+siml="$TEST_DIR/xfail_error_in_later_document.siml"
+if "$BIN_INDEX" -k id "$siml" 2>/dev/null ||
+   ! "$BIN_INDEX" -s -k id "$siml" ||
+   ! "$BIN_INDEX" -f id=third "$siml" >/dev/null ||
+   [[ "$("$BIN_INDEX" -f id=second "$siml" 2>&1)" != \
+      "$("$BIN" "$siml" 2>&1 >/dev/null)" ]]; then
+    echo "[test] FAILED (index error line): $siml" >&2
+    rc=1
+fi
+cp "$siml" "$TEST_DIR/index_stale.tmp"
+"$BIN_INDEX" -s "$TEST_DIR/index_stale.tmp"
+echo "id: fourth" >>"$TEST_DIR/index_stale.tmp"
+if "$BIN_INDEX" -n 0 "$TEST_DIR/index_stale.tmp" >/dev/null 2>&1; then
+    echo "[test] FAILED (stale index used)" >&2
+    rc=1
+fi
+# Same length, same second: only the content tells the index is stale.
+"$BIN_INDEX" -s "$TEST_DIR/index_stale.tmp"
+sed -i 's/fourth/fifth!/' "$TEST_DIR/index_stale.tmp"
+if "$BIN_INDEX" -n 0 "$TEST_DIR/index_stale.tmp" >/dev/null 2>&1; then
+    echo "[test] FAILED (stale index used after same-length edit)" >&2
+    rc=1
+fi
+rm -f "$TEST_DIR"/*.idx "$TEST_DIR/index_stale.tmp"
+
+# siml-lint checks the whole directory in one run and must report exactly
+# the xfail cases, each with its expected message.
+echo "[test] siml-lint $TEST_DIR"
+lint_out="$TEST_DIR/lint.out"
+if "$BIN_LINT" -j 3 "$TEST_DIR" 2>"$lint_out"; then
+    echo "[test] FAILED (siml-lint reported no errors)" >&2
+    rc=1
+fi
+for siml in "$TEST_DIR"/*.siml; do
+    [ -e "$siml" ] || continue
+    xfail="${siml%.siml}.xfail"
+    if [[ "$(basename "$siml")" == "xfail_io_error.siml" ]]; then
+        continue
+    fi
+    if [ -f "$xfail" ]; then
+        if ! grep -F "$siml: SIML error at line " "$lint_out" |
+             grep -F -q "$(cat "$xfail")"; then
+            echo "[test] FAILED (siml-lint error mismatch): $siml" >&2
+            rc=1
+        fi
+    elif grep -F -q "$siml: " "$lint_out"; then
+        echo "[test] FAILED (siml-lint unexpected error): $siml" >&2
+        rc=1
+    fi
+done
+if ! LC_ALL=C sort -c "$lint_out"; then
+    echo "[test] FAILED (siml-lint output not sorted by path)" >&2
+    rc=1
+fi
+rm -f "$lint_out"
+
+# Links to .siml files are checked, links to directories are not followed:
+# a link back up the tree must not report the same file again and again.
+walk_dir="$TEST_DIR/walk.tmp"
+rm -rf "$walk_dir"
+mkdir -p "$walk_dir/sub"
+printf 'a: 1\r\n' >"$walk_dir/sub/bad.siml"
+ln -s .. "$walk_dir/sub/loop"
+ln -s sub/bad.siml "$walk_dir/link.siml"
+"$BIN_LINT" "$walk_dir" 2>"$TEST_DIR/lint.out" || true
+if [[ "$(grep -c 'SIML error' "$TEST_DIR/lint.out")" != 2 ]]; then
+    echo "[test] FAILED (siml-lint directory walk)" >&2
+    rc=1
+fi
+rm -rf "$walk_dir"
+rm -f "$TEST_DIR/lint.out"
+# An unreadable directory fails the run (root reads it anyway).
+if [[ "$(id -u)" != 0 ]]; then
+    mkdir -p "$walk_dir/locked"
+    chmod 000 "$walk_dir/locked"
+    if "$BIN_LINT" "$walk_dir" 2>/dev/null; then
+        echo "[test] FAILED (siml-lint passed an unreadable directory)" >&2
+        rc=1
+    fi
+    chmod 755 "$walk_dir/locked"
+    rm -rf "$walk_dir"
+fi
+
+# With a cache, siml-lint reports the same, and a second run takes every
+# verdict from the cache: an entry changed behind its back shows through.
+echo "[test] siml-lint -c"
+rm -rf "$cache_dir"
+mkdir "$cache_dir"
+"$BIN_LINT" "$TEST_DIR" 2>"$TEST_DIR/lint.out" || true
+"$BIN_LINT" -c "$cache_dir" "$TEST_DIR" 2>"$TEST_DIR/lint_store.out" || true
+"$BIN_LINT" -c "$cache_dir" "$TEST_DIR" 2>"$TEST_DIR/lint_hit.out" || true
+if ! cmp -s "$TEST_DIR/lint.out" "$TEST_DIR/lint_store.out" ||
+   ! cmp -s "$TEST_DIR/lint.out" "$TEST_DIR/lint_hit.out"; then
+    echo "[test] FAILED (siml-lint -c output mismatch)" >&2
+    rc=1
+fi
+LC_ALL=C sed -i 's/empty flow sequence element/EMPTY FLOW SEQUENCE ELEMENT/' \
+    "$cache_dir"/*
+"$BIN_LINT" -c "$cache_dir" "$TEST_DIR" 2>"$TEST_DIR/lint_hit.out" || true
+if ! grep -F -q "EMPTY FLOW SEQUENCE ELEMENT" "$TEST_DIR/lint_hit.out"; then
+    echo "[test] FAILED (siml-lint -c did not read the cache)" >&2
+    rc=1
+fi
+# An outcome stored without UTF-8 validation is not taken by a check with it.
+utf8_siml="$TEST_DIR/xfail_utf8_invalid.siml"
+if ! "$BIN" -a -c "$cache_dir" "$utf8_siml" \
+        >/dev/null 2>&1; then
+    echo "[test] FAILED (siml-dump -c without UTF-8 validation)" >&2
+    rc=1
+fi
+if "$BIN" -c "$cache_dir" "$utf8_siml" >/dev/null 2>"$TEST_DIR/lint_hit.out" ||
+   ! grep -F -q "$(cat "${utf8_siml%.siml}.xfail")" "$TEST_DIR/lint_hit.out"
+then
+    echo "[test] FAILED (siml-dump -c took an entry stored with other options)" >&2
+    rc=1
+fi
+# An entry whose tape does not replay is reported as such.
+rm -rf "$cache_dir"
+mkdir "$cache_dir"
+"$BIN" -c "$cache_dir" "$TEST_DIR/mapping_many_keys.siml" >/dev/null
+printf 'X' | dd of="$(echo "$cache_dir"/*)" bs=1 seek=48 conv=notrunc \
+    2>/dev/null
+if "$BIN" -c "$cache_dir" "$TEST_DIR/mapping_many_keys.siml" >/dev/null \
+        2>"$TEST_DIR/lint_hit.out" ||
+   ! grep -F -q "damaged entry in cache" "$TEST_DIR/lint_hit.out"; then
+    echo "[test] FAILED (siml-dump -c damaged cache entry)" >&2
+    rc=1
+fi
+rm -rf "$cache_dir"
+# Likewise a tape recorded without UTF-8 validation is recorded again for a
+# run with it, and the other way round.
+echo "[test] siml-dump -r tape with other options"
+rm -f "$utf8_siml.tape"
+if ! "$BIN" -a -r tape "$utf8_siml" >/dev/null 2>&1; then
+    echo "[test] FAILED (siml-dump -r tape without UTF-8 validation)" >&2
+    rc=1
+fi
+if "$BIN" -r tape "$utf8_siml" >/dev/null 2>"$TEST_DIR/lint_hit.out" ||
+   ! grep -F -q "$(cat "${utf8_siml%.siml}.xfail")" "$TEST_DIR/lint_hit.out"
+then
+    echo "[test] FAILED (siml-dump -r tape replayed a tape of other options)" >&2
+    rc=1
+fi
+if ! "$BIN" -a -r tape "$utf8_siml" >/dev/null 2>&1; then
+    echo "[test] FAILED (siml-dump -a -r tape replayed a validating tape)" >&2
+    rc=1
+fi
+rm -f "$utf8_siml.tape"
+rm -f "$TEST_DIR/lint.out" "$TEST_DIR/lint_store.out" \
+    "$TEST_DIR/lint_hit.out"
+
+# siml-lint -e checks a file again after each edit; with -x every result must
+# be the one a parse of the whole edited file gives.
+echo "[test] siml-lint -e"
+script="$TEST_DIR/lint_edits.tmp"
+printf '%s\n' '114 0  ' '114 1' '84 0 -\n' '84 2' '16 0 second: two\n' \
+    '84 0 ---\n' '88 4' >"$script"
+siml="$TEST_DIR/multi_docs.siml"
+if ! "$BIN_LINT" -e "$script" -x "$siml" |
+        diff -u - <(printf "$siml: edit %s\n" \
+            '0: ok' \
+            '1: SIML error at line 12: indentation must be a multiple of 2 spaces' \
+            '2: ok' \
+            '3: SIML error at line 9: nested node indentation mismatch, expected 2 got 0' \
+            '4: ok' \
+            '5: ok' \
+            '6: SIML error at line 9: unknown line form' \
+            '7: SIML error at line 9: unknown line form'); then
+    echo "[test] FAILED (siml-lint -e): $siml" >&2
+    rc=1
+fi
+# A unit keeps an error on the entry line after it, which here depends on
+# the line after that: a CR line is a CRLF once a complete line follows.
+printf '%s\n' '7 3 key: v # c\n' >"$script"
+siml="$TEST_DIR/lint_edits_cr.tmp"
+printf 'a: 1\n\r\nb:2' >"$siml"
+if ! "$BIN_LINT" -e "$script" -x "$siml" |
+        diff -u - <(printf "$siml: edit %s\n" \
+            '0: SIML error at line 2: final line without LF' \
+            '1: SIML error at line 2: CRLF is forbidden (\r\n found)'); then
+    echo "[test] FAILED (siml-lint -e after a CR line): $siml" >&2
+    rc=1
+fi
+rm -f "$script" "$siml"
+
 exit "$rc"